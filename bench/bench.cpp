@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "graph_capture.hpp"
+#include "linear.hpp"
+#include "quantization.hpp"
+#include "tensor.hpp"
+#include "thread_pool.hpp"
+
+using namespace micro;
+
+/**
+ * Micro-benchmarks for the kernels and the autograd engine. Every case runs one warm-up
+ * iteration and then repeats until it has been measured for at least --min-time seconds; the
+ * median iteration time is reported as ns/element, GFLOP/s and GB/s.
+ *
+ * Usage: micro_torch_bench [--filter <substring>] [--min-time <seconds>] [--json <file|->]
+ */
+
+struct BenchResult {
+    std::string name;
+    int64_t iterations;
+    double median_ns;
+    int64_t elements;
+    double flops, bytes;
+};
+
+struct BenchOptions {
+    std::string filter;
+    std::string json_path;
+    double min_time = 0.25;
+};
+
+class BenchRunner {
+   public:
+    explicit BenchRunner(BenchOptions options) : m_options(std::move(options)) {}
+
+    // elements, flops and bytes are per iteration of fn; bytes counts every read and write
+    template <typename Fn>
+    void run(const std::string& name, int64_t elements, double flops, double bytes, Fn&& fn) {
+        if (!m_options.filter.empty() && name.find(m_options.filter) == std::string::npos) return;
+
+        using clock = std::chrono::steady_clock;
+        fn();
+
+        std::vector<double> samples;
+        double total = 0;
+        while (samples.size() < 3 || total < m_options.min_time * 1e9) {
+            auto start = clock::now();
+            fn();
+            double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+            samples.push_back(ns);
+            total += ns;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        BenchResult result{name, int64_t(samples.size()), samples[samples.size() / 2], elements, flops, bytes};
+        print(log(), result);
+        m_results.push_back(result);
+    }
+
+    void write_json() const {
+        if (m_options.json_path.empty()) return;
+
+        std::ofstream file;
+        if (m_options.json_path != "-") file.open(m_options.json_path);
+        std::ostream& os = m_options.json_path == "-" ? std::cout : file;
+
+        os << "{\n  \"num_threads\": " << get_num_threads() << ",\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < m_results.size(); i++) {
+            const auto& r = m_results[i];
+            os << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+               << ", \"median_ns\": " << r.median_ns << ", \"elements\": " << r.elements
+               << ", \"ns_per_element\": " << r.median_ns / r.elements << ", \"gflops\": " << r.flops / r.median_ns
+               << ", \"gbps\": " << r.bytes / r.median_ns << "}" << (i + 1 < m_results.size() ? "," : "") << "\n";
+        }
+        os << "  ]\n}\n";
+    }
+
+    // The table goes to stderr when the JSON report is written to stdout
+    std::ostream& log() const { return m_options.json_path == "-" ? std::cerr : std::cout; }
+
+   private:
+    static void print(std::ostream& os, const BenchResult& r) {
+        os << std::left << std::setw(36) << r.name << std::right << std::fixed << std::setprecision(3)
+           << std::setw(14) << r.median_ns / 1e3 << " us" << std::setw(12) << r.median_ns / r.elements << " ns/el"
+           << std::setw(10) << r.flops / r.median_ns << " GFLOP/s" << std::setw(10) << r.bytes / r.median_ns << " GB/s"
+           << std::endl;
+    }
+
+    BenchOptions m_options;
+    std::vector<BenchResult> m_results;
+};
+
+// Filled with small non-zero values so that division and long reductions stay finite
+Tensor make_tensor(const std::vector<uint32_t>& shape, Type dtype = Type::FLOAT32) {
+    Tensor t(shape);
+    std::vector<Element> values(t.size());
+    for (size_t i = 0; i < values.size(); i++) values[i] = Element(float(i % 13 + 1) / 8.f);
+
+    t = values;
+    return dtype == Type::FLOAT32 ? t : t.to(dtype);
+}
+
+void bench_element_wise(BenchRunner& runner) {
+    const uint32_t rows = 1024, cols = 1024;
+    const int64_t n = int64_t(rows) * cols;
+    const double fp32 = sizeof(float);
+
+    Tensor a = make_tensor({rows, cols}), b = make_tensor({rows, cols}), bias = make_tensor({cols});
+    Tensor b_t = make_tensor({cols, rows}).transpose();
+
+    runner.run("add/contiguous/1024x1024", n, n, 3 * n * fp32, [&] { auto c = a + b; });
+    runner.run("mul/contiguous/1024x1024", n, n, 3 * n * fp32, [&] { auto c = a * b; });
+    runner.run("div/contiguous/1024x1024", n, n, 3 * n * fp32, [&] { auto c = a / b; });
+    runner.run("add/broadcast/1024x1024+1024", n, n, (2 * n + cols) * fp32, [&] { auto c = a + bias; });
+    runner.run("add/transposed/1024x1024", n, n, 3 * n * fp32, [&] { auto c = a + b_t; });
+
+    Tensor ai = make_tensor({rows, cols}, Type::INT32), bi = make_tensor({rows, cols}, Type::INT32);
+    runner.run("add/contiguous/int32/1024x1024", n, n, 3 * n * fp32, [&] { auto c = ai + bi; });
+
+    // The same four-op chain run op by op and as one fused loop; bytes count a single pass
+    double chain_bytes = (3 * n + cols) * fp32;
+    runner.run("chain/eager/1024x1024", n, 4 * n, chain_bytes, [&] { auto c = (a * b + bias - a) * 2.f; });
+    runner.run("chain/lazy/1024x1024", n, 4 * n, chain_bytes, [&] {
+        LazyGuard lazy;
+        auto c = (a * b + bias - a) * 2.f;
+        (void)c[{0, 0}];
+    });
+}
+
+void bench_scalar(BenchRunner& runner) {
+    const uint32_t rows = 1024, cols = 1024;
+    const int64_t n = int64_t(rows) * cols;
+    const double fp32 = sizeof(float);
+
+    Tensor a = make_tensor({rows, cols});
+    Tensor a_t = make_tensor({cols, rows}).transpose();
+
+    runner.run("scalar_mul/contiguous/1024x1024", n, n, 2 * n * fp32, [&] { auto c = a * 2.f; });
+    runner.run("scalar_mul/transposed/1024x1024", n, n, 2 * n * fp32, [&] { auto c = a_t * 2.f; });
+    runner.run("scalar_add_inplace/1024x1024", n, n, 2 * n * fp32, [&] { a += 1.f; });
+}
+
+void bench_matmul(BenchRunner& runner) {
+    for (uint32_t size : {32u, 64u, 128u, 256u, 512u, 1024u}) {
+        Tensor a = make_tensor({size, size}), b = make_tensor({size, size});
+        double mnk = double(size) * size * size;
+        double bytes = 3.0 * size * size * sizeof(float);
+
+        runner.run("mm/" + std::to_string(size), int64_t(size) * size, 2 * mnk, bytes, [&] { auto c = a.mm(b); });
+    }
+
+    uint32_t batch = 32, size = 64;
+    Tensor a = make_tensor({batch, size, size}), b = make_tensor({size, size});
+    double mnk = double(batch) * size * size * size;
+    runner.run("mm/batched/32x64x64", int64_t(batch) * size * size, 2 * mnk, 2.0 * batch * size * size * 4,
+               [&] { auto c = a.mm(b); });
+
+    // A linear layer: the bias added by a broadcast op after mm, or by the gemm epilogue of addmm
+    {
+        uint32_t size = 512;
+        Tensor x = make_tensor({size, size}), w = make_tensor({size, size}), bias = make_tensor({size});
+        double mnk = double(size) * size * size;
+        double bytes = 3.0 * size * size * sizeof(float);
+        int64_t n = int64_t(size) * size;
+
+        runner.run("linear/mm+bias/512", n, 2 * mnk, bytes, [&] { auto c = x.mm(w) + bias; });
+        runner.run("linear/addmm/512", n, 2 * mnk, bytes, [&] { auto c = x.addmm(w, bias); });
+        runner.run("linear/addmm_relu/512", n, 2 * mnk, bytes, [&] { auto c = x.addmm(w, bias, Activation::RELU); });
+    }
+
+    // uint8 activations times per-channel int8 weights through the int8 GEMM, scaled into float
+    for (uint32_t size : {256u, 1024u}) {
+        Tensor x = make_tensor({size, size}), w = make_tensor({size, size});
+        Tensor xq = x.quantize(QuantParams::from_range(0.f, 2.f, Type::UINT8), Type::UINT8);
+        Tensor wq = w.quantize(QuantParams::per_channel_from(w, 1));
+        double mnk = double(size) * size * size;
+        double bytes = 2.0 * size * size + size * size * sizeof(float);
+
+        runner.run("mm/int8/" + std::to_string(size), int64_t(size) * size, 2 * mnk, bytes,
+                   [&] { auto c = xq.mm(wq); });
+    }
+}
+
+void bench_reductions(BenchRunner& runner) {
+    const uint32_t d0 = 64, d1 = 128, d2 = 128;
+    const int64_t n = int64_t(d0) * d1 * d2;
+
+    Tensor a = make_tensor({d0, d1, d2});
+    uint32_t shape[] = {d0, d1, d2};
+
+    for (uint32_t dim = 0; dim < 3; dim++) {
+        double bytes = (n + n / shape[dim]) * sizeof(float);
+        runner.run("sum/dim" + std::to_string(dim) + "/64x128x128", n, n, bytes, [&] { auto s = a.sum(dim); });
+    }
+
+    double bytes = n * sizeof(float);
+    runner.run("sum/all/64x128x128", n, n, bytes, [&] { auto s = a.sum(); });
+    runner.run("max/dim2/64x128x128", n, n, bytes, [&] { auto s = a.max(2); });
+    runner.run("argmax/dim2/64x128x128", n, n, bytes, [&] { auto s = a.argmax(2); });
+    runner.run("var/dim0/64x128x128", n, 4 * n, 4 * bytes, [&] { auto s = a.var(0); });
+}
+
+// Two-layer perceptron with a squared error, forward and backward; biases are kept 2-D so they
+// broadcast along the batch dim
+void bench_mlp(BenchRunner& runner) {
+    for (uint32_t hidden : {64u, 256u}) {
+        uint32_t batch = 64, in = 128, out = 16;
+
+        Tensor x = make_tensor({batch, in}), target = make_tensor({batch, out});
+        Tensor w1 = make_tensor({in, hidden}), b1 = make_tensor({1, hidden});
+        Tensor w2 = make_tensor({hidden, out}), b2 = make_tensor({1, out});
+        std::vector<Tensor*> params = {&w1, &b1, &w2, &b2};
+        for (auto* p : params) p->requires_grad(true);
+
+        // Forward matmuls, then two gradient matmuls per layer
+        double flops = 3 * 2.0 * batch * (double(in) * hidden + double(hidden) * out);
+        double bytes = 3.0 * (batch * in + in * hidden + hidden * out + batch * out) * sizeof(float);
+
+        auto step = [&] {
+            auto h = x.mm(w1) + b1;
+            auto y = h.mm(w2) + b2;
+            auto diff = y - target;
+            auto loss = diff * diff;
+            loss.backward();
+        };
+
+        std::string shape = "64x128x" + std::to_string(hidden) + "x16";
+        runner.run("mlp/forward_backward/" + shape, batch, flops, bytes, [&] {
+            step();
+            for (auto* p : params) p->reset_grad();
+        });
+
+        auto captured = CapturedGraph::capture(step);
+        runner.run("mlp/captured/" + shape, batch, flops, bytes, [&] { captured.replay(); });
+        for (auto* p : params) p->reset_grad();
+
+        // The same layers as nn::Linear, each one a single addmm node
+        nn::Linear layer1(in, hidden, Activation::NONE, 1), layer2(hidden, out, Activation::NONE, 2);
+        std::vector<Tensor*> layer_params = {&layer1.weight, &layer1.bias, &layer2.weight, &layer2.bias};
+        runner.run("mlp/linear/" + shape, batch, flops, bytes, [&] {
+            auto diff = layer2(layer1(x)) - target;
+            auto loss = diff * diff;
+            loss.backward();
+            for (auto* p : layer_params) p->reset_grad();
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--filter") && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (!std::strcmp(argv[i], "--min-time") && i + 1 < argc) {
+            options.min_time = std::stod(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--json") && i + 1 < argc) {
+            options.json_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--filter <substring>] [--min-time <seconds>] [--json <file|->]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    BenchRunner runner(options);
+    runner.log() << "threads: " << get_num_threads() << std::endl;
+
+    bench_element_wise(runner);
+    bench_scalar(runner);
+    bench_matmul(runner);
+    bench_reductions(runner);
+    bench_mlp(runner);
+
+    runner.write_json();
+    return 0;
+}
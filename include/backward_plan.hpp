@@ -0,0 +1,48 @@
+#pragma once
+#include "tensor.hpp"
+
+namespace micro {
+
+/**
+ * Execution order of a backward pass over the graph ending in a root node. The graph is walked
+ * iteratively, numbering every AutogradContext in the order it is first reached, and the plan
+ * keeps only those numbers: the parent edges of each node and the order the grad functions run
+ * in, every node after all of its consumers.
+ *
+ * A training loop builds a graph of the same shape on every step. prepare() first replays the
+ * stored edges against the new graph, and only rebuilds the plan when they don't match.
+ */
+class BackwardPlan {
+   public:
+    // Points the plan at the graph ending in root. Returns whether the previous plan was reused
+    bool prepare(AutogradContext& root);
+
+    // Runs the grad function of every node, in order. Unless retain_graph is set, each node drops
+    // its saved tensors, grad function and any gradient still left lazy right after it has run
+    void run(bool retain_graph) const;
+
+    // Runs the retained graph again as a fresh pass: leaf gradients are overwritten in their
+    // buffers rather than accumulated into
+    void replay() const;
+
+   private:
+    bool bind(AutogradContext& root);
+
+    void build(AutogradContext& root);
+
+    static void visit(AutogradContext& node, uint64_t epoch, uint32_t index);
+
+    // Evaluates the gradient of node if it is still a lazy expression, or drops it unless keep is set
+    static void settle_lazy_grad(AutogradContext& node, bool keep);
+
+   private:
+    std::vector<AutogradContext*> m_nodes;
+
+    // Parents of node i are m_edges[m_edge_begin[i], m_edge_begin[i + 1]), -1 for a tensor without a node
+    std::vector<uint32_t> m_edge_begin;
+    std::vector<int32_t> m_edges;
+
+    std::vector<uint32_t> m_order;
+};
+
+};  // namespace micro
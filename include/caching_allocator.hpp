@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+#include "includes.hpp"
+
+namespace micro {
+
+/**
+ * Header placed in front of every block handed out by the CachingAllocator. It keeps the owner
+ * count of the Storage in the same allocation as its data, and pads the data to a cache line.
+ * The count is atomic so Storages sharing a block can be copied and dropped from any thread.
+ */
+struct alignas(64) StorageBlock {
+    std::atomic<int32_t> count_owners;
+    uint32_t bucket;
+    // Unevaluated lazy expressions reading the data, which a write in place evaluates first
+    std::atomic<uint32_t> lazy_readers{0};
+
+    void* data() { return reinterpret_cast<char*>(this) + sizeof(StorageBlock); }
+};
+
+/**
+ * Size-bucketed cache of 64-byte-aligned blocks backing every Storage. Freed blocks go back to
+ * the free list of their bucket instead of the system heap, so the temporaries and gradients
+ * of a training step reuse the blocks released by the previous one.
+ *
+ * Buckets are four linear steps per power of two (e.g. 1024, 1280, 1536, 1792, 2048 bytes), so at
+ * most a quarter of a block is wasted.
+ */
+class CachingAllocator {
+   public:
+    static CachingAllocator& instance();
+
+    // Returns a block with at least size bytes of data and its owner count set to 1
+    StorageBlock* allocate(size_t size);
+
+    // Returns a block owning no data of its own, for a Storage over memory that lives elsewhere
+    // (a mapped file). Its owner count is set to 1, and deleter runs when the block is released
+    StorageBlock* borrow(std::function<void()> deleter);
+
+    void release(StorageBlock* block);
+
+    // Returns every cached block to the system
+    void empty_cache();
+
+    size_t cached_bytes() const;
+
+    size_t allocated_bytes() const;
+
+   private:
+    CachingAllocator() = default;
+
+    static uint32_t bucket_index(size_t size);
+
+    static size_t bucket_capacity(uint32_t bucket);
+
+   private:
+    mutable std::mutex m_mutex;
+    std::vector<std::vector<StorageBlock*>> m_free_blocks;
+    size_t m_cached_bytes = 0;
+    size_t m_allocated_bytes = 0;
+};
+
+// Releases the memory held by the Storage cache back to the system
+inline void empty_cache() { CachingAllocator::instance().empty_cache(); }
+
+};  // namespace micro
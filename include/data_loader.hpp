@@ -0,0 +1,76 @@
+#pragma once
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "tensor.hpp"
+
+namespace micro {
+
+/**
+ * Streams batches of samples to a training loop. Samples are the rows (indices of dim 0) of the
+ * source tensors, typically the inputs and the targets of a dataset mapped from disk with load()
+ * or load_raw(), and each batch holds the same rows of every source as contiguous tensors.
+ *
+ * Worker threads gather the rows of upcoming batches while the loop trains on the current one,
+ * and keep up to prefetch batches ready in order, so reading pages of the source and copying rows
+ * stay off the training thread:
+ *
+ *     DataLoader loader({x, y}, 64, true, seed);
+ *     for (uint32_t epoch = 0; epoch < epochs; epoch++) {
+ *         std::vector<Tensor> batch;
+ *         while (loader.next(batch)) step(batch[0], batch[1]);
+ *     }
+ *
+ * With shuffle, every epoch visits the samples in a new order drawn from seed and the epoch
+ * number, so the same seed gives the same batches on every run.
+ */
+class DataLoader {
+   public:
+    DataLoader(std::vector<Tensor> sources, uint32_t batch_size, bool shuffle = true, uint64_t seed = 0,
+               bool drop_last = false, uint32_t num_workers = 2, uint32_t prefetch = 3);
+
+    ~DataLoader();
+
+    DataLoader(const DataLoader&) = delete;
+
+    DataLoader& operator=(const DataLoader&) = delete;
+
+    // Moves the next batch of the epoch into batch, one tensor per source. Returns false once at
+    // the end of every epoch; the call after that starts the next one
+    bool next(std::vector<Tensor>& batch);
+
+    uint32_t batches_per_epoch() const { return m_batches_per_epoch; }
+
+   private:
+    struct Slot {
+        uint64_t batch = UINT64_MAX;
+        std::vector<Tensor> tensors;
+    };
+
+    // The order samples are visited in during epoch
+    std::shared_ptr<const std::vector<uint32_t>> order(uint64_t epoch);
+
+    std::vector<Tensor> gather(uint64_t batch);
+
+    void worker_loop();
+
+   private:
+    std::vector<Tensor> m_sources;
+    uint32_t m_samples, m_batch_size, m_batches_per_epoch;
+    bool m_shuffle;
+    uint64_t m_seed;
+
+    std::mutex m_mutex;
+    std::condition_variable m_batch_ready, m_slot_free;
+    // Batches are numbered across epochs; batch b waits for the consumer in slot b % prefetch
+    std::vector<Slot> m_slots;
+    uint64_t m_next_batch = 0, m_consumed = 0;
+    bool m_epoch_ended = false, m_stop = false;
+    // Sample orders of the epochs being gathered, dropped once the consumer is past them
+    std::vector<std::pair<uint64_t, std::shared_ptr<const std::vector<uint32_t>>>> m_orders;
+    std::vector<std::thread> m_workers;
+};
+
+};  // namespace micro
@@ -0,0 +1,157 @@
+#pragma once
+#include <type_traits>
+
+#include "half.hpp"
+#include "includes.hpp"
+
+namespace micro {
+
+enum class Type : uint8_t { UINT32 = 0, INT32, FLOAT32, FLOAT16, BFLOAT16, INT8, UINT8, UNKONWN };
+
+/**
+ * Every concrete dtype together with the C++ type its elements are stored as. Dispatch and the
+ * kernel registry instantiate their templates from this list, so a new dtype only needs an
+ * entry in Type and a line here.
+ */
+#define MICRO_FORALL_TYPES(_)   \
+    _(Type::UINT32, uint32_t)   \
+    _(Type::INT32, int32_t)     \
+    _(Type::FLOAT32, float)     \
+    _(Type::FLOAT16, Half)      \
+    _(Type::BFLOAT16, BFloat16) \
+    _(Type::INT8, int8_t)       \
+    _(Type::UINT8, uint8_t)
+
+constexpr size_t NUM_TYPES = size_t(Type::UNKONWN);
+
+std::ostream& operator<<(std::ostream& os, const Type& type);
+
+template <typename T>
+struct TypeTag {
+    using type = T;
+};
+
+template <typename T>
+constexpr Type type_of();
+
+#define MICRO_TYPE_OF(type, cpp_type)   \
+    template <>                         \
+    constexpr Type type_of<cpp_type>() { \
+        return type;                    \
+    }
+MICRO_FORALL_TYPES(MICRO_TYPE_OF)
+#undef MICRO_TYPE_OF
+
+// Bytes per element of dtype in storage
+inline size_t element_size(Type dtype) {
+    switch (dtype) {
+#define MICRO_ELEMENT_SIZE_CASE(type, cpp_type) \
+    case type:                                  \
+        return sizeof(cpp_type);
+        MICRO_FORALL_TYPES(MICRO_ELEMENT_SIZE_CASE)
+#undef MICRO_ELEMENT_SIZE_CASE
+        default:
+            LOG(FATAL) << "Unsupported tensor type " << dtype;
+    }
+    return 0;
+}
+
+inline bool is_half_precision(Type dtype) { return dtype == Type::FLOAT16 || dtype == Type::BFLOAT16; }
+
+inline bool is_floating_point(Type dtype) { return dtype == Type::FLOAT32 || is_half_precision(dtype); }
+
+// INT8 and UINT8 hold the values of quantized tensors, and multiply through the int8 GEMM
+inline bool is_8bit(Type dtype) { return dtype == Type::INT8 || dtype == Type::UINT8; }
+
+template <typename T>
+constexpr bool is_8bit_v = std::is_same_v<T, int8_t> || std::is_same_v<T, uint8_t>;
+
+/**
+ * Switches on dtype once and calls fn(TypeTag<T>{}) with the matching C++ type, so everything
+ * inside fn is compiled as straight-line typed code. Typical use:
+ *
+ *     dispatch_type(dtype, [&](auto tag) {
+ *         using T = typename decltype(tag)::type;
+ *         ...
+ *     });
+ */
+template <typename Fn>
+void dispatch_type(Type dtype, Fn&& fn) {
+    switch (dtype) {
+#define MICRO_DISPATCH_CASE(type, cpp_type) \
+    case type:                              \
+        fn(TypeTag<cpp_type>{});            \
+        return;
+        MICRO_FORALL_TYPES(MICRO_DISPATCH_CASE)
+#undef MICRO_DISPATCH_CASE
+        default:
+            LOG(FATAL) << "Unsupported tensor type " << dtype;
+    }
+}
+
+// A single value of any dtype, held as its 32-bit type: FLOAT16 and BFLOAT16 values as a float,
+// INT8 and UINT8 ones as an int32_t and a uint32_t
+struct Element {
+    union Data {
+        uint32_t u32 = 0;
+        int32_t i32;
+        float f32;
+    } data;
+
+    Element() = default;
+
+    template <typename T>
+    Element(T value) {
+        if constexpr (std::is_same_v<T, int32_t> || std::is_same_v<T, int8_t>) {
+            data.i32 = value;
+        } else if constexpr (std::is_same_v<T, uint32_t> || std::is_same_v<T, uint8_t>) {
+            data.u32 = value;
+        } else if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double> || is_half_precision_v<T>) {
+            data.f32 = float(value);
+        } else {
+            LOG(FATAL) << "Element Type is not supported";
+        }
+    }
+
+    operator float() const { return this->data.f32; }
+
+    operator float&() { return this->data.f32; }
+
+    operator int32_t() const { return this->data.i32; }
+
+    operator int32_t&() { return this->data.i32; }
+
+    operator uint32_t() const { return this->data.u32; }
+
+    operator uint32_t&() { return this->data.u32; }
+
+    // 8-bit values can't be referenced in the union, so non-const Elements convert by value as well
+    operator int8_t() const { return int8_t(this->data.i32); }
+
+    operator int8_t() { return int8_t(this->data.i32); }
+
+    operator uint8_t() const { return uint8_t(this->data.u32); }
+
+    operator uint8_t() { return uint8_t(this->data.u32); }
+};
+
+template <typename E, typename>
+Half::Half(const E& value) : Half(value.data.f32) {}
+
+template <typename E, typename>
+BFloat16::BFloat16(const E& value) : BFloat16(value.data.f32) {}
+
+// Converts the value held by an Element of dtype `from` to dtype `to`
+inline Element cast_element(Element value, Type from, Type to) {
+    Element result;
+    dispatch_type(from, [&](auto from_tag) {
+        using F = typename decltype(from_tag)::type;
+        dispatch_type(to, [&](auto to_tag) {
+            using D = typename decltype(to_tag)::type;
+            result = Element(D(F(value)));
+        });
+    });
+    return result;
+}
+
+};  // namespace micro
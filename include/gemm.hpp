@@ -0,0 +1,40 @@
+#pragma once
+#include "half.hpp"
+#include "kernel_registry.hpp"
+
+namespace micro {
+namespace gemm {
+
+// What gemm does to its results on their way to C: adds bias[j] to every element of column j
+// (bias holds N elements, nullptr for none), then applies activation
+template <typename T>
+struct Epilogue {
+    const T* bias = nullptr;
+    Activation activation = Activation::NONE;
+};
+
+/**
+ * C = A * B (or C += A * B when accumulate is set) for an M x K matrix A and a K x N matrix B.
+ * Every operand is addressed through an explicit (row, column) element stride, so transposed
+ * or otherwise strided views are consumed in place without being copied to a contiguous layout.
+ * A and B may be stored as 16-bit floats when T is float; they are widened while being packed.
+ * The epilogue runs on the registers holding the final sums, before they are stored.
+ */
+template <typename T, typename TA = T, typename TB = T>
+void gemm(uint32_t M, uint32_t N, uint32_t K, const TA* A, int64_t a_row_stride, int64_t a_col_stride, const TB* B,
+          int64_t b_row_stride, int64_t b_col_stride, T* C, int64_t c_row_stride, int64_t c_col_stride,
+          bool accumulate = false, const Epilogue<T>& epilogue = {});
+
+/**
+ * C = (A - a_zero) * (B - b_zero) for an M x K matrix A and a K x N matrix B of 8-bit integers
+ * (int8_t or uint8_t each), computed exactly in int32. a_zero holds one zero point per row of A
+ * and b_zero one per column of B; nullptr stands for zeros. The products run through the u8 x s8
+ * dot-product instructions of AVX-512 VNNI or AVX-VNNI when the target has them.
+ */
+template <typename TA, typename TB>
+void gemm_int8(uint32_t M, uint32_t N, uint32_t K, const TA* A, int64_t a_row_stride, int64_t a_col_stride,
+               const int32_t* a_zero, const TB* B, int64_t b_row_stride, int64_t b_col_stride, const int32_t* b_zero,
+               int32_t* C, int64_t c_row_stride, int64_t c_col_stride);
+
+};  // namespace gemm
+};  // namespace micro
@@ -0,0 +1,52 @@
+#pragma once
+#include "tensor.hpp"
+
+namespace micro {
+
+/**
+ * A training step recorded once and replayed as a flat list of kernel launches. capture() runs
+ * the step eagerly while every op it launches (element-wise and scalar ops, in-place updates,
+ * mm, sum, casts) and every backward() it calls are recorded against the tensors they ran on.
+ * The graph keeps those tensors, and with them every activation and gradient buffer, alive.
+ *
+ * replay() runs the recorded kernels again into the same buffers and reruns each backward
+ * through its retained graph, so a step allocates nothing and skips building autograd nodes,
+ * grad functions and the backward order. Inputs are rebound by writing new values into the
+ * tensors the step read, in place (assignment from a vector, copy_from), and results are read
+ * from tensors kept from the captured step. Shapes, dtypes and control flow are fixed at capture.
+ */
+class CapturedGraph {
+   public:
+    static CapturedGraph capture(const std::function<void()>& step);
+
+    void replay() const;
+
+    size_t num_ops() const { return m_ops.size(); }
+
+   private:
+    std::vector<std::function<void()>> m_ops;
+};
+
+// Whether a step is being captured on the calling thread
+bool is_capturing();
+
+// Appends a kernel launch to the graph being captured on the calling thread
+void record_replay(std::function<void()> op);
+
+// Stops recording on the calling thread for its lifetime, around kernels that a recorded op
+// already launches again on replay
+class CapturePause {
+   public:
+    CapturePause();
+
+    ~CapturePause();
+
+    CapturePause(const CapturePause&) = delete;
+
+    CapturePause& operator=(const CapturePause&) = delete;
+
+   private:
+    std::vector<std::function<void()>>* m_prev;
+};
+
+};  // namespace micro
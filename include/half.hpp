@@ -0,0 +1,129 @@
+#pragma once
+#include <cstring>
+#include <type_traits>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+#include "includes.hpp"
+
+namespace micro {
+
+struct Element;
+
+// IEEE binary16 <-> float. F16C converts in one instruction; the fallback rounds to nearest even
+// the same way, overflowing to infinity and keeping NaNs quiet
+inline float half_bits_to_float(uint16_t bits) {
+#if defined(__F16C__)
+    return _cvtsh_ss(bits);
+#else
+    uint32_t sign = uint32_t(bits & 0x8000) << 16;
+    uint32_t exponent = (bits >> 10) & 0x1f;
+    uint32_t mantissa = bits & 0x3ff;
+
+    // Subnormals are mantissa * 2^-24, exact in a float
+    if (exponent == 0) {
+        float value = float(mantissa) * 5.9604645e-8f;
+        return sign ? -value : value;
+    }
+
+    uint32_t x = sign | (mantissa << 13) | (exponent == 0x1f ? 0x7f800000 : (exponent + 112) << 23);
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+#endif
+}
+
+inline uint16_t float_to_half_bits(float value) {
+#if defined(__F16C__)
+    return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+
+    if (abs > 0x7f800000) return uint16_t(sign | 0x7e00);
+    if (abs >= 0x477ff000) return uint16_t(sign | 0x7c00);
+
+    // Below 2^-14 the result is subnormal, the mantissa (with its implicit bit) shifted right
+    if (abs < 0x38800000) {
+        if (abs <= 0x33000000) return uint16_t(sign);
+        uint32_t shift = 126 - (abs >> 23);
+        uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        uint32_t bits = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (bits & 1))) bits++;
+        return uint16_t(sign | bits);
+    }
+
+    // Rebias the exponent; rounding up may carry into the exponent, up to infinity
+    uint32_t bits = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (bits & 1))) bits++;
+    return uint16_t(sign | bits);
+#endif
+}
+
+// bfloat16 is the upper half of a float, so widening is a shift. Narrowing rounds to nearest even
+inline float bfloat16_bits_to_float(uint16_t bits) {
+    uint32_t x = uint32_t(bits) << 16;
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+inline uint16_t float_to_bfloat16_bits(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000) return uint16_t((x >> 16) | 0x40);
+    x += 0x7fff + ((x >> 16) & 1);
+    return uint16_t(x >> 16);
+}
+
+/**
+ * 16-bit floats, a storage format only: they convert to float to be computed with, and every
+ * expression on them (a + b, a < b, ...) is evaluated in float. Kernels read them into float,
+ * accumulate in float and round once when storing the result.
+ */
+#define MICRO_HALF_PRECISION_TYPE(Name, to_float, from_float)                         \
+    struct Name {                                                                      \
+        uint16_t bits = 0;                                                             \
+                                                                                       \
+        Name() = default;                                                              \
+                                                                                       \
+        Name(float value) : bits(from_float(value)) {}                                 \
+                                                                                       \
+        template <typename U, typename = std::enable_if_t<std::is_arithmetic_v<U>>>    \
+        Name(U value) : Name(float(value)) {}                                          \
+                                                                                       \
+        /* Elements of a 16-bit float tensor hold their value as a float. A template, */ \
+        /* so that other types never convert to Element on the way */                  \
+        template <typename E, typename = std::enable_if_t<std::is_same_v<E, Element>>> \
+        Name(const E& value);                                                          \
+                                                                                       \
+        operator float() const { return to_float(bits); }                              \
+                                                                                       \
+        Name& operator+=(float value) { return *this = Name(float(*this) + value); }   \
+                                                                                       \
+        Name& operator-=(float value) { return *this = Name(float(*this) - value); }   \
+                                                                                       \
+        Name& operator*=(float value) { return *this = Name(float(*this) * value); }   \
+                                                                                       \
+        Name& operator/=(float value) { return *this = Name(float(*this) / value); }   \
+    }
+
+MICRO_HALF_PRECISION_TYPE(Half, half_bits_to_float, float_to_half_bits);
+MICRO_HALF_PRECISION_TYPE(BFloat16, bfloat16_bits_to_float, float_to_bfloat16_bits);
+
+#undef MICRO_HALF_PRECISION_TYPE
+
+template <typename T>
+constexpr bool is_half_precision_v = std::is_same_v<T, Half> || std::is_same_v<T, BFloat16>;
+
+// The type kernels compute and accumulate in for elements stored as T
+template <typename T>
+using compute_t = std::conditional_t<is_half_precision_v<T>, float, T>;
+
+};  // namespace micro
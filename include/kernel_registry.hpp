@@ -0,0 +1,51 @@
+#pragma once
+#include "dtype.hpp"
+
+namespace micro {
+
+class Tensor;
+
+enum class BinaryOp : uint8_t { ADD = 0, SUB, MUL, DIV, COUNT };
+
+enum class ReduceOp : uint8_t { SUM = 0, PROD, MAX, MIN, COUNT };
+
+// Pointwise function addmm applies to its result in the GEMM epilogue
+enum class Activation : uint8_t { NONE = 0, RELU };
+
+// How the operands of an element-wise op are laid out in memory
+enum class Layout : uint8_t {
+    CONTIGUOUS = 0,  // every input is contiguous with the output's shape, or a single scalar
+    STRIDED,         // anything else, resolved through broadcasting index arithmetic
+    COUNT
+};
+
+using BinaryKernel = void (*)(const Tensor& in1, const Tensor& in2, Tensor& out);
+
+// Tensor-scalar variant of a binary op; value already holds the tensor's dtype
+using ScalarKernel = void (*)(const Tensor& in, Element value, Tensor& out);
+
+/**
+ * Table of typed kernels keyed on (op, dtype, layout). An op looks its kernel up once and then
+ * runs a loop specialized for a single C++ type, instead of switching on the dtype per element.
+ * The built-in kernels are registered on first use, and register_binary can replace any of them.
+ */
+class KernelRegistry {
+   public:
+    static KernelRegistry& instance();
+
+    void register_binary(BinaryOp op, Type dtype, Layout layout, BinaryKernel kernel);
+
+    BinaryKernel binary(BinaryOp op, Type dtype, Layout layout) const;
+
+    void register_scalar(BinaryOp op, Type dtype, Layout layout, ScalarKernel kernel);
+
+    ScalarKernel scalar(BinaryOp op, Type dtype, Layout layout) const;
+
+   private:
+    KernelRegistry();
+
+    BinaryKernel m_binary[size_t(BinaryOp::COUNT)][NUM_TYPES][size_t(Layout::COUNT)] = {};
+    ScalarKernel m_scalar[size_t(BinaryOp::COUNT)][NUM_TYPES][size_t(Layout::COUNT)] = {};
+};
+
+};  // namespace micro
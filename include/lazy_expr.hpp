@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "tensor.hpp"
+
+namespace micro {
+
+/**
+ * An element-wise op recorded in lazy mode instead of being run: its operands, which may be lazy
+ * themselves, and the broadcast shape and dtype of its result. The first read of the result
+ * flattens every unevaluated node below into a single fused loop that reads each input once and
+ * allocates only the result. Once evaluated, the node keeps the result and drops its operands.
+ *
+ * An expression reads its operands when it is evaluated, not when it is recorded, so every node
+ * is registered as a pending reader of the storages it reads. Writing to one of them in place
+ * first evaluates the nodes still reading it, which then see the values from before the write.
+ */
+struct LazyExpr : std::enable_shared_from_this<LazyExpr> {
+    BinaryOp op;
+    Tensor lhs, rhs;
+
+    // lhs <op> value, with rhs unused
+    bool scalar_rhs = false;
+    Element value;
+
+    std::vector<uint32_t> shape;
+    Type dtype;
+
+    // Unevaluated ops this node would fuse, itself included
+    uint32_t num_ops = 1;
+
+    std::mutex mutex;
+    std::atomic<bool> evaluated{false};
+    Storage result;
+
+    // Unevaluated nodes reading this one's result, which become readers of its storage once it
+    // is evaluated, and the storages this node reads
+    std::vector<std::weak_ptr<LazyExpr>> readers;
+    std::vector<StorageBlock*> watched;
+
+    ~LazyExpr();
+
+    // Runs the fused kernel of this node into its result, unless it has been evaluated already
+    void evaluate();
+};
+
+};  // namespace micro
@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+
+#include "tensor.hpp"
+
+namespace micro {
+namespace nn {
+
+/**
+ * Fully connected layer: y = activation(x W + b) for inputs x of shape (..., in_features), with
+ * a weight W of shape (in_features, out_features) and a bias b of out_features elements, run as
+ * a single addmm. W and b require grad and start uniform in [-1/sqrt(in_features), 1/sqrt(in_features)],
+ * drawn from seed, so layers built with the same seed start out the same.
+ */
+class Linear {
+   public:
+    Linear(uint32_t in_features, uint32_t out_features, Activation activation = Activation::NONE, uint64_t seed = 0,
+           Type dtype = Type::FLOAT32);
+
+    Tensor forward(const Tensor& x) const { return x.addmm(weight, bias, m_activation); }
+
+    Tensor operator()(const Tensor& x) const { return forward(x); }
+
+    // The weight and bias as prefix + "weight" and prefix + "bias", ready for save()
+    TensorDict parameters(const std::string& prefix = "") const;
+
+    // Copies the weight and bias saved under prefix in parameters, as returned by load()
+    void load_parameters(const TensorDict& parameters, const std::string& prefix = "");
+
+    Tensor weight, bias;
+
+   private:
+    Activation m_activation;
+};
+
+};  // namespace nn
+};  // namespace micro
@@ -0,0 +1,66 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "tensor.hpp"
+
+namespace micro {
+
+/**
+ * Maps the 8-bit values q of a quantized tensor to the real values (q - zero_point) * scale.
+ * Per-tensor params have a single scale and zero point; per-channel ones have one for each index
+ * of dim axis, typically the output channels of a weight.
+ */
+struct QuantParams {
+    std::vector<float> scales;
+    std::vector<int32_t> zero_points;
+    int32_t axis = -1;
+
+    QuantParams(float scale = 1.f, int32_t zero_point = 0) : scales{scale}, zero_points{zero_point} {}
+
+    QuantParams(std::vector<float> scales, std::vector<int32_t> zero_points, uint32_t axis)
+        : scales(std::move(scales)), zero_points(std::move(zero_points)), axis(int32_t(axis)) {}
+
+    bool per_channel() const { return axis >= 0; }
+
+    // Why these params can't map a tensor of shape stored as dtype, empty when they can: every
+    // channel needs a positive finite scale and a zero point in the range of dtype
+    std::string check(const std::vector<uint32_t>& shape, Type dtype) const;
+
+    // Params spreading [min, max], widened to hold 0 so that 0 is exact, over the values of
+    // dtype. Symmetric params center the range on 0 instead, with zero point 0 (128 for UINT8)
+    static QuantParams from_range(float min, float max, Type dtype = Type::INT8, bool symmetric = false);
+
+    // Per-channel params along axis from the range of every channel of t; weights are usually
+    // quantized symmetrically, which keeps the zero-point corrections of mm off their side
+    static QuantParams per_channel_from(const Tensor& t, uint32_t axis, Type dtype = Type::INT8,
+                                        bool symmetric = true);
+};
+
+/**
+ * Records the range of activations over float forward passes, to choose the params they are
+ * quantized with at inference. Run representative inputs through the float model with each
+ * activation wrapped in observe():
+ *
+ *     Calibrator calibrator;
+ *     auto hidden = calibrator.observe("hidden", x.mm(w1) + b1);
+ *     ...
+ *     auto hidden_q = hidden.quantize(calibrator.params("hidden", Type::UINT8), Type::UINT8);
+ */
+class Calibrator {
+   public:
+    // Widens the range recorded under name to the values of t, and returns t
+    Tensor observe(const std::string& name, const Tensor& t);
+
+    // The (min, max) recorded under name
+    std::pair<float, float> range(const std::string& name) const;
+
+    QuantParams params(const std::string& name, Type dtype = Type::UINT8, bool symmetric = false) const;
+
+   private:
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, std::pair<float, float>> m_ranges;
+};
+
+};  // namespace micro
@@ -0,0 +1,39 @@
+#pragma once
+#include <future>
+#include <map>
+#include <string>
+
+#include "tensor.hpp"
+
+namespace micro {
+
+/**
+ * Checkpoint files hold named tensors, such as the parameters of a model. The file starts with
+ * a header listing the name, dtype, shape, strides, quantization params and data offset of every
+ * tensor, followed by the raw bytes of each tensor at a 64-byte-aligned offset:
+ *
+ *     "MTCKPT\0\0" | u32 version | u32 count | count entries | padding | data | padding | data ...
+ *
+ * Values are written in the byte order of the machine, and dtypes as their Type values.
+ */
+
+// Writes tensors to path, their elements in row-major order. The file is written next to path
+// and renamed over it at the end, so a crash mid-save never leaves a torn checkpoint behind
+void save(const std::string& path, const TensorDict& tensors);
+
+// Maps the checkpoint at path into memory and returns tensors reading their elements straight
+// from the mapping, so loading copies nothing and the pages are shared with every process
+// mapping the same file. Writes to a loaded tensor go to a private copy of the page they touch
+// and never reach the file. The mapping lives until the last tensor using it is gone
+TensorDict load(const std::string& path);
+
+// Maps a headerless file of raw elements, such as a dataset exported by another tool, as a
+// contiguous tensor of shape and dtype starting offset bytes into the file
+Tensor load_raw(const std::string& path, std::vector<uint32_t> shape, Type dtype, uint64_t offset = 0);
+
+// Copies tensors right away and saves the copies on a background thread, so training can go
+// on updating the originals while the checkpoint is written. Wait on the future before
+// exiting or saving to the same path again
+std::future<void> save_async(const std::string& path, const TensorDict& tensors);
+
+};  // namespace micro
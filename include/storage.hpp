@@ -1,42 +1,48 @@
 #pragma once
+#include "caching_allocator.hpp"
 #include "includes.hpp"
 
 class Storage {
    public:
     Storage() = default;
 
-    Storage(uint32_t size) : m_count_owners(new int32_t), m_size(size), m_ptr((void*)new char[size]) {
-        *m_count_owners = 1;
+    Storage(uint32_t size)
+        : m_block(micro::CachingAllocator::instance().allocate(size)), m_size(size), m_ptr(m_block->data()) {}
+
+    // Borrows size bytes at ptr without copying them; deleter runs once the last Storage sharing
+    // them is gone
+    Storage(void* ptr, uint32_t size, std::function<void()> deleter)
+        : m_block(micro::CachingAllocator::instance().borrow(std::move(deleter))), m_size(size), m_ptr(ptr) {}
+
+    Storage(const Storage& other) : m_block(other.m_block), m_size(other.m_size), m_ptr(other.m_ptr) { retain(); }
+
+    Storage(Storage&& other) noexcept : m_block(other.m_block), m_size(other.m_size), m_ptr(other.m_ptr) {
+        other.reset();
     }
 
-    Storage(const Storage& other) {
-        m_count_owners = other.m_count_owners;
+    Storage& operator=(const Storage& other) {
+        if (m_block == other.m_block) return *this;
+
+        release();
+        m_block = other.m_block;
         m_ptr = other.m_ptr;
         m_size = other.m_size;
-        if (m_count_owners) {
-            (*m_count_owners)++;
-        }
+        retain();
+        return *this;
     }
 
-    void operator=(const Storage& other) {
-        m_count_owners = other.m_count_owners;
+    Storage& operator=(Storage&& other) noexcept {
+        if (this == &other) return *this;
+
+        release();
+        m_block = other.m_block;
         m_ptr = other.m_ptr;
         m_size = other.m_size;
-        if (m_count_owners) {
-            (*m_count_owners)++;
-        }
+        other.reset();
+        return *this;
     }
 
-    ~Storage() {
-        if (m_count_owners == nullptr) return;
-
-        (*m_count_owners)--;
-        if (*m_count_owners > 0) return;
-        delete m_count_owners;
-
-        if (m_ptr == nullptr) return;
-        delete[] (char*)m_ptr;
-    }
+    ~Storage() { release(); }
 
     void* at(uint32_t offset) const {
         LOG_IF(FATAL, !m_ptr);
@@ -44,8 +50,33 @@ class Storage {
         return (void*)(reinterpret_cast<char*>(m_ptr) + offset);
     }
 
+    // The block shared by every Storage over the same memory, null for an empty Storage
+    micro::StorageBlock* block() const { return m_block; }
+
+   private:
+    void retain() {
+        if (m_block) m_block->count_owners.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The last owner to let go hands the block back to the allocator, which runs the deleter of
+    // a borrowed one
+    void release() {
+        if (m_block == nullptr) return;
+
+        if (m_block->count_owners.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            micro::CachingAllocator::instance().release(m_block);
+        }
+        reset();
+    }
+
+    void reset() {
+        m_block = nullptr;
+        m_size = 0;
+        m_ptr = nullptr;
+    }
+
    private:
-    int32_t* m_count_owners{nullptr};
+    micro::StorageBlock* m_block{nullptr};
     uint32_t m_size{0};
     void* m_ptr{nullptr};
-};
\ No newline at end of file
+};
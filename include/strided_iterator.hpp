@@ -0,0 +1,109 @@
+#pragma once
+#include <array>
+
+#include "includes.hpp"
+
+namespace micro {
+
+/**
+ * Walks an N-operand iteration space of arbitrary rank. Each operand brings its own element
+ * strides aligned with the iteration shape (0 on broadcast dims). On construction, size-1 dims
+ * are dropped and neighbouring dims that are contiguous for every operand are coalesced, so a
+ * contiguous tensor of any rank becomes a single flat row.
+ *
+ * for_each hands out whole rows of the innermost dim: fn(offsets, count, strides) receives the
+ * element offset of every operand at the start of the row, the row length and the per-operand
+ * inner strides. Offsets advance odometer-style between rows, without recomputing them from
+ * indices.
+ */
+template <size_t N>
+class StridedIterator {
+   public:
+    StridedIterator(const std::vector<uint32_t>& shape, const std::array<std::vector<int64_t>, N>& strides) {
+        for (size_t d = 0; d < shape.size(); d++) {
+            if (shape[d] == 1) continue;
+
+            bool mergeable = !m_shape.empty();
+            for (size_t k = 0; k < N && mergeable; k++) {
+                mergeable = m_strides[k].back() == strides[k][d] * int64_t(shape[d]);
+            }
+
+            if (mergeable) {
+                m_shape.back() *= shape[d];
+                for (size_t k = 0; k < N; k++) m_strides[k].back() = strides[k][d];
+                continue;
+            }
+
+            m_shape.push_back(shape[d]);
+            for (size_t k = 0; k < N; k++) m_strides[k].push_back(strides[k][d]);
+        }
+
+        if (m_shape.empty()) {
+            m_shape.push_back(1);
+            for (size_t k = 0; k < N; k++) m_strides[k].push_back(0);
+        }
+
+        m_numel = 1;
+        for (auto s : m_shape) m_numel *= s;
+    }
+
+    int64_t numel() const { return m_numel; }
+
+    int32_t ndims() const { return m_shape.size(); }
+
+    // Length of the innermost dim after coalescing, and the stride of each operand along it
+    int64_t inner_size() const { return m_shape.back(); }
+
+    int64_t inner_stride(size_t operand) const { return m_strides[operand].back(); }
+
+    // Visits the elements with linear index in [begin, end), in row-major order
+    template <typename Fn>
+    void for_each(int64_t begin, int64_t end, Fn&& fn) const {
+        int32_t ndims = m_shape.size();
+        int32_t last = ndims - 1;
+
+        // Short ranges are walked often (one block of a fused loop at a time), so the index lives
+        // on the stack unless the iteration space is unusually deep
+        int64_t inline_index[8] = {};
+        std::vector<int64_t> heap_index(ndims > 8 ? ndims : 0, 0);
+        int64_t* index = ndims > 8 ? heap_index.data() : inline_index;
+        std::array<int64_t, N> offsets{}, inner_strides{};
+
+        int64_t rest = begin;
+        for (int32_t d = last; d >= 0; d--) {
+            index[d] = rest % m_shape[d];
+            rest /= m_shape[d];
+            for (size_t k = 0; k < N; k++) offsets[k] += index[d] * m_strides[k][d];
+        }
+
+        for (size_t k = 0; k < N; k++) inner_strides[k] = m_strides[k][last];
+
+        for (int64_t position = begin; position < end;) {
+            int64_t count = std::min(m_shape[last] - index[last], end - position);
+            fn(offsets.data(), count, inner_strides.data());
+            position += count;
+
+            index[last] += count;
+            for (size_t k = 0; k < N; k++) offsets[k] += count * inner_strides[k];
+            if (index[last] < m_shape[last]) continue;
+
+            for (size_t k = 0; k < N; k++) offsets[k] -= m_shape[last] * inner_strides[k];
+            index[last] = 0;
+
+            for (int32_t d = last - 1; d >= 0; d--) {
+                for (size_t k = 0; k < N; k++) offsets[k] += m_strides[k][d];
+                if (++index[d] < m_shape[d]) break;
+
+                for (size_t k = 0; k < N; k++) offsets[k] -= m_shape[d] * m_strides[k][d];
+                index[d] = 0;
+            }
+        }
+    }
+
+   private:
+    std::vector<int64_t> m_shape;
+    std::array<std::vector<int64_t>, N> m_strides;
+    int64_t m_numel;
+};
+
+};  // namespace micro
@@ -1,56 +1,109 @@
 #pragma once
 #include <functional>
-#include <unordered_set>
+#include <future>
+#include <map>
+#include <string>
 
+#include "dtype.hpp"
 #include "includes.hpp"
+#include "kernel_registry.hpp"
 #include "storage.hpp"
 
 namespace micro {
 
+// Grad mode is per thread: ops only record the autograd graph while it is enabled on the calling
+// thread, so inference threads can run without grad while another thread trains
 void with_no_grad();
 void with_grad();
+bool is_grad_enabled();
 
-class AutogradContext;
+// Disables grad mode on this thread for its lifetime and restores the previous mode on exit,
+// so no-grad regions nest
+class NoGradGuard {
+   public:
+    NoGradGuard() : m_prev(is_grad_enabled()) { with_no_grad(); }
 
-enum class Type : uint8_t { UINT32 = 0, INT32, FLOAT32, UNKONWN };
+    ~NoGradGuard() {
+        if (m_prev) with_grad();
+    }
 
-std::ostream& operator<<(std::ostream& os, const Type& type);
+    NoGradGuard(const NoGradGuard&) = delete;
 
-struct Element {
-    union Data {
-        uint32_t u32 = 0;
-        int32_t i32;
-        float f32;
-    } data;
+    NoGradGuard& operator=(const NoGradGuard&) = delete;
 
-    Element() = default;
+   private:
+    bool m_prev;
+};
 
-    template <typename T>
-    Element(T value) {
-        if constexpr (std::is_same_v<T, int32_t>) {
-            data.i32 = value;
-        } else if constexpr (std::is_same_v<T, uint32_t>) {
-            data.u32 = value;
-        } else if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>) {
-            data.f32 = float(value);
-        } else {
-            LOG(FATAL) << "Element Type is not supported";
-        }
+// Enables grad mode on this thread for its lifetime and restores the previous mode on exit, to
+// record a graph from code that runs without grad, such as a grad function
+class EnableGradGuard {
+   public:
+    EnableGradGuard() : m_prev(is_grad_enabled()) { with_grad(); }
+
+    ~EnableGradGuard() {
+        if (!m_prev) with_no_grad();
     }
 
-    operator float() const { return this->data.f32; }
+    EnableGradGuard(const EnableGradGuard&) = delete;
 
-    operator float&() { return this->data.f32; }
+    EnableGradGuard& operator=(const EnableGradGuard&) = delete;
 
-    operator int32_t() const { return this->data.i32; }
+   private:
+    bool m_prev;
+};
 
-    operator int32_t&() { return this->data.i32; }
+// Lazy mode is per thread as well: while it is enabled, element-wise ops (+, -, *, / with tensors
+// or scalars) record an expression instead of running. The expression is evaluated the first
+// time its result is read, for example by operator[], a reduction, mm, printing or a kernel,
+// and a chain of such ops then runs as one fused loop.
+void with_lazy();
+void with_eager();
+bool is_lazy_enabled();
 
-    operator uint32_t() const { return this->data.u32; }
+// Enables lazy mode on this thread for its lifetime and restores the previous mode on exit
+class LazyGuard {
+   public:
+    LazyGuard() : m_prev(is_lazy_enabled()) { with_lazy(); }
+
+    ~LazyGuard() {
+        if (!m_prev) with_eager();
+    }
+
+    LazyGuard(const LazyGuard&) = delete;
+
+    LazyGuard& operator=(const LazyGuard&) = delete;
 
-    operator uint32_t&() { return this->data.u32; }
+   private:
+    bool m_prev;
 };
 
+// The dtype an op on tensors of types t1 and t2 computes in
+Type get_output_type(const Type& t1, const Type& t2);
+
+// Broadcasts two shapes against each other, aligning their trailing dims
+std::vector<uint32_t> broadcast_shapes(const std::vector<uint32_t>& shape1, const std::vector<uint32_t>& shape2);
+
+class AutogradContext;
+class Tensor;
+struct LazyExpr;
+struct QuantParams;
+struct MatmulProblem;
+struct MatmulOperand;
+
+// A forward segment for checkpoint(): computes one tensor from its inputs with tensor ops
+using Segment = std::function<Tensor(const std::vector<Tensor>&)>;
+
+// Runs segment on inputs without saving any of its intermediates for backward. When backward()
+// reaches the result, the segment runs again from the same inputs, under grad, to rebuild them
+// right before they are needed: one more forward of the segment for the memory of its activations.
+// Leaf tensors the segment captures, such as its parameters, get their gradients too; a tensor
+// computed by earlier ops has to be passed in inputs for its gradient to reach back past it
+Tensor checkpoint(const Segment& segment, const std::vector<Tensor>& inputs);
+
+// Tensors by name, such as the parameters of a model as save() and load() store them
+using TensorDict = std::map<std::string, Tensor>;
+
 class Tensor {
    public:
     Tensor() = default;
@@ -60,43 +113,79 @@ class Tensor {
         m_storage = Storage(number_bytes());
     }
 
+    // Copies share the storage and the autograd node; moves hand them over without touching
+    // either refcount, so tensors returned from ops are never copied
+    Tensor(const Tensor&) = default;
+    Tensor(Tensor&&) noexcept = default;
+    Tensor& operator=(const Tensor&) = default;
+    Tensor& operator=(Tensor&&) noexcept = default;
+
     void set_default_strides();
 
     size_t size() const;
 
-    uint32_t number_bytes() const { return size() * sizeof(Element); }
+    bool is_contiguous() const;
+
+    // Whether some dim of size > 1 has stride 0, so that several indices share one element
+    bool is_expanded() const;
+
+    uint32_t number_bytes() const { return size() * element_size(m_dtype); }
+
+    Type dtype() const { return m_dtype; }
 
     Tensor grad();
 
     void reset_grad();
 
-    void requires_grad(bool requires_grad) {
-        LOG_IF(FATAL, m_grad_fn != nullptr) << "you can only change requires_grad flags of leaf variables";
-        m_requires_grad = requires_grad;
-    }
+    void requires_grad(bool requires_grad);
+
+    bool requires_grad() const { return m_requires_grad; }
 
     Element operator[](const std::initializer_list<uint32_t>& indices) const {
-        return const_cast<Tensor*>(this)->operator[](std::vector<uint32_t>{indices});
+        return operator[](element_offset(indices));
     }
 
     Element& operator[](const std::initializer_list<uint32_t>& indices) {
         return this->operator[](std::vector<uint32_t>{indices});
     }
 
-    Element operator[](const std::vector<uint32_t>& indices) const {
-        return const_cast<Tensor*>(this)->operator[](indices);
-    }
+    Element operator[](const std::vector<uint32_t>& indices) const { return operator[](element_offset(indices)); }
 
     Element& at(const std::vector<uint32_t>& indices) { return this->operator[](indices); }
 
-    Tensor transpose(uint32_t dim0 = 0, uint32_t dim1 = 1) {
-        Tensor t = *this;
-        std::swap(t.m_shape[dim0], t.m_shape[dim1]);
-        std::swap(t.m_stride[dim0], t.m_stride[dim1]);
+    // Views share this tensor's storage and read it through a shape, strides and offset of their
+    // own, so taking one copies nothing and writes through a view land in this tensor. Gradients
+    // flowing into a view go back to the elements it was taken from.
 
-        t.m_saved_context = nullptr;
-        return t;
-    }
+    // The same elements under another shape with as many of them. view() fails when the strides
+    // can't express the new shape (flattening a transposed tensor, say), where reshape() copies
+    Tensor view(const std::vector<uint32_t>& shape) const;
+    Tensor reshape(const std::vector<uint32_t>& shape) const;
+
+    // Elements start, start + step, ... below end along dim
+    Tensor slice(uint32_t dim, uint32_t start, uint32_t end, uint32_t step = 1) const;
+    Tensor narrow(uint32_t dim, uint32_t start, uint32_t length) const { return slice(dim, start, start + length); }
+
+    // The elements at index along dim, with dim dropped
+    Tensor select(uint32_t dim, uint32_t index) const;
+
+    // Dim i of the result is dim dims[i] of this tensor
+    Tensor permute(const std::vector<uint32_t>& dims) const;
+    Tensor transpose(uint32_t dim0 = 0, uint32_t dim1 = 1) const;
+
+    // squeeze() drops every size-1 dim, squeeze(dim) only dim; unsqueeze(dim) inserts one at dim
+    Tensor squeeze() const;
+    Tensor squeeze(uint32_t dim) const;
+    Tensor unsqueeze(uint32_t dim) const;
+
+    // A view of this tensor broadcast to shape: the dims it is broadcast along (its size-1 dims
+    // and any leading dims it lacks) read the same elements with stride 0. The gradient of the
+    // view is summed back over those dims. An expanded view can't be written to.
+    Tensor expand(const std::vector<uint32_t>& shape) const;
+    Tensor broadcast_to(const std::vector<uint32_t>& shape) const { return expand(shape); }
+
+    // This tensor when its elements are laid out row-major without gaps, a copy otherwise
+    Tensor contiguous() const;
 
     Element& operator[](const std::vector<uint32_t>& indices);
     Tensor operator+(const Tensor& other) const;
@@ -104,112 +193,228 @@ class Tensor {
     Tensor operator*(const Tensor& other) const;
     Tensor operator/(const Tensor& other) const;
     Tensor mm(const Tensor& other) const;
-    Tensor sum(uint32_t dim, bool keep_dims = false) const;
-
-#define WRITE_ELEMENT(out, value)                                           \
-    {                                                                       \
-        switch (m_dtype) {                                                  \
-            case Type::UINT32:                                              \
-                out.data.i32 = uint32_t(value);                             \
-                break;                                                      \
-            case Type::INT32:                                               \
-                out.data.i32 = int32_t(value);                              \
-                break;                                                      \
-            case Type::FLOAT32:                                             \
-                out.data.f32 = float(value);                                \
-                break;                                                      \
-            default:                                                        \
-                LOG(FATAL) << "Can't write value with unknown tensor type"; \
-        }                                                                   \
+
+    // activation(mm(weight) + bias) for a bias with one element per column of weight, the way a
+    // linear layer computes it: the gemm adds the bias and applies the activation to its sums
+    // before storing them, and backward sums the bias gradient in its pass over the gradient
+    Tensor addmm(const Tensor& weight, const Tensor& bias, Activation activation = Activation::NONE) const;
+
+    // A copy of this tensor cast to dtype. Gradients flow back through the cast, converted to this tensor's dtype
+    Tensor to(Type dtype) const;
+
+    // An INT8 or UINT8 tensor holding round(x / scale) + zero_point for every element x of this
+    // tensor, clamped to the range of dtype and carrying params to map the values back. mm of two
+    // quantized tensors multiplies their 8-bit values in int32 and returns a FLOAT32 result; other
+    // ops see a quantized tensor as plain integers. See quantization.hpp for choosing params
+    Tensor quantize(const QuantParams& params, Type dtype = Type::INT8) const;
+
+    // The FLOAT32 values (q - zero_point) * scale a quantized tensor stands for
+    Tensor dequantize() const;
+
+    bool is_quantized() const { return m_quant != nullptr; }
+
+    const QuantParams& quant_params() const;
+
+    // Reductions over dims, or over every dim when none are given. The reduced dims are dropped
+    // from the result unless keep_dims is set; reducing every dim away leaves shape {1}. mean and
+    // var of an integer tensor are FLOAT32
+    Tensor sum(uint32_t dim, bool keep_dims = false) const { return sum(std::vector<uint32_t>{dim}, keep_dims); }
+    Tensor sum(const std::vector<uint32_t>& dims = {}, bool keep_dims = false) const;
+    Tensor mean(uint32_t dim, bool keep_dims = false) const { return mean(std::vector<uint32_t>{dim}, keep_dims); }
+    Tensor mean(const std::vector<uint32_t>& dims = {}, bool keep_dims = false) const;
+    Tensor prod(uint32_t dim, bool keep_dims = false) const { return prod(std::vector<uint32_t>{dim}, keep_dims); }
+    Tensor prod(const std::vector<uint32_t>& dims = {}, bool keep_dims = false) const;
+    Tensor max(uint32_t dim, bool keep_dims = false) const { return max(std::vector<uint32_t>{dim}, keep_dims); }
+    Tensor max(const std::vector<uint32_t>& dims = {}, bool keep_dims = false) const;
+    Tensor min(uint32_t dim, bool keep_dims = false) const { return min(std::vector<uint32_t>{dim}, keep_dims); }
+    Tensor min(const std::vector<uint32_t>& dims = {}, bool keep_dims = false) const;
+
+    // UINT32 position of the first max (min) among the elements reduced into each output, counted
+    // in row-major order over the reduced dims, so along dim when there is only one
+    Tensor argmax(uint32_t dim, bool keep_dims = false) const { return argmax(std::vector<uint32_t>{dim}, keep_dims); }
+    Tensor argmax(const std::vector<uint32_t>& dims = {}, bool keep_dims = false) const;
+    Tensor argmin(uint32_t dim, bool keep_dims = false) const { return argmin(std::vector<uint32_t>{dim}, keep_dims); }
+    Tensor argmin(const std::vector<uint32_t>& dims = {}, bool keep_dims = false) const;
+
+    // Two-pass variance, divided by N - 1 unless unbiased is false
+    Tensor var(uint32_t dim, bool unbiased = true, bool keep_dims = false) const {
+        return var(std::vector<uint32_t>{dim}, unbiased, keep_dims);
     }
+    Tensor var(const std::vector<uint32_t>& dims = {}, bool unbiased = true, bool keep_dims = false) const;
 
     Tensor& operator=(const std::vector<Element>& values) {
+        LOG_IF(FATAL, is_expanded()) << "Can't write to an expanded view";
         LOG_IF(FATAL, values.size() != size())
             << "Can't assign an array of size " << values.size() << " to a tensor of size " << size();
+        evaluate_pending_readers();
 
-        for (size_t i = 0; i < size(); i++) {
-            WRITE_ELEMENT((this->operator[](i)), values[i]);
-        }
+        // A view is filled from a contiguous copy of the values
+        Tensor src = is_contiguous() ? *this : Tensor(m_shape, m_dtype);
+        dispatch_type(m_dtype, [&](auto tag) {
+            using T = typename decltype(tag)::type;
+            T* data = src.data_ptr<T>();
+            for (size_t i = 0; i < values.size(); i++) data[i] = T(values[i]);
+        });
+        if (!is_contiguous()) cast_impl(src, *this);
 
         return *this;
     }
 
     template <typename T>
     Tensor operator+(T value) const {
-        Tensor tensor({1});
-        WRITE_ELEMENT(tensor[0], value);
-        return this->operator+(tensor);
+        return scalar_op(BinaryOp::ADD, to_element(value));
     }
 
     template <typename T>
     Tensor operator-(T value) const {
-        Tensor tensor({1});
-        WRITE_ELEMENT(tensor[0], value);
-        return this->operator-(tensor);
+        return scalar_op(BinaryOp::SUB, to_element(value));
     }
 
     template <typename T>
     Tensor operator*(T value) const {
-        Tensor tensor({1});
-        WRITE_ELEMENT(tensor[0], value);
-        return this->operator*(tensor);
+        return scalar_op(BinaryOp::MUL, to_element(value));
     }
 
     template <typename T>
     Tensor operator/(T value) const {
-        Tensor tensor({1});
-        WRITE_ELEMENT(tensor[0], value);
-        return this->operator/(tensor);
+        return scalar_op(BinaryOp::DIV, to_element(value));
     }
 
     template <typename T>
     typename std::enable_if_t<!std::is_same_v<T, Tensor>, void> operator+=(T value) {
-        Tensor tensor({1});
-        WRITE_ELEMENT(tensor[0], value);
-        add_forward_impl(*this, tensor, *this);
+        inplace_scalar_op(BinaryOp::ADD, to_element(value));
     }
 
     template <typename T>
     typename std::enable_if_t<!std::is_same_v<T, Tensor>, void> operator-=(T value) {
-        Tensor tensor({1});
-        WRITE_ELEMENT(tensor[0], value);
-        sub_forward_impl(*this, tensor, *this);
+        inplace_scalar_op(BinaryOp::SUB, to_element(value));
     }
 
     template <typename T>
     typename std::enable_if_t<!std::is_same_v<T, Tensor>, void> operator*=(T value) {
-        Tensor tensor({1});
-        WRITE_ELEMENT(tensor[0], value);
-        mul_forward_impl(*this, tensor, *this);
+        inplace_scalar_op(BinaryOp::MUL, to_element(value));
     }
 
     template <typename T>
     typename std::enable_if_t<!std::is_same_v<T, Tensor>, void> operator/=(T value) {
-        Tensor tensor({1});
-        WRITE_ELEMENT(tensor[0], value);
-        div_forward_impl(*this, tensor, *this);
+        inplace_scalar_op(BinaryOp::DIV, to_element(value));
     }
 
+    // In-place ops write into this tensor's storage and aren't recorded by autograd, which makes
+    // them the way to update parameters (under a NoGradGuard) in a captured step
+    void operator+=(const Tensor& other);
+    void operator-=(const Tensor& other);
+    void operator*=(const Tensor& other);
+    void operator/=(const Tensor& other);
+
+    // Writes the values of src, broadcast to this tensor's shape and cast to its dtype, into this
+    // tensor's storage
+    void copy_from(const Tensor& src);
+
     template <typename T>
     void operator=(T value) {
-        for (uint32_t i = 0; i < size(); i++) {
-            WRITE_ELEMENT(this->operator[](i), value);
+        LOG_IF(FATAL, is_expanded()) << "Can't write to an expanded view";
+        evaluate_pending_readers();
+        if (!is_contiguous()) {
+            Tensor src({1}, m_dtype);
+            src = value;
+            cast_impl(src, *this);
+            return;
         }
-    }
 
-    void backward();
+        dispatch_type(m_dtype, [&](auto tag) {
+            using D = typename decltype(tag)::type;
+            D* data = data_ptr<D>();
+            for (size_t i = 0; i < size(); i++) data[i] = D(value);
+        });
+    }
 
-#undef WRITE_ELEMENT
+    // Frees the tensors saved by every node once its backward has run, unless retain_graph is set
+    // to allow another backward (or a double backward) through the same graph
+    void backward(bool retain_graph = false);
 
    private:
-    Element operator[](uint32_t offset) const { return const_cast<Tensor*>(this)->operator[](offset); }
+    // Offset of the element at indices from the first element of this tensor
+    uint32_t element_offset(const std::vector<uint32_t>& indices) const;
+
+    // Elements stored in 8 or 16 bits are read converted into an Element; only 32-bit ones can be
+    // referenced in place
+    Element operator[](uint32_t offset) const {
+        if (element_size(m_dtype) == sizeof(Element)) return element(offset);
+
+        Element value;
+        dispatch_type(m_dtype, [&](auto tag) {
+            using T = typename decltype(tag)::type;
+            value = Element(data_ptr<T>()[offset]);
+        });
+        return value;
+    }
 
+    // The returned reference may be written to, so the lazy expressions still reading this
+    // tensor are evaluated first
     Element& operator[](uint32_t offset) {
-        LOG_IF(FATAL, offset >= size()) << "index out of range";
+        LOG_IF(FATAL, element_size(m_dtype) != sizeof(Element))
+            << "Elements of a " << m_dtype << " tensor can't be referenced in place; assign the tensor or use "
+            << "copy_from to write them";
+        evaluate_pending_readers();
+        return element(offset);
+    }
+
+    // offset counts elements from the first one of this tensor, following its strides, so it
+    // can run past size() in a view; the storage checks it against its own size
+    Element& element(uint32_t offset) const {
+        if (m_expr) materialize();
         return *reinterpret_cast<Element*>(m_storage.at((m_offset + offset) * sizeof(Element)));
     }
 
-    Element broadcasted_read(const std::vector<uint32_t>& indices) const;
+    // Element strides for reading this tensor broadcast to `shape`, 0 on broadcast dims
+    std::vector<int64_t> broadcast_strides(const std::vector<uint32_t>& shape) const;
+
+    // Converts a C++ scalar to an Element holding this tensor's dtype
+    template <typename T>
+    Element to_element(T value) const {
+        Element element;
+        dispatch_type(m_dtype, [&](auto tag) {
+            using D = typename decltype(tag)::type;
+            element = Element(D(value));
+        });
+        return element;
+    }
+
+    Tensor scalar_op(BinaryOp op, Element value) const;
+
+    // Which dims a reduction over dims (every dim when empty) reduces
+    std::vector<bool> reduced_dims(const std::vector<uint32_t>& dims) const;
+
+    Tensor reduce(ReduceOp op, const std::vector<uint32_t>& dims, bool keep_dims) const;
+
+    Tensor arg_reduce(ReduceOp op, const std::vector<uint32_t>& dims, bool keep_dims) const;
+
+    // Drops the reduced dims from the keep_dims shape of a freshly computed reduction
+    void drop_reduced_dims(const std::vector<bool>& reduced);
+
+    // A view of a reduction result (or its gradient) with the reduced dims back as size-1 dims
+    Tensor keep_reduced_dims(const std::vector<bool>& reduced) const;
+
+    // A view of this tensor with the given layout. Its gradient is written to view_fn applied to
+    // the grad buffer of this tensor, the same view taken of a tensor with this one's shape
+    Tensor make_view(std::vector<uint32_t> shape, std::vector<uint32_t> stride, int64_t offset,
+                     std::function<Tensor(const Tensor&)> view_fn) const;
+
+    void inplace_op(BinaryOp op, const Tensor& other);
+
+    void inplace_scalar_op(BinaryOp op, Element value);
+
+    void materialize() const;
+
+    // Evaluates this tensor and the lazy expressions reading its storage, before it is written in place
+    void evaluate_pending_readers() const;
+
+    template <typename T>
+    T* data_ptr() const {
+        if (m_expr) materialize();
+        return reinterpret_cast<T*>(m_storage.at(m_offset * element_size(m_dtype)));
+    }
 
    private:
     Type m_dtype = Type::FLOAT32;
@@ -218,17 +423,33 @@ class Tensor {
 
    private:
     std::vector<uint32_t> m_shape, m_stride;
-    Storage m_storage;
+    // A lazy tensor has no storage until its expression is evaluated on first read, which fills
+    // in m_storage and clears m_expr even through a const reference
+    mutable Storage m_storage;
+    mutable std::shared_ptr<LazyExpr> m_expr;
+    // Scale and zero point of a quantized tensor, shared with its views
+    std::shared_ptr<const QuantParams> m_quant;
 
    private:
     std::shared_ptr<AutogradContext> m_saved_context = std::make_shared<AutogradContext>();
-    std::function<void(Tensor&)> m_grad_fn;
 
    public:
     friend std::ostream& operator<<(std::ostream& os, const Tensor& t);
     friend Tensor get_element_wise_empty_output(const Tensor& in1, const Tensor& in2);
     friend Tensor get_matmul_empty_output(const Tensor& in1, const Tensor& in2);
-    friend void align_gradient_with_tensor(const Tensor& tensor, Tensor& gradient);
+    friend MatmulProblem get_matmul_problem(const Tensor& in1, const Tensor& in2);
+    friend MatmulOperand get_matmul_operand(const Tensor& t, size_t batch_ndims, bool has_rows, bool has_cols);
+    friend class KernelRegistry;
+    friend class BackwardPlan;
+    friend class FusedKernel;
+    friend struct LazyExpr;
+    friend class DataLoader;
+    friend struct QuantParams;
+    friend Tensor checkpoint(const Segment& segment, const std::vector<Tensor>& inputs);
+    friend void save(const std::string& path, const TensorDict& tensors);
+    friend TensorDict load(const std::string& path);
+    friend Tensor load_raw(const std::string& path, std::vector<uint32_t> shape, Type dtype, uint64_t offset);
+    friend std::future<void> save_async(const std::string& path, const TensorDict& tensors);
 
     // Forward Functions
     static void add_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out);
@@ -236,33 +457,112 @@ class Tensor {
     static void mul_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out);
     static void div_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out);
     static void matmul_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out);
-    static void sum_forward_impl(const Tensor& in, const uint32_t dim, Tensor& out);
+    static void addmm_forward_impl(const Tensor& in1, const Tensor& in2, const Tensor* bias, Activation activation,
+                                   Tensor& out);
+    static void int8_matmul_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out);
+    static void quantize_impl(const Tensor& in, Tensor& out);
+    static void dequantize_impl(const Tensor& in, Tensor& out);
+    static void reduce_forward_impl(ReduceOp op, const Tensor& in, Tensor& out);
+    static void arg_reduce_forward_impl(ReduceOp op, const Tensor& in, Tensor& out, Tensor& indices);
+
+    static void cast_impl(const Tensor& in, Tensor& out);
+    static Tensor promote(const Tensor& in, Type dtype);
+    static void gemm_into(Tensor& out, bool accumulate, const std::function<void(const Tensor&, bool)>& gemm_fn);
+
+    static void binary_forward_impl(BinaryOp op, const Tensor& in1, const Tensor& in2, Tensor& out);
+    static void scalar_forward_impl(BinaryOp op, const Tensor& in, Element value, Tensor& out);
+
+    // Lazy element-wise ops and the fused kernel that evaluates them into out, or adds them to it
+    static Tensor lazy_op(BinaryOp op, const Tensor& lhs, const Tensor& rhs);
+    static Tensor lazy_scalar_op(BinaryOp op, const Tensor& in, Element value);
+    static Tensor from_expr(std::shared_ptr<LazyExpr> expr);
+    static void fused_forward_impl(const LazyExpr& expr, Tensor& out, bool accumulate);
+
+    template <typename Op, typename T>
+    static void binary_contiguous_kernel(const Tensor& in1, const Tensor& in2, Tensor& out);
+
+    template <typename Op, typename T>
+    static void binary_strided_kernel(const Tensor& in1, const Tensor& in2, Tensor& out);
+
+    template <typename Op, typename T>
+    static void scalar_contiguous_kernel(const Tensor& in, Element value, Tensor& out);
+
+    template <typename Op, typename T>
+    static void scalar_strided_kernel(const Tensor& in, Element value, Tensor& out);
 
     // Backward Functions
-    static void add_backward_impl(Tensor& out);
-    static void sub_backward_impl(Tensor& out);
-    static void mul_backward_impl(Tensor& out);
-    static void div_backward_impl(Tensor& out);
-    static void matmul_backward_impl(Tensor& out);
-    static void sum_backward_impl(Tensor& out);
-
-    void topological_sort(Tensor& curr, std::vector<Tensor>& list,
-                          std::unordered_set<std::shared_ptr<AutogradContext>>& visited);
+    static void add_backward_impl(AutogradContext& ctx);
+    static void sub_backward_impl(AutogradContext& ctx);
+    static void mul_backward_impl(AutogradContext& ctx);
+    static void div_backward_impl(AutogradContext& ctx);
+    static void matmul_backward_impl(AutogradContext& ctx);
+    static void matmul_backward(AutogradContext& ctx, const Tensor& in1, const Tensor& in2, const Tensor& out_grad);
+    static void addmm_backward_impl(AutogradContext& ctx, Activation activation);
+    static void view_backward_impl(AutogradContext& ctx, const std::function<Tensor(const Tensor&)>& view_fn);
+    static void expand_backward_impl(AutogradContext& ctx);
+    static void sum_backward_impl(AutogradContext& ctx, const std::vector<bool>& reduced);
+    static void prod_backward_impl(AutogradContext& ctx, const std::vector<bool>& reduced);
+    static void select_backward_impl(AutogradContext& ctx, const std::vector<bool>& reduced, const Tensor& indices);
+    static void cast_backward_impl(AutogradContext& ctx);
+    static void scalar_backward_impl(AutogradContext& ctx, BinaryOp op, Element value);
+    static void checkpoint_backward_impl(AutogradContext& ctx, const Segment& segment);
+
+    static void accumulate_grad(const Tensor& in, const Tensor& grad, const Tensor* factor, Element scale,
+                                bool divide = false);
+
+    static Tensor& grad_buffer(const Tensor& in, bool& accumulate);
+
+    template <typename T, bool HasFactor>
+    static void accumulate_grad_kernel(const Tensor& grad, const Tensor* factor, compute_t<T> scale, bool divide,
+                                       Tensor& dst, bool accumulate);
 };
 
+/**
+ * One node of the autograd graph: the inputs an op saved for its backward, the function that
+ * propagates this node's gradient to them, and the gradient itself once it has been computed.
+ */
 class AutogradContext {
    public:
-    void save_for_backward(const std::vector<Tensor>& tensors_to_save) {
-        m_saved_tensors.insert(m_saved_tensors.end(), tensors_to_save.begin(), tensors_to_save.end());
+    using GradFn = std::function<void(AutogradContext&)>;
+
+    void save_for_backward(std::vector<Tensor> tensors_to_save) {
+        if (m_saved_tensors.empty()) {
+            m_saved_tensors = std::move(tensors_to_save);
+            return;
+        }
+
+        m_saved_tensors.insert(m_saved_tensors.end(), std::make_move_iterator(tensors_to_save.begin()),
+                               std::make_move_iterator(tensors_to_save.end()));
     }
 
-    std::vector<Tensor> get_saved_variables() { return m_saved_tensors; }
+    const std::vector<Tensor>& get_saved_variables() const { return m_saved_tensors; }
 
     std::shared_ptr<Tensor>& grad() { return m_grad; }
 
+    // A stale grad buffer is left over from an earlier backward through the same graph and kept so
+    // it can be reused: the next gradient written to it overwrites it instead of accumulating
+    bool has_grad() const { return m_grad && !m_grad_stale; }
+
+    void mark_grad_fresh() { m_grad_stale = false; }
+
+    void set_grad_fn(GradFn grad_fn) { m_grad_fn = std::move(grad_fn); }
+
+    const GradFn& grad_fn() const { return m_grad_fn; }
+
    private:
+    friend class BackwardPlan;
+
     std::vector<Tensor> m_saved_tensors;
     std::shared_ptr<Tensor> m_grad = nullptr;
+    bool m_grad_stale = false;
+    GradFn m_grad_fn;
+
+    // Set by BackwardPlan while it walks a graph, so a visited node is recognized without a lookup
+    uint64_t m_visit_epoch = 0;
+    uint32_t m_plan_index = 0;
+
+    // Backward already went through this node and dropped what it saved
+    bool m_released = false;
 };
 
 };  // namespace micro
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "includes.hpp"
+
+namespace micro {
+
+/**
+ * Persistent pool of worker threads. Each worker owns a task deque, pops from its front and
+ * steals from the back of the other deques once its own runs dry. The thread that submits work
+ * takes part as well, so a pool of size N runs N - 1 background workers.
+ */
+class ThreadPool {
+   public:
+    using RangeFn = std::function<void(int64_t, int64_t)>;
+
+    explicit ThreadPool(uint32_t num_threads);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    uint32_t size() const { return m_queues.size() + 1; }
+
+    // Splits [begin, end) into chunks of at least grain_size elements and runs fn on each chunk,
+    // returning once every chunk has finished.
+    void run(int64_t begin, int64_t end, int64_t grain_size, const RangeFn& fn);
+
+   private:
+    struct Task {
+        const RangeFn* fn;
+        int64_t begin, end;
+        std::atomic<int64_t>* pending;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool try_pop(size_t queue, Task& task);
+
+    bool try_steal(size_t thief, Task& task);
+
+    void execute(const Task& task);
+
+    void worker_loop(size_t id);
+
+   private:
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_sleep_cv;
+    std::atomic<int64_t> m_queued{0};
+    bool m_stop = false;
+};
+
+// Number of threads used by the kernels. Defaults to the MICRO_TORCH_NUM_THREADS environment
+// variable, or to the hardware concurrency when it isn't set.
+uint32_t get_num_threads();
+
+// Resizes the intra-op thread pool. Must not be called while kernels are running.
+void set_num_threads(uint32_t num_threads);
+
+/**
+ * Runs fn(chunk_begin, chunk_end) over [begin, end) on the intra-op thread pool. Ranges that
+ * fit in a single grain, and calls made from inside another parallel region, run inline on the
+ * calling thread so small tensors never pay for scheduling.
+ */
+void parallel_for(int64_t begin, int64_t end, int64_t grain_size, const ThreadPool::RangeFn& fn);
+
+};  // namespace micro
@@ -0,0 +1,366 @@
+#pragma once
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "half.hpp"
+#include "includes.hpp"
+
+namespace micro {
+namespace vec {
+
+/**
+ * Thin wrapper over the widest SIMD register available at compile time.
+ * The generic version holds a single lane so every kernel written against Vec<T>
+ * still compiles (and auto-vectorizes where possible) without AVX.
+ * Vec<float> also loads from and stores to Half and BFloat16 memory, converting on the way, so
+ * kernels over 16-bit floats compute in float registers.
+ */
+template <typename T>
+struct Vec {
+    static constexpr size_t size = 1;
+    T v;
+
+    static Vec load(const T* ptr) { return {*ptr}; }
+
+    static Vec broadcast(T value) { return {value}; }
+
+    void store(T* ptr) const { *ptr = v; }
+
+    template <typename U>
+    static Vec load(const U* ptr) {
+        return {T(*ptr)};
+    }
+
+    template <typename U>
+    void store(U* ptr) const {
+        *ptr = U(v);
+    }
+
+    friend Vec operator+(Vec a, Vec b) { return {T(a.v + b.v)}; }
+
+    friend Vec operator-(Vec a, Vec b) { return {T(a.v - b.v)}; }
+
+    friend Vec operator*(Vec a, Vec b) { return {T(a.v * b.v)}; }
+
+    friend Vec operator/(Vec a, Vec b) { return {T(a.v / b.v)}; }
+
+    friend Vec max(Vec a, Vec b) { return {a.v < b.v ? b.v : a.v}; }
+
+    friend Vec min(Vec a, Vec b) { return {b.v < a.v ? b.v : a.v}; }
+};
+
+#if defined(__AVX512F__)
+
+template <>
+struct Vec<float> {
+    static constexpr size_t size = 16;
+    __m512 v;
+
+    static Vec load(const float* ptr) { return {_mm512_loadu_ps(ptr)}; }
+
+    static Vec broadcast(float value) { return {_mm512_set1_ps(value)}; }
+
+    void store(float* ptr) const { _mm512_storeu_ps(ptr, v); }
+
+    // The conversions use the zero-masked forms with every lane set: GCC 12 reports the undefined
+    // pass-through register of the unmasked ones as -Wmaybe-uninitialized
+    static constexpr __mmask16 ALL = 0xffff;
+
+    static Vec load(const Half* ptr) { return {_mm512_maskz_cvtph_ps(ALL, _mm256_loadu_si256((const __m256i*)ptr))}; }
+
+    void store(Half* ptr) const {
+        _mm256_storeu_si256((__m256i*)ptr, _mm512_maskz_cvtps_ph(ALL, v, _MM_FROUND_TO_NEAREST_INT));
+    }
+
+    static Vec load(const BFloat16* ptr) {
+        __m512i bits = _mm512_maskz_cvtepu16_epi32(ALL, _mm256_loadu_si256((const __m256i*)ptr));
+        return {_mm512_castsi512_ps(_mm512_maskz_slli_epi32(ALL, bits, 16))};
+    }
+
+    void store(BFloat16* ptr) const {
+#if defined(__AVX512BF16__)
+        _mm256_storeu_si256((__m256i*)ptr, (__m256i)_mm512_cvtneps_pbh(v));
+#else
+        // Round to nearest even on the bits, keeping NaNs quiet, as float_to_bfloat16_bits does
+        __m512i x = _mm512_castps_si512(v);
+        __m512i odd = _mm512_and_si512(_mm512_srli_epi32(x, 16), _mm512_set1_epi32(1));
+        __m512i rounded = _mm512_add_epi32(x, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7fff)));
+        __mmask16 nan = _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q);
+        rounded = _mm512_mask_mov_epi32(rounded, nan, _mm512_or_si512(x, _mm512_set1_epi32(0x400000)));
+        _mm256_storeu_si256((__m256i*)ptr, _mm512_cvtepi32_epi16(_mm512_srli_epi32(rounded, 16)));
+#endif
+    }
+
+    friend Vec operator+(Vec a, Vec b) { return {_mm512_add_ps(a.v, b.v)}; }
+
+    friend Vec operator-(Vec a, Vec b) { return {_mm512_sub_ps(a.v, b.v)}; }
+
+    friend Vec operator*(Vec a, Vec b) { return {_mm512_mul_ps(a.v, b.v)}; }
+
+    friend Vec operator/(Vec a, Vec b) { return {_mm512_div_ps(a.v, b.v)}; }
+
+    // The masked forms compile to the same instruction; the unmasked ones trip GCC's
+    // -Wmaybe-uninitialized on the undefined register they pass through
+    friend Vec max(Vec a, Vec b) { return {_mm512_mask_max_ps(a.v, 0xFFFF, a.v, b.v)}; }
+
+    friend Vec min(Vec a, Vec b) { return {_mm512_mask_min_ps(a.v, 0xFFFF, a.v, b.v)}; }
+};
+
+#define MICRO_VEC_INT32(T, SIGN)                                                                 \
+    template <>                                                                                  \
+    struct Vec<T> {                                                                              \
+        static constexpr size_t size = 16;                                                       \
+        __m512i v;                                                                               \
+                                                                                                 \
+        static Vec load(const T* ptr) { return {_mm512_loadu_si512(ptr)}; }                      \
+                                                                                                 \
+        static Vec broadcast(T value) { return {_mm512_set1_epi32(int32_t(value))}; }            \
+                                                                                                 \
+        void store(T* ptr) const { _mm512_storeu_si512(ptr, v); }                                \
+                                                                                                 \
+        friend Vec operator+(Vec a, Vec b) { return {_mm512_add_epi32(a.v, b.v)}; }              \
+                                                                                                 \
+        friend Vec operator-(Vec a, Vec b) { return {_mm512_sub_epi32(a.v, b.v)}; }              \
+                                                                                                 \
+        friend Vec operator*(Vec a, Vec b) { return {_mm512_mullo_epi32(a.v, b.v)}; }            \
+                                                                                                 \
+        friend Vec operator/(Vec a, Vec b) {                                                     \
+            alignas(64) T lhs[size], rhs[size];                                                  \
+            a.store(lhs);                                                                        \
+            b.store(rhs);                                                                        \
+            for (size_t i = 0; i < size; i++) lhs[i] /= rhs[i];                                  \
+            return load(lhs);                                                                    \
+        }                                                                                        \
+                                                                                                 \
+        friend Vec max(Vec a, Vec b) { return {_mm512_mask_max_##SIGN(a.v, 0xFFFF, a.v, b.v)}; } \
+                                                                                                 \
+        friend Vec min(Vec a, Vec b) { return {_mm512_mask_min_##SIGN(a.v, 0xFFFF, a.v, b.v)}; } \
+    }
+
+MICRO_VEC_INT32(int32_t, epi32);
+MICRO_VEC_INT32(uint32_t, epu32);
+
+#undef MICRO_VEC_INT32
+
+#elif defined(__AVX2__)
+
+template <>
+struct Vec<float> {
+    static constexpr size_t size = 8;
+    __m256 v;
+
+    static Vec load(const float* ptr) { return {_mm256_loadu_ps(ptr)}; }
+
+    static Vec broadcast(float value) { return {_mm256_set1_ps(value)}; }
+
+    void store(float* ptr) const { _mm256_storeu_ps(ptr, v); }
+
+#if defined(__F16C__)
+    static Vec load(const Half* ptr) { return {_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)ptr))}; }
+
+    void store(Half* ptr) const { _mm_storeu_si128((__m128i*)ptr, _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT)); }
+#else
+    static Vec load(const Half* ptr) {
+        alignas(32) float lanes[size];
+        for (size_t i = 0; i < size; i++) lanes[i] = ptr[i];
+        return load(lanes);
+    }
+
+    void store(Half* ptr) const {
+        alignas(32) float lanes[size];
+        store(lanes);
+        for (size_t i = 0; i < size; i++) ptr[i] = lanes[i];
+    }
+#endif
+
+    static Vec load(const BFloat16* ptr) {
+        __m256i bits = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)ptr));
+        return {_mm256_castsi256_ps(_mm256_slli_epi32(bits, 16))};
+    }
+
+    void store(BFloat16* ptr) const {
+        // Round to nearest even on the bits, keeping NaNs quiet, as float_to_bfloat16_bits does
+        __m256i x = _mm256_castps_si256(v);
+        __m256i odd = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+        __m256i rounded = _mm256_add_epi32(x, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7fff)));
+        __m256 nan = _mm256_cmp_ps(v, v, _CMP_UNORD_Q);
+        __m256i quiet = _mm256_or_si256(x, _mm256_set1_epi32(0x400000));
+        rounded = _mm256_castps_si256(
+            _mm256_blendv_ps(_mm256_castsi256_ps(rounded), _mm256_castsi256_ps(quiet), nan));
+
+        // Pack the upper halves; packus works within 128-bit lanes, so the two lanes are gathered
+        __m256i packed = _mm256_packus_epi32(_mm256_srli_epi32(rounded, 16), _mm256_setzero_si256());
+        packed = _mm256_permute4x64_epi64(packed, 0x08);
+        _mm_storeu_si128((__m128i*)ptr, _mm256_castsi256_si128(packed));
+    }
+
+    friend Vec operator+(Vec a, Vec b) { return {_mm256_add_ps(a.v, b.v)}; }
+
+    friend Vec operator-(Vec a, Vec b) { return {_mm256_sub_ps(a.v, b.v)}; }
+
+    friend Vec operator*(Vec a, Vec b) { return {_mm256_mul_ps(a.v, b.v)}; }
+
+    friend Vec operator/(Vec a, Vec b) { return {_mm256_div_ps(a.v, b.v)}; }
+
+    friend Vec max(Vec a, Vec b) { return {_mm256_max_ps(a.v, b.v)}; }
+
+    friend Vec min(Vec a, Vec b) { return {_mm256_min_ps(a.v, b.v)}; }
+};
+
+#define MICRO_VEC_INT32(T, SIGN)                                                                   \
+    template <>                                                                                    \
+    struct Vec<T> {                                                                                \
+        static constexpr size_t size = 8;                                                          \
+        __m256i v;                                                                                 \
+                                                                                                   \
+        static Vec load(const T* ptr) { return {_mm256_loadu_si256((const __m256i*)ptr)}; }        \
+                                                                                                   \
+        static Vec broadcast(T value) { return {_mm256_set1_epi32(int32_t(value))}; }              \
+                                                                                                   \
+        void store(T* ptr) const { _mm256_storeu_si256((__m256i*)ptr, v); }                        \
+                                                                                                   \
+        friend Vec operator+(Vec a, Vec b) { return {_mm256_add_epi32(a.v, b.v)}; }                \
+                                                                                                   \
+        friend Vec operator-(Vec a, Vec b) { return {_mm256_sub_epi32(a.v, b.v)}; }                \
+                                                                                                   \
+        friend Vec operator*(Vec a, Vec b) { return {_mm256_mullo_epi32(a.v, b.v)}; }              \
+                                                                                                   \
+        friend Vec operator/(Vec a, Vec b) {                                                       \
+            alignas(32) T lhs[size], rhs[size];                                                    \
+            a.store(lhs);                                                                          \
+            b.store(rhs);                                                                          \
+            for (size_t i = 0; i < size; i++) lhs[i] /= rhs[i];                                    \
+            return load(lhs);                                                                      \
+        }                                                                                          \
+                                                                                                   \
+        friend Vec max(Vec a, Vec b) { return {_mm256_max_##SIGN(a.v, b.v)}; }                     \
+                                                                                                   \
+        friend Vec min(Vec a, Vec b) { return {_mm256_min_##SIGN(a.v, b.v)}; }                     \
+    }
+
+MICRO_VEC_INT32(int32_t, epi32);
+MICRO_VEC_INT32(uint32_t, epu32);
+
+#undef MICRO_VEC_INT32
+
+#endif
+
+// a * b + c, fused into a single instruction where the target supports it.
+template <typename V>
+inline V fmadd(V a, V b, V c) {
+    return a * b + c;
+}
+
+#if defined(__AVX512F__)
+template <>
+inline Vec<float> fmadd(Vec<float> a, Vec<float> b, Vec<float> c) {
+    return {_mm512_fmadd_ps(a.v, b.v, c.v)};
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+template <>
+inline Vec<float> fmadd(Vec<float> a, Vec<float> b, Vec<float> c) {
+    return {_mm256_fmadd_ps(a.v, b.v, c.v)};
+}
+#endif
+
+struct Add {
+    template <typename V>
+    static V apply(V a, V b) {
+        return a + b;
+    }
+};
+
+struct Sub {
+    template <typename V>
+    static V apply(V a, V b) {
+        return a - b;
+    }
+};
+
+struct Mul {
+    template <typename V>
+    static V apply(V a, V b) {
+        return a * b;
+    }
+};
+
+struct Div {
+    template <typename V>
+    static V apply(V a, V b) {
+        return a / b;
+    }
+};
+
+struct Max {
+    template <typename V>
+    static V apply(V a, V b) {
+        if constexpr (std::is_arithmetic_v<V>) {
+            return a < b ? b : a;
+        } else {
+            return max(a, b);
+        }
+    }
+};
+
+struct Min {
+    template <typename V>
+    static V apply(V a, V b) {
+        if constexpr (std::is_arithmetic_v<V>) {
+            return b < a ? b : a;
+        } else {
+            return min(a, b);
+        }
+    }
+};
+
+template <typename Op, bool in1_scalar, bool in2_scalar, typename T>
+void binary_loop(const T* in1, const T* in2, T* out, size_t n) {
+    using C = compute_t<T>;
+    using V = Vec<C>;
+    const V s1 = V::broadcast(C(*in1)), s2 = V::broadcast(C(*in2));
+
+    size_t i = 0;
+    for (; i + V::size <= n; i += V::size) {
+        V a = in1_scalar ? s1 : V::load(in1 + i);
+        V b = in2_scalar ? s2 : V::load(in2 + i);
+        Op::apply(a, b).store(out + i);
+    }
+
+    for (; i < n; i++) {
+        C a = in1_scalar ? *in1 : in1[i];
+        C b = in2_scalar ? *in2 : in2[i];
+        out[i] = T(Op::apply(a, b));
+    }
+}
+
+/**
+ * out[i] = Op(in1[i], in2[i]) over a flat buffer of n elements, computed in compute_t<T>.
+ * A scalar input (in*_scalar = true) is read once and broadcast to every lane.
+ */
+template <typename Op, typename T>
+void binary_kernel(const T* in1, bool in1_scalar, const T* in2, bool in2_scalar, T* out, size_t n) {
+    if (in1_scalar && in2_scalar) {
+        binary_loop<Op, true, true>(in1, in2, out, n);
+    } else if (in1_scalar) {
+        binary_loop<Op, true, false>(in1, in2, out, n);
+    } else if (in2_scalar) {
+        binary_loop<Op, false, true>(in1, in2, out, n);
+    } else {
+        binary_loop<Op, false, false>(in1, in2, out, n);
+    }
+}
+
+// dst[i] = O(src[i]) for float and 16-bit float element types, converted a register at a time
+template <typename I, typename O>
+void convert(const I* src, O* dst, size_t n) {
+    using V = Vec<float>;
+
+    size_t i = 0;
+    for (; i + V::size <= n; i += V::size) V::load(src + i).store(dst + i);
+    for (; i < n; i++) dst[i] = O(float(src[i]));
+}
+
+};  // namespace vec
+};  // namespace micro
@@ -0,0 +1,172 @@
+#include "backward_plan.hpp"
+
+#include <atomic>
+
+namespace micro {
+
+// Each walk over a graph stamps the nodes it reaches with a fresh epoch
+static uint64_t next_epoch() {
+    static std::atomic<uint64_t> epoch{0};
+    return ++epoch;
+}
+
+bool BackwardPlan::prepare(AutogradContext& root) {
+    if (!m_nodes.empty() && bind(root)) return true;
+
+    build(root);
+    return false;
+}
+
+void BackwardPlan::visit(AutogradContext& node, uint64_t epoch, uint32_t index) {
+    node.m_visit_epoch = epoch;
+    node.m_plan_index = index;
+}
+
+// A released node reached from another graph has nothing left to propagate to and ends the walk
+// like a leaf, which is how a parameter updated from its own gradient stops the graph growing
+// from one step to the next.
+void BackwardPlan::build(AutogradContext& root) {
+    LOG_IF(FATAL, root.m_released)
+        << "Trying to backward through the graph a second time, pass retain_graph=true to the first backward";
+
+    uint64_t epoch = next_epoch();
+
+    m_nodes.assign(1, &root);
+    m_edge_begin.clear();
+    m_edges.clear();
+    visit(root, epoch, 0);
+
+    // Breadth first: m_nodes doubles as the queue of nodes whose parents are still to be walked
+    for (size_t i = 0; i < m_nodes.size(); i++) {
+        m_edge_begin.push_back(m_edges.size());
+
+        for (auto& parent : m_nodes[i]->m_saved_tensors) {
+            auto* node = parent.m_saved_context.get();
+            if (!node) {
+                m_edges.push_back(-1);
+                continue;
+            }
+
+            if (node->m_visit_epoch != epoch) {
+                visit(*node, epoch, m_nodes.size());
+                m_nodes.push_back(node);
+            }
+
+            m_edges.push_back(node->m_plan_index);
+        }
+    }
+    m_edge_begin.push_back(m_edges.size());
+
+    // A node is ready once every node consuming it has run and accumulated into its gradient
+    std::vector<uint32_t> consumers(m_nodes.size(), 0);
+    for (auto edge : m_edges) {
+        if (edge >= 0) consumers[edge]++;
+    }
+
+    m_order.clear();
+    std::vector<uint32_t> ready(1, 0);
+    while (!ready.empty()) {
+        uint32_t i = ready.back();
+        ready.pop_back();
+
+        // Leaves have nothing to propagate to
+        if (m_edge_begin[i] != m_edge_begin[i + 1]) m_order.push_back(i);
+
+        for (uint32_t e = m_edge_begin[i]; e < m_edge_begin[i + 1]; e++) {
+            if (m_edges[e] >= 0 && --consumers[m_edges[e]] == 0) ready.push_back(m_edges[e]);
+        }
+    }
+}
+
+// Walks the new graph in the same order build() did and checks every edge against the stored
+// one. A parent seen for the first time has to be the next node in the numbering, and one seen
+// before has to carry the number recorded for this edge, so shared subgraphs must match too.
+bool BackwardPlan::bind(AutogradContext& root) {
+    if (root.m_released) return false;
+
+    uint64_t epoch = next_epoch();
+
+    m_nodes[0] = &root;
+    visit(root, epoch, 0);
+    uint32_t num_bound = 1;
+
+    for (size_t i = 0; i < m_nodes.size(); i++) {
+        auto& parents = m_nodes[i]->m_saved_tensors;
+        uint32_t begin = m_edge_begin[i];
+        if (parents.size() != m_edge_begin[i + 1] - begin) return false;
+
+        for (size_t j = 0; j < parents.size(); j++) {
+            auto* node = parents[j].m_saved_context.get();
+            int32_t expected = m_edges[begin + j];
+
+            if (!node || expected < 0) {
+                if (node || expected >= 0) return false;
+                continue;
+            }
+
+            if (node->m_visit_epoch == epoch) {
+                if (node->m_plan_index != uint32_t(expected)) return false;
+                continue;
+            }
+
+            if (uint32_t(expected) != num_bound) return false;
+            visit(*node, epoch, num_bound);
+            m_nodes[num_bound++] = node;
+        }
+    }
+
+    return true;
+}
+
+void BackwardPlan::run(bool retain_graph) const {
+    // Dropping the saved tensors of a node can release the last reference to a parent that hasn't
+    // run yet, so the parent nodes are held here until the pass is over
+    std::vector<std::shared_ptr<AutogradContext>> pending;
+
+    // Gradients of inner nodes left over from an earlier pass through a retained graph would be
+    // accumulated into, so they are overwritten in place. The root already holds its seed gradient
+    for (auto i : m_order) {
+        if (i != 0) m_nodes[i]->m_grad_stale = true;
+    }
+
+    for (auto i : m_order) {
+        auto* node = m_nodes[i];
+        if (!node->m_grad_fn) continue;
+        node->m_grad_fn(*node);
+
+        // Its consumers have folded a lazy gradient into the gradients of the parents by now
+        settle_lazy_grad(*node, retain_graph);
+        if (retain_graph) continue;
+
+        for (auto& parent : node->m_saved_tensors) pending.push_back(std::move(parent.m_saved_context));
+        node->m_saved_tensors.clear();
+        node->m_grad_fn = nullptr;
+        node->m_released = true;
+    }
+
+    // Leaves keep their gradients for the caller to read
+    for (size_t i = 0; i < m_nodes.size(); i++) {
+        if (m_edge_begin[i] == m_edge_begin[i + 1]) settle_lazy_grad(*m_nodes[i], true);
+    }
+}
+
+// A lazy gradient is an expression over the tensors its grad function was given, which can
+// include the tensor owning the node (x in x * x), so it can't be left in the node unevaluated.
+// It is evaluated when it is kept and dropped otherwise.
+void BackwardPlan::settle_lazy_grad(AutogradContext& node, bool keep) {
+    auto& grad = node.m_grad;
+    if (!grad || !grad->m_expr) return;
+
+    if (keep) {
+        grad->materialize();
+    } else {
+        grad = nullptr;
+    }
+}
+
+void BackwardPlan::replay() const {
+    for (size_t i = 1; i < m_nodes.size(); i++) m_nodes[i]->m_grad_stale = true;
+    run(true);
+}
+
+};  // namespace micro
@@ -0,0 +1,119 @@
+#include "caching_allocator.hpp"
+
+#include <new>
+
+namespace micro {
+
+static constexpr size_t MIN_BLOCK_SIZE = 64;
+static constexpr uint32_t LOG2_MIN_BLOCK_SIZE = 6;
+static constexpr uint32_t STEPS_PER_POWER = 4;
+
+// Bucket of the blocks handed out by borrow(), which never reach the free lists
+static constexpr uint32_t BORROWED_BUCKET = UINT32_MAX;
+
+struct BorrowedBlock : StorageBlock {
+    std::function<void()> deleter;
+};
+
+CachingAllocator& CachingAllocator::instance() {
+    // Never destroyed: tensors with static storage duration may release blocks during shutdown
+    static CachingAllocator* allocator = new CachingAllocator();
+    return *allocator;
+}
+
+uint32_t CachingAllocator::bucket_index(size_t size) {
+    if (size <= MIN_BLOCK_SIZE) return 0;
+
+    // 2^power < size <= 2^(power + 1), split into STEPS_PER_POWER equal steps
+    uint32_t power = 63 - __builtin_clzll(size - 1);
+    size_t step = (size_t(1) << power) / STEPS_PER_POWER;
+    uint32_t sub_step = (size + step - 1) / step - STEPS_PER_POWER;
+
+    return 1 + (power - LOG2_MIN_BLOCK_SIZE) * STEPS_PER_POWER + (sub_step - 1);
+}
+
+size_t CachingAllocator::bucket_capacity(uint32_t bucket) {
+    if (bucket == 0) return MIN_BLOCK_SIZE;
+
+    uint32_t power = (bucket - 1) / STEPS_PER_POWER + LOG2_MIN_BLOCK_SIZE;
+    uint32_t sub_step = (bucket - 1) % STEPS_PER_POWER + 1;
+    size_t step = (size_t(1) << power) / STEPS_PER_POWER;
+
+    return (size_t(1) << power) + sub_step * step;
+}
+
+StorageBlock* CachingAllocator::allocate(size_t size) {
+    uint32_t bucket = bucket_index(size);
+    size_t capacity = bucket_capacity(bucket);
+    StorageBlock* block = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (bucket < m_free_blocks.size() && !m_free_blocks[bucket].empty()) {
+            block = m_free_blocks[bucket].back();
+            m_free_blocks[bucket].pop_back();
+            m_cached_bytes -= capacity;
+        }
+        m_allocated_bytes += capacity;
+    }
+
+    if (!block) {
+        void* memory = ::operator new(sizeof(StorageBlock) + capacity, std::align_val_t(alignof(StorageBlock)));
+        block = new (memory) StorageBlock();
+        block->bucket = bucket;
+    }
+
+    block->count_owners.store(1, std::memory_order_relaxed);
+    return block;
+}
+
+StorageBlock* CachingAllocator::borrow(std::function<void()> deleter) {
+    auto* block = new BorrowedBlock();
+    block->bucket = BORROWED_BUCKET;
+    block->deleter = std::move(deleter);
+    block->count_owners.store(1, std::memory_order_relaxed);
+    return block;
+}
+
+void CachingAllocator::release(StorageBlock* block) {
+    if (block->bucket == BORROWED_BUCKET) {
+        auto* borrowed = static_cast<BorrowedBlock*>(block);
+        if (borrowed->deleter) borrowed->deleter();
+        delete borrowed;
+        return;
+    }
+
+    size_t capacity = bucket_capacity(block->bucket);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (block->bucket >= m_free_blocks.size()) m_free_blocks.resize(block->bucket + 1);
+
+    m_free_blocks[block->bucket].push_back(block);
+    m_cached_bytes += capacity;
+    m_allocated_bytes -= capacity;
+}
+
+void CachingAllocator::empty_cache() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& blocks : m_free_blocks) {
+        for (auto* block : blocks) {
+            block->~StorageBlock();
+            ::operator delete(block, std::align_val_t(alignof(StorageBlock)));
+        }
+        blocks.clear();
+    }
+
+    m_cached_bytes = 0;
+}
+
+size_t CachingAllocator::cached_bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cached_bytes;
+}
+
+size_t CachingAllocator::allocated_bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_allocated_bytes;
+}
+
+};  // namespace micro
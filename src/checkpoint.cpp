@@ -0,0 +1,60 @@
+#include "backward_plan.hpp"
+#include "tensor.hpp"
+
+namespace micro {
+
+Tensor checkpoint(const Segment& segment, const std::vector<Tensor>& inputs) {
+    Tensor out;
+    {
+        NoGradGuard no_grad;
+        out = segment(inputs);
+    }
+
+    // Nothing tells from here whether the tensors the segment reaches outside its inputs, such as
+    // captured parameters, need a gradient, so the result gets a node whenever grad is enabled.
+    // The recompute finds out, and stops early when none of them does
+    if (!is_grad_enabled()) return out;
+
+    // The node is the result's own, even when the segment returned one of its inputs as is
+    out.m_saved_context = std::make_shared<AutogradContext>();
+    out.m_saved_context->save_for_backward(inputs);
+    out.m_requires_grad = true;
+    out.m_saved_context->set_grad_fn(
+        [segment](AutogradContext& ctx) { Tensor::checkpoint_backward_impl(ctx, segment); });
+    return out;
+}
+
+// The segment runs again on copies of its inputs detached from the graph, so the graph it builds
+// ends at those copies. A backward pass of its own takes this node's gradient through it, and the
+// gradients reaching the copies are then handed to the real inputs.
+void Tensor::checkpoint_backward_impl(AutogradContext& ctx, const Segment& segment) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
+
+    auto& inputs = ctx.get_saved_variables();
+
+    std::vector<Tensor> detached = inputs;
+    for (auto& in : detached) in.m_saved_context = std::make_shared<AutogradContext>();
+
+    // Backward runs with grad disabled, and the segment has to record its graph this time
+    Tensor out;
+    {
+        EnableGradGuard enable_grad;
+        out = segment(detached);
+    }
+
+    if (!out.m_requires_grad) return;
+    LOG_IF(FATAL, out.m_shape != ctx.grad()->m_shape) << "Checkpointed segment returned another shape on recompute";
+
+    BackwardPlan plan;
+    plan.prepare(*out.m_saved_context);
+    out.m_saved_context->grad() = ctx.grad();
+    plan.run(false);
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        auto& grad = detached[i].m_saved_context->grad();
+        if (!grad) continue;
+        accumulate_grad(inputs[i], *grad, nullptr, grad->to_element(1));
+    }
+}
+
+};  // namespace micro
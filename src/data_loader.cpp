@@ -0,0 +1,145 @@
+#include "data_loader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <random>
+
+#include "quantization.hpp"
+
+namespace micro {
+
+DataLoader::DataLoader(std::vector<Tensor> sources, uint32_t batch_size, bool shuffle, uint64_t seed, bool drop_last,
+                       uint32_t num_workers, uint32_t prefetch)
+    : m_batch_size(batch_size), m_shuffle(shuffle), m_seed(seed), m_slots(prefetch) {
+    LOG_IF(FATAL, sources.empty()) << "DataLoader needs at least one source tensor";
+    LOG_IF(FATAL, batch_size == 0 || num_workers == 0 || prefetch == 0)
+        << "DataLoader needs a batch size, a worker and a prefetched batch of at least 1";
+
+    m_samples = sources[0].m_shape.empty() ? 0 : sources[0].m_shape[0];
+    for (const auto& source : sources) {
+        LOG_IF(FATAL, source.m_shape.empty() || source.m_shape[0] != m_samples)
+            << "Every source of a DataLoader needs one row per sample, " << m_samples << " of them";
+        LOG_IF(FATAL, source.number_bytes() == 0) << "DataLoader sources can't be empty";
+        LOG_IF(FATAL, source.is_quantized() && source.quant_params().axis == 0)
+            << "DataLoader sources can't be quantized per row";
+
+        // Workers copy whole rows, so sources are made contiguous and evaluated up front
+        NoGradGuard no_grad;
+        m_sources.push_back(source.contiguous());
+        m_sources.back().data_ptr<char>();
+    }
+
+    m_batches_per_epoch = drop_last ? m_samples / batch_size : (m_samples + batch_size - 1) / batch_size;
+    LOG_IF(FATAL, m_batches_per_epoch == 0) << "DataLoader has fewer samples than a batch of " << batch_size;
+
+    for (uint32_t i = 0; i < num_workers; i++) m_workers.emplace_back(&DataLoader::worker_loop, this);
+}
+
+DataLoader::~DataLoader() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_slot_free.notify_all();
+    for (auto& worker : m_workers) worker.join();
+}
+
+bool DataLoader::next(std::vector<Tensor>& batch) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_consumed % m_batches_per_epoch == 0 && m_consumed > 0 && !m_epoch_ended) {
+            m_epoch_ended = true;
+            return false;
+        }
+        m_epoch_ended = false;
+
+        Slot& slot = m_slots[m_consumed % m_slots.size()];
+        m_batch_ready.wait(lock, [&]() { return slot.batch == m_consumed; });
+        batch = std::move(slot.tensors);
+        slot.tensors.clear();
+        m_consumed++;
+
+        uint64_t epoch = m_consumed / m_batches_per_epoch;
+        m_orders.erase(std::remove_if(m_orders.begin(), m_orders.end(),
+                                      [epoch](const auto& order) { return order.first < epoch; }),
+                       m_orders.end());
+    }
+    m_slot_free.notify_all();
+    return true;
+}
+
+std::shared_ptr<const std::vector<uint32_t>> DataLoader::order(uint64_t epoch) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& [e, order] : m_orders) {
+            if (e == epoch) return order;
+        }
+    }
+
+    // Fisher-Yates over a generator seeded from (seed, epoch) alone, so orders don't depend on
+    // the standard library or on which worker draws them
+    auto order = std::make_shared<std::vector<uint32_t>>(m_samples);
+    std::iota(order->begin(), order->end(), 0u);
+    std::seed_seq seeds{uint32_t(m_seed), uint32_t(m_seed >> 32), uint32_t(epoch), uint32_t(epoch >> 32)};
+    std::mt19937_64 generator(seeds);
+    for (uint32_t i = m_samples - 1; i > 0; i--) std::swap((*order)[i], (*order)[generator() % (i + 1)]);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& [e, drawn] : m_orders) {
+        if (e == epoch) return drawn;
+    }
+    m_orders.emplace_back(epoch, order);
+    return order;
+}
+
+std::vector<Tensor> DataLoader::gather(uint64_t batch) {
+    uint64_t epoch = batch / m_batches_per_epoch;
+    uint32_t first = (batch % m_batches_per_epoch) * m_batch_size;
+    uint32_t count = std::min(m_batch_size, m_samples - first);
+    auto samples = m_shuffle ? order(epoch) : nullptr;
+
+    std::vector<Tensor> tensors;
+    for (const auto& source : m_sources) {
+        auto shape = source.m_shape;
+        shape[0] = count;
+        Tensor out(shape, source.m_dtype);
+        out.m_quant = source.m_quant;
+
+        size_t row_bytes = source.number_bytes() / m_samples;
+        const char* rows = source.data_ptr<char>();
+        char* data = out.data_ptr<char>();
+        if (!samples) {
+            std::memcpy(data, rows + first * row_bytes, count * row_bytes);
+        } else {
+            for (uint32_t r = 0; r < count; r++) {
+                std::memcpy(data + r * row_bytes, rows + size_t((*samples)[first + r]) * row_bytes, row_bytes);
+            }
+        }
+        tensors.push_back(std::move(out));
+    }
+    return tensors;
+}
+
+void DataLoader::worker_loop() {
+    while (true) {
+        uint64_t batch;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_slot_free.wait(lock, [&]() { return m_stop || m_next_batch < m_consumed + m_slots.size(); });
+            if (m_stop) return;
+            batch = m_next_batch++;
+        }
+
+        auto tensors = gather(batch);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            Slot& slot = m_slots[batch % m_slots.size()];
+            slot.batch = batch;
+            slot.tensors = std::move(tensors);
+        }
+        m_batch_ready.notify_all();
+    }
+}
+
+};  // namespace micro
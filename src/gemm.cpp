@@ -0,0 +1,522 @@
+#include "gemm.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "thread_pool.hpp"
+#include "vectorized.hpp"
+
+namespace micro {
+namespace gemm {
+
+namespace {
+
+template <typename T>
+struct Blocking {
+    using V = vec::Vec<T>;
+
+    // Register tile: MR rows of A times NR columns of B held in MR * NV vector accumulators
+    static constexpr uint32_t NV = V::size == 1 ? 8 : 2;
+    static constexpr uint32_t NR = NV * V::size;
+    static constexpr uint32_t MR = 6;
+
+    // Cache blocking: a KC x NR sliver of B lives in L1, an MC x KC panel of A in L2
+    // and the KC x NC panel of B in L3
+    static constexpr uint32_t KC = 256;
+    static constexpr uint32_t MC = 16 * MR;
+    static constexpr uint32_t NC = 4096;
+};
+
+// Multiply-adds per packed panel below which the panel is computed serially
+constexpr int64_t PARALLEL_WORK = 1 << 18;
+
+// Packs an mc x kc block of A into MR-row slivers stored k-major, zero-padding the last sliver.
+// Elements stored as another type (16-bit floats) are converted to T on the way
+template <typename T, typename S>
+void pack_a(uint32_t mc, uint32_t kc, const S* A, int64_t row_stride, int64_t col_stride, T* packed) {
+    constexpr uint32_t MR = Blocking<T>::MR;
+
+    for (uint32_t ir = 0; ir < mc; ir += MR) {
+        uint32_t mr = std::min(MR, mc - ir);
+        for (uint32_t k = 0; k < kc; k++) {
+            const S* src = A + ir * row_stride + k * col_stride;
+            uint32_t i = 0;
+            for (; i < mr; i++) *packed++ = T(src[i * row_stride]);
+            for (; i < MR; i++) *packed++ = T(0);
+        }
+    }
+}
+
+// Packs a kc x nc block of B into NR-column slivers stored k-major, zero-padding the last sliver
+template <typename T, typename S>
+void pack_b(uint32_t kc, uint32_t nc, const S* B, int64_t row_stride, int64_t col_stride, T* packed) {
+    constexpr uint32_t NR = Blocking<T>::NR;
+
+    for (uint32_t jr = 0; jr < nc; jr += NR) {
+        uint32_t nr = std::min(NR, nc - jr);
+        for (uint32_t k = 0; k < kc; k++) {
+            const S* src = B + k * row_stride + jr * col_stride;
+            uint32_t j = 0;
+            if (col_stride == 1) {
+                for (; j < nr; j++) *packed++ = T(src[j]);
+            } else {
+                for (; j < nr; j++) *packed++ = T(src[j * col_stride]);
+            }
+            for (; j < NR; j++) *packed++ = T(0);
+        }
+    }
+}
+
+// Computes an MR x NR tile of C from packed slivers. Only the top-left mr x nr corner is written,
+// and it either overwrites C or accumulates into it. The epilogue, with its bias starting at the
+// first column of the tile, is given for the last panel of K only.
+template <typename T>
+void micro_kernel(uint32_t kc, const T* packed_a, const T* packed_b, T* C, int64_t row_stride, int64_t col_stride,
+                  uint32_t mr, uint32_t nr, bool overwrite, const Epilogue<T>& epilogue) {
+    using B = Blocking<T>;
+    using V = typename B::V;
+    constexpr uint32_t MR = B::MR, NR = B::NR, NV = B::NV;
+
+    V acc[MR][NV];
+    for (uint32_t i = 0; i < MR; i++) {
+        for (uint32_t v = 0; v < NV; v++) acc[i][v] = V::broadcast(T(0));
+    }
+
+    for (uint32_t k = 0; k < kc; k++) {
+        V b[NV];
+        for (uint32_t v = 0; v < NV; v++) b[v] = V::load(packed_b + v * V::size);
+
+        for (uint32_t i = 0; i < MR; i++) {
+            V a = V::broadcast(packed_a[i]);
+            for (uint32_t v = 0; v < NV; v++) acc[i][v] = vec::fmadd(a, b[v], acc[i][v]);
+        }
+
+        packed_a += MR;
+        packed_b += NR;
+    }
+
+    bool relu = epilogue.activation == Activation::RELU;
+    if (mr == MR && nr == NR && col_stride == 1) {
+        V bias[NV];
+        for (uint32_t v = 0; v < NV; v++) {
+            bias[v] = epilogue.bias ? V::load(epilogue.bias + v * V::size) : V::broadcast(T(0));
+        }
+
+        for (uint32_t i = 0; i < MR; i++) {
+            T* c = C + i * row_stride;
+            for (uint32_t v = 0; v < NV; v++) {
+                V value = overwrite ? acc[i][v] : acc[i][v] + V::load(c + v * V::size);
+                if (epilogue.bias) value = value + bias[v];
+                if (relu) value = max(value, V::broadcast(T(0)));
+                value.store(c + v * V::size);
+            }
+        }
+        return;
+    }
+
+    T tile[MR * NR];
+    for (uint32_t i = 0; i < MR; i++) {
+        for (uint32_t v = 0; v < NV; v++) acc[i][v].store(tile + i * NR + v * V::size);
+    }
+
+    for (uint32_t i = 0; i < mr; i++) {
+        for (uint32_t j = 0; j < nr; j++) {
+            T& c = C[i * row_stride + j * col_stride];
+            T value = overwrite ? tile[i * NR + j] : T(c + tile[i * NR + j]);
+            if (epilogue.bias) value += epilogue.bias[j];
+            c = relu ? std::max(value, T(0)) : value;
+        }
+    }
+}
+
+// Runs the micro-kernel over NR-column slivers [jr_begin, jr_end) of an mc x nc block of C
+template <typename T>
+void macro_kernel(uint32_t mc, uint32_t nc, uint32_t kc, const T* packed_a, const T* packed_b, T* C,
+                  int64_t row_stride, int64_t col_stride, uint32_t jr_begin, uint32_t jr_end, bool overwrite,
+                  const Epilogue<T>& epilogue) {
+    constexpr uint32_t MR = Blocking<T>::MR, NR = Blocking<T>::NR;
+
+    for (uint32_t jr = jr_begin * NR; jr < std::min(nc, jr_end * NR); jr += NR) {
+        Epilogue<T> tile_epilogue{epilogue.bias ? epilogue.bias + jr : nullptr, epilogue.activation};
+        for (uint32_t ir = 0; ir < mc; ir += MR) {
+            T* c = C + ir * row_stride + jr * col_stride;
+            micro_kernel(kc, packed_a + ir * kc, packed_b + jr * kc, c, row_stride, col_stride, std::min(MR, mc - ir),
+                         std::min(NR, nc - jr), overwrite, tile_epilogue);
+        }
+    }
+}
+
+/**
+ * Blocking of the int8 GEMM. K is consumed in groups of four: each int32 lane of a dot-product
+ * instruction multiplies four unsigned bytes of A with four signed bytes of B and adds up the
+ * products, so both packed operands keep the four k of a group next to each other.
+ */
+struct Int8Blocking {
+#if defined(__AVX512VNNI__)
+    static constexpr uint32_t LANES = 16;
+#else
+    static constexpr uint32_t LANES = 8;
+#endif
+    static constexpr uint32_t NV = 2;
+    static constexpr uint32_t NR = NV * LANES;
+    static constexpr uint32_t MR = 6;
+
+    // KC is a multiple of the group size; a KC x NR sliver of B is 16 KiB with 512-bit registers
+    static constexpr uint32_t KC = 512;
+    static constexpr uint32_t MC = 16 * MR;
+    static constexpr uint32_t NC = 4096;
+};
+
+// The instructions take A unsigned and B signed, so int8 A is packed shifted up by 128 and uint8 B
+// shifted down by 128. gemm_int8 folds the shifts into the zero points
+template <typename T>
+constexpr int32_t A_SHIFT = std::is_same_v<T, int8_t> ? 128 : 0;
+
+template <typename T>
+constexpr int32_t B_SHIFT = std::is_same_v<T, uint8_t> ? -128 : 0;
+
+// Packs an mc x kc block of A into MR-row slivers made of k groups: MR rows of four bytes per
+// group, zero-padded past mc and kc
+template <typename TA>
+void pack_a_int8(uint32_t mc, uint32_t kc, const TA* A, int64_t row_stride, int64_t col_stride, uint8_t* packed) {
+    constexpr uint32_t MR = Int8Blocking::MR;
+
+    for (uint32_t ir = 0; ir < mc; ir += MR) {
+        uint32_t mr = std::min(MR, mc - ir);
+        for (uint32_t k = 0; k < kc; k += 4) {
+            for (uint32_t i = 0; i < MR; i++, packed += 4) {
+                std::memset(packed, 0, 4);
+                if (i >= mr) continue;
+
+                const TA* src = A + (ir + i) * row_stride + k * col_stride;
+                for (uint32_t t = 0; t < 4 && k + t < kc; t++) {
+                    packed[t] = uint8_t(int32_t(src[t * col_stride]) + A_SHIFT<TA>);
+                }
+            }
+        }
+    }
+}
+
+// Packs a kc x nc block of B into NR-column slivers made of k groups: four bytes of each of the
+// NR columns per group, zero-padded past nc and kc. Adds the packed values of every column to
+// col_sums
+template <typename TB>
+void pack_b_int8(uint32_t kc, uint32_t nc, const TB* B, int64_t row_stride, int64_t col_stride, int8_t* packed,
+                 int32_t* col_sums) {
+    constexpr uint32_t NR = Int8Blocking::NR;
+
+    for (uint32_t jr = 0; jr < nc; jr += NR) {
+        uint32_t nr = std::min(NR, nc - jr);
+        for (uint32_t k = 0; k < kc; k += 4) {
+            for (uint32_t j = 0; j < NR; j++, packed += 4) {
+                std::memset(packed, 0, 4);
+                if (j >= nr) continue;
+
+                const TB* src = B + k * row_stride + (jr + j) * col_stride;
+                for (uint32_t t = 0; t < 4 && k + t < kc; t++) {
+                    packed[t] = int8_t(int32_t(src[t * row_stride]) + B_SHIFT<TB>);
+                    col_sums[jr + j] += packed[t];
+                }
+            }
+        }
+    }
+}
+
+#if defined(__AVX512VNNI__) || defined(__AVXVNNI__)
+// A register of int32 lanes accumulating dot products of four unsigned by four signed bytes
+struct DotVec {
+#if defined(__AVX512VNNI__)
+    __m512i v;
+
+    static DotVec zero() { return {_mm512_setzero_si512()}; }
+
+    static DotVec load(const int8_t* ptr) { return {_mm512_loadu_si512(ptr)}; }
+
+    static DotVec broadcast(int32_t bytes) { return {_mm512_set1_epi32(bytes)}; }
+
+    static DotVec dot(DotVec acc, DotVec a, DotVec b) { return {_mm512_dpbusd_epi32(acc.v, a.v, b.v)}; }
+
+    void store(int32_t* ptr) const { _mm512_storeu_si512(ptr, v); }
+#else
+    __m256i v;
+
+    static DotVec zero() { return {_mm256_setzero_si256()}; }
+
+    static DotVec load(const int8_t* ptr) { return {_mm256_loadu_si256((const __m256i*)ptr)}; }
+
+    static DotVec broadcast(int32_t bytes) { return {_mm256_set1_epi32(bytes)}; }
+
+    static DotVec dot(DotVec acc, DotVec a, DotVec b) { return {_mm256_dpbusd_avx_epi32(acc.v, a.v, b.v)}; }
+
+    void store(int32_t* ptr) const { _mm256_storeu_si256((__m256i*)ptr, v); }
+#endif
+};
+#endif
+
+// Computes an MR x NR tile of C over `groups` k groups of packed slivers. Only the top-left
+// mr x nr corner is written, and it either overwrites C or accumulates into it.
+void micro_kernel_int8(uint32_t groups, const uint8_t* packed_a, const int8_t* packed_b, int32_t* C,
+                       int64_t row_stride, int64_t col_stride, uint32_t mr, uint32_t nr, bool overwrite) {
+    constexpr uint32_t MR = Int8Blocking::MR, NR = Int8Blocking::NR;
+
+    alignas(64) int32_t tile[MR * NR];
+
+#if defined(__AVX512VNNI__) || defined(__AVXVNNI__)
+    constexpr uint32_t NV = Int8Blocking::NV, LANES = Int8Blocking::LANES;
+
+    DotVec acc[MR][NV];
+    for (uint32_t i = 0; i < MR; i++) {
+        for (uint32_t v = 0; v < NV; v++) acc[i][v] = DotVec::zero();
+    }
+
+    for (uint32_t g = 0; g < groups; g++) {
+        DotVec b[NV];
+        for (uint32_t v = 0; v < NV; v++) b[v] = DotVec::load(packed_b + v * LANES * 4);
+
+        for (uint32_t i = 0; i < MR; i++) {
+            int32_t bytes;
+            std::memcpy(&bytes, packed_a + i * 4, sizeof(bytes));
+            DotVec a = DotVec::broadcast(bytes);
+            for (uint32_t v = 0; v < NV; v++) acc[i][v] = DotVec::dot(acc[i][v], a, b[v]);
+        }
+
+        packed_a += MR * 4;
+        packed_b += NR * 4;
+    }
+
+    for (uint32_t i = 0; i < MR; i++) {
+        for (uint32_t v = 0; v < NV; v++) acc[i][v].store(tile + i * NR + v * LANES);
+    }
+#else
+    // Without the dot-product instructions the same layout is widened and multiplied in int32
+    std::fill(tile, tile + MR * NR, 0);
+    for (uint32_t g = 0; g < groups; g++) {
+        for (uint32_t i = 0; i < MR; i++) {
+            for (uint32_t j = 0; j < NR; j++) {
+                int32_t sum = 0;
+                for (uint32_t t = 0; t < 4; t++) sum += int32_t(packed_a[i * 4 + t]) * int32_t(packed_b[j * 4 + t]);
+                tile[i * NR + j] += sum;
+            }
+        }
+
+        packed_a += MR * 4;
+        packed_b += NR * 4;
+    }
+#endif
+
+    for (uint32_t i = 0; i < mr; i++) {
+        for (uint32_t j = 0; j < nr; j++) {
+            int32_t& c = C[i * row_stride + j * col_stride];
+            c = overwrite ? tile[i * NR + j] : c + tile[i * NR + j];
+        }
+    }
+}
+
+};  // namespace
+
+template <typename T, typename TA, typename TB>
+void gemm(uint32_t M, uint32_t N, uint32_t K, const TA* A, int64_t a_row_stride, int64_t a_col_stride, const TB* B,
+          int64_t b_row_stride, int64_t b_col_stride, T* C, int64_t c_row_stride, int64_t c_col_stride,
+          bool accumulate, const Epilogue<T>& epilogue) {
+    using Block = Blocking<T>;
+    constexpr uint32_t NR = Block::NR, KC = Block::KC, MC = Block::MC, NC = Block::NC;
+
+    if (M == 0 || N == 0) return;
+
+    if (K == 0) {
+        if (accumulate && !epilogue.bias && epilogue.activation == Activation::NONE) return;
+        for (uint32_t i = 0; i < M; i++) {
+            for (uint32_t j = 0; j < N; j++) {
+                T& c = C[i * c_row_stride + j * c_col_stride];
+                T value = accumulate ? c : T(0);
+                if (epilogue.bias) value += epilogue.bias[j];
+                c = epilogue.activation == Activation::RELU ? std::max(value, T(0)) : value;
+            }
+        }
+        return;
+    }
+
+    // A block-scope thread_local is only set up on threads that reach its declaration, so each
+    // packed A buffer is declared where its thread uses it; one declared out here and touched by
+    // a pool worker would never be freed when that worker exits
+    thread_local std::vector<T> packed_b;
+    packed_b.resize(KC * ((std::min(N, NC) + NR - 1) / NR) * NR);
+
+    for (uint32_t jc = 0; jc < N; jc += NC) {
+        uint32_t nc = std::min(NC, N - jc);
+        uint32_t slivers = (nc + NR - 1) / NR;
+
+        for (uint32_t pc = 0; pc < K; pc += KC) {
+            uint32_t kc = std::min(KC, K - pc);
+            bool overwrite = !accumulate && pc == 0;
+            // The epilogue runs once, as the last panel of K completes the sums
+            Epilogue<T> panel_epilogue;
+            if (pc + kc == K) panel_epilogue = {epilogue.bias ? epilogue.bias + jc : nullptr, epilogue.activation};
+
+            // Worker threads have their own thread_local buffers, so the shared panel is passed by pointer
+            const T* pb = packed_b.data();
+            pack_b(kc, nc, B + pc * b_row_stride + jc * b_col_stride, b_row_stride, b_col_stride, packed_b.data());
+
+            uint32_t blocks = (M + MC - 1) / MC;
+            bool serial = int64_t(M) * nc * kc < PARALLEL_WORK;
+
+            if (serial || blocks >= get_num_threads()) {
+                // Enough row blocks to go around: each thread packs and computes whole MC x nc blocks
+                parallel_for(0, blocks, serial ? blocks : 1, [&](int64_t begin, int64_t end) {
+                    thread_local std::vector<T> packed_a;
+                    packed_a.resize(MC * KC);
+                    for (int64_t block = begin; block < end; block++) {
+                        uint32_t ic = block * MC;
+                        uint32_t mc = std::min(MC, M - ic);
+                        pack_a(mc, kc, A + ic * a_row_stride + pc * a_col_stride, a_row_stride, a_col_stride,
+                               packed_a.data());
+                        macro_kernel(mc, nc, kc, packed_a.data(), pb, C + ic * c_row_stride + jc * c_col_stride,
+                                     c_row_stride, c_col_stride, 0, slivers, overwrite, panel_epilogue);
+                    }
+                });
+                continue;
+            }
+
+            // Few, tall-and-wide blocks: share one packed A block and split its columns across threads
+            thread_local std::vector<T> packed_a;
+            packed_a.resize(MC * KC);
+            const T* pa = packed_a.data();
+            for (uint32_t ic = 0; ic < M; ic += MC) {
+                uint32_t mc = std::min(MC, M - ic);
+                pack_a(mc, kc, A + ic * a_row_stride + pc * a_col_stride, a_row_stride, a_col_stride,
+                       packed_a.data());
+                parallel_for(0, slivers, 1, [&](int64_t begin, int64_t end) {
+                    macro_kernel(mc, nc, kc, pa, pb, C + ic * c_row_stride + jc * c_col_stride, c_row_stride,
+                                 c_col_stride, begin, end, overwrite, panel_epilogue);
+                });
+            }
+        }
+    }
+}
+
+/**
+ * With a = A + A_SHIFT and b = B + B_SHIFT the packed values, the kernels compute S = a * b. As
+ * (A - a_zero) = a - alpha with alpha = A_SHIFT + a_zero (and likewise beta for B), the result is
+ *
+ *     S[m][n] - alpha[m] * colsum(b)[n] - beta[n] * rowsum(a)[m] + K * alpha[m] * beta[n]
+ *
+ * The column sums come out of packing B and the row sums take one pass over A.
+ */
+template <typename TA, typename TB>
+void gemm_int8(uint32_t M, uint32_t N, uint32_t K, const TA* A, int64_t a_row_stride, int64_t a_col_stride,
+               const int32_t* a_zero, const TB* B, int64_t b_row_stride, int64_t b_col_stride, const int32_t* b_zero,
+               int32_t* C, int64_t c_row_stride, int64_t c_col_stride) {
+    using Block = Int8Blocking;
+    constexpr uint32_t MR = Block::MR, NR = Block::NR, KC = Block::KC, MC = Block::MC, NC = Block::NC;
+
+    if (M == 0 || N == 0) return;
+
+    if (K == 0) {
+        for (uint32_t i = 0; i < M; i++) {
+            for (uint32_t j = 0; j < N; j++) C[i * c_row_stride + j * c_col_stride] = 0;
+        }
+        return;
+    }
+
+    std::vector<int64_t> row_sums(M);
+    parallel_for(0, M, std::max<int64_t>(1, PARALLEL_WORK / K), [&](int64_t begin, int64_t end) {
+        for (int64_t m = begin; m < end; m++) {
+            int64_t sum = int64_t(K) * A_SHIFT<TA>;
+            for (uint32_t k = 0; k < K; k++) sum += A[m * a_row_stride + k * a_col_stride];
+            row_sums[m] = sum;
+        }
+    });
+
+    std::vector<int32_t> col_sums(N, 0);
+    thread_local std::vector<int8_t> packed_b;
+    packed_b.resize(KC * ((std::min(N, NC) + NR - 1) / NR) * NR);
+
+    for (uint32_t jc = 0; jc < N; jc += NC) {
+        uint32_t nc = std::min(NC, N - jc);
+        uint32_t slivers = (nc + NR - 1) / NR;
+
+        for (uint32_t pc = 0; pc < K; pc += KC) {
+            uint32_t kc = std::min(KC, K - pc);
+            uint32_t groups = (kc + 3) / 4;
+            bool overwrite = pc == 0;
+
+            const int8_t* pb = packed_b.data();
+            pack_b_int8(kc, nc, B + pc * b_row_stride + jc * b_col_stride, b_row_stride, b_col_stride,
+                        packed_b.data(), col_sums.data() + jc);
+
+            // Row blocks are split further into column ranges when there are fewer of them than
+            // threads, as with the single row of a matrix-vector product; each task packs its own A
+            uint32_t blocks = (M + MC - 1) / MC;
+            bool serial = int64_t(M) * nc * kc < PARALLEL_WORK;
+            uint32_t ranges = serial ? 1 : std::clamp<uint32_t>(get_num_threads() / blocks, 1, slivers);
+            int64_t tasks = int64_t(blocks) * ranges;
+
+            parallel_for(0, tasks, serial ? tasks : 1, [&](int64_t begin, int64_t end) {
+                thread_local std::vector<uint8_t> packed_a;
+                packed_a.resize(MC * KC);
+                for (int64_t task = begin; task < end; task++) {
+                    uint32_t ic = uint32_t(task / ranges) * MC;
+                    uint32_t mc = std::min(MC, M - ic);
+                    uint32_t range = uint32_t(task % ranges);
+                    uint32_t first = range * slivers / ranges, last = (range + 1) * slivers / ranges;
+
+                    pack_a_int8(mc, kc, A + ic * a_row_stride + pc * a_col_stride, a_row_stride, a_col_stride,
+                                packed_a.data());
+                    for (uint32_t jr = first * NR; jr < std::min(nc, last * NR); jr += NR) {
+                        for (uint32_t ir = 0; ir < mc; ir += MR) {
+                            int32_t* c = C + (ic + ir) * c_row_stride + (jc + jr) * c_col_stride;
+                            micro_kernel_int8(groups, packed_a.data() + ir * groups * 4, pb + jr * groups * 4, c,
+                                              c_row_stride, c_col_stride, std::min(MR, mc - ir), std::min(NR, nc - jr),
+                                              overwrite);
+                        }
+                    }
+                }
+            });
+        }
+
+        parallel_for(0, M, std::max<int64_t>(1, PARALLEL_WORK / nc), [&](int64_t begin, int64_t end) {
+            for (int64_t m = begin; m < end; m++) {
+                int64_t alpha = A_SHIFT<TA> + (a_zero ? a_zero[m] : 0);
+                for (uint32_t n = jc; n < jc + nc; n++) {
+                    int64_t beta = B_SHIFT<TB> + (b_zero ? b_zero[n] : 0);
+                    int32_t& c = C[m * c_row_stride + n * c_col_stride];
+                    c = int32_t(c - alpha * col_sums[n] - beta * row_sums[m] + int64_t(K) * alpha * beta);
+                }
+            }
+        });
+    }
+}
+
+#define INSTANTIATE_GEMM(T, TA, TB)                                                                             \
+    template void gemm<T, TA, TB>(uint32_t, uint32_t, uint32_t, const TA*, int64_t, int64_t, const TB*, int64_t, \
+                                  int64_t, T*, int64_t, int64_t, bool, const Epilogue<T>&);
+
+INSTANTIATE_GEMM(float, float, float)
+INSTANTIATE_GEMM(int32_t, int32_t, int32_t)
+INSTANTIATE_GEMM(uint32_t, uint32_t, uint32_t)
+
+// 16-bit float operands are multiplied in float, alone or mixed with float ones
+INSTANTIATE_GEMM(float, Half, Half)
+INSTANTIATE_GEMM(float, Half, float)
+INSTANTIATE_GEMM(float, float, Half)
+INSTANTIATE_GEMM(float, BFloat16, BFloat16)
+INSTANTIATE_GEMM(float, BFloat16, float)
+INSTANTIATE_GEMM(float, float, BFloat16)
+INSTANTIATE_GEMM(float, Half, BFloat16)
+INSTANTIATE_GEMM(float, BFloat16, Half)
+
+#undef INSTANTIATE_GEMM
+
+#define INSTANTIATE_GEMM_INT8(TA, TB)                                                                             \
+    template void gemm_int8<TA, TB>(uint32_t, uint32_t, uint32_t, const TA*, int64_t, int64_t, const int32_t*, \
+                                    const TB*, int64_t, int64_t, const int32_t*, int32_t*, int64_t, int64_t);
+
+INSTANTIATE_GEMM_INT8(int8_t, int8_t)
+INSTANTIATE_GEMM_INT8(int8_t, uint8_t)
+INSTANTIATE_GEMM_INT8(uint8_t, int8_t)
+INSTANTIATE_GEMM_INT8(uint8_t, uint8_t)
+
+#undef INSTANTIATE_GEMM_INT8
+
+};  // namespace gemm
+};  // namespace micro
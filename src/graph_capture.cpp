@@ -0,0 +1,35 @@
+#include "graph_capture.hpp"
+
+namespace micro {
+
+static thread_local std::vector<std::function<void()>>* capturing = nullptr;
+
+bool is_capturing() { return capturing != nullptr; }
+
+void record_replay(std::function<void()> op) { capturing->push_back(std::move(op)); }
+
+CapturePause::CapturePause() : m_prev(capturing) { capturing = nullptr; }
+
+CapturePause::~CapturePause() { capturing = m_prev; }
+
+CapturedGraph CapturedGraph::capture(const std::function<void()>& step) {
+    LOG_IF(FATAL, capturing) << "Graph capture can't be nested";
+
+    // Lazy ops would be recorded as expressions instead of kernels, so the step runs eagerly
+    bool lazy = is_lazy_enabled();
+    with_eager();
+
+    CapturedGraph graph;
+    capturing = &graph.m_ops;
+    step();
+    capturing = nullptr;
+
+    if (lazy) with_lazy();
+    return graph;
+}
+
+void CapturedGraph::replay() const {
+    for (auto& op : m_ops) op();
+}
+
+};  // namespace micro
@@ -1,76 +1,35 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <optional>
+
+#include "gemm.hpp"
+#include "lazy_expr.hpp"
+#include "quantization.hpp"
+#include "strided_iterator.hpp"
 #include "tensor.hpp"
+#include "thread_pool.hpp"
+#include "vectorized.hpp"
 
 namespace micro {
 
-#define EXECUTE_OPERATION(out, in1, in2, odtype, operation)                             \
-    {                                                                                   \
-        auto& out_alias = out;                                                          \
-        auto in1_alias = in1;                                                           \
-        auto in2_alias = in2;                                                           \
-        switch (odtype) {                                                               \
-            case Type::UINT32:                                                          \
-                out_alias.data.i32 = uint32_t(in1_alias) operation uint32_t(in2_alias); \
-                break;                                                                  \
-            case Type::INT32:                                                           \
-                out_alias.data.i32 = int32_t(in1_alias) operation int32_t(in2_alias);   \
-                break;                                                                  \
-            case Type::FLOAT32:                                                         \
-                out_alias.data.f32 = float(in1_alias) operation float(in2_alias);       \
-                break;                                                                  \
-            default:                                                                    \
-                LOG(FATAL) << "Can't do element wise operation with unsupported types"; \
-        }                                                                               \
-    }
-
-#define EXECUTE_INLINE_OPERATION(out, in, odtype, operation)                           \
-    {                                                                                  \
-        auto& out_alias = out;                                                         \
-        auto in_alias = in;                                                            \
-        switch (odtype) {                                                              \
-            case Type::UINT32:                                                         \
-                out_alias.data.i32 = uint32_t(out_alias) operation uint32_t(in_alias); \
-                break;                                                                 \
-            case Type::INT32:                                                          \
-                out_alias.data.i32 = int32_t(out_alias) operation int32_t(in_alias);   \
-                break;                                                                 \
-            case Type::FLOAT32:                                                        \
-                out_alias.data.f32 = float(out_alias) operation float(in_alias);       \
-                break;                                                                 \
-            default:                                                                   \
-                LOG(FATAL) << "Can't do inline operation with unsupported types";      \
-        }                                                                              \
-    }
-
-template <typename CallBackFn>
-void iterate_tensor(const std::vector<uint32_t>& shape, CallBackFn& call_back) {
-    int32_t ndims = shape.size();
-    if (ndims <= 0) return;
-    LOG_IF(FATAL, ndims >= 5) << "Looping " << ndims << " times is not yet supported";
-    for (uint32_t i = 0; i < shape[0]; i++) {
-        if (ndims == 1) {
-            call_back({i});
-            continue;
-        }
+// Element counts below which a kernel runs serially; above them work is split across the thread pool
+constexpr int64_t ELEMENT_WISE_GRAIN = 32768;
+constexpr int64_t REDUCTION_GRAIN = 32768;
+constexpr int64_t MATMUL_GRAIN = 1 << 18;
 
-        for (uint32_t j = 0; j < shape[1]; j++) {
-            if (ndims == 2) {
-                call_back({i, j});
-                continue;
-            }
+// Elements a reduction combines one after another before partial results are combined pairwise,
+// so the rounding error of a float sum grows with the log of its length rather than the length
+constexpr int64_t PAIRWISE_BLOCK = 512;
 
-            for (uint32_t k = 0; k < shape[2]; k++) {
-                if (ndims == 3) {
-                    call_back({i, j, k});
-                    continue;
-                }
+// Input rows an outer reduction accumulates one after another before combining them pairwise,
+// and the width of the row of outputs it accumulates at a time, so the partial rows stay in L1
+constexpr int64_t PAIRWISE_ROWS = 32;
+constexpr int64_t REDUCTION_COLUMNS = 256;
 
-                for (uint32_t l = 0; l < shape[3]; l++) {
-                    call_back({i, j, k, l});
-                }
-            }
-        }
-    }
-}
+// Contiguous runs longer than this are reduced in chunks of this size in parallel. The chunks
+// don't depend on the number of threads, so neither does the result
+constexpr int64_t REDUCTION_CHUNK = 1 << 16;
 
 Type get_output_type(const Type& t1, const Type& t2) {
     if (t1 == Type::UNKONWN && t2 == Type::UNKONWN) {
@@ -81,367 +40,1517 @@ Type get_output_type(const Type& t1, const Type& t2) {
     if (t1 == Type::UNKONWN) return t2;
     if (t2 == Type::UNKONWN) return t1;
 
+    // INT8 and UINT8 meet any wider type in that type, and each other in INT32
+    if (is_8bit(t1) || is_8bit(t2)) {
+        if (t1 == t2) return t1;
+        if (is_8bit(t1) && is_8bit(t2)) return Type::INT32;
+        return is_8bit(t1) ? t2 : t1;
+    }
+
+    // A 16-bit float wins over the integer types, and meets FLOAT32 or the other 16-bit format in
+    // FLOAT32, which holds both
+    if (is_half_precision(t1) || is_half_precision(t2)) {
+        if (t1 == t2) return t1;
+        if (!is_half_precision(t1) && t1 != Type::FLOAT32) return t2;
+        if (!is_half_precision(t2) && t2 != Type::FLOAT32) return t1;
+        return Type::FLOAT32;
+    }
+
     return std::max(t1, t2);
 }
 
 Tensor get_element_wise_empty_output(const Tensor& in1, const Tensor& in2) {
+    return Tensor(broadcast_shapes(in1.m_shape, in2.m_shape), get_output_type(in1.m_dtype, in2.m_dtype));
+}
+
+std::vector<uint32_t> broadcast_shapes(const std::vector<uint32_t>& shape1, const std::vector<uint32_t>& shape2) {
+    int32_t ndims1 = shape1.size();
+    int32_t ndims2 = shape2.size();
+    int32_t ndims = std::max(ndims1, ndims2);
+    std::vector<uint32_t> out_shape(ndims);
+
+    for (int32_t i = 0; i < ndims; i++) {
+        uint32_t dim1 = i < ndims1 ? shape1[ndims1 - i - 1] : 1;
+        uint32_t dim2 = i < ndims2 ? shape2[ndims2 - i - 1] : 1;
+        LOG_IF(FATAL, dim1 != dim2 && dim1 != 1 && dim2 != 1)
+            << "Broadcasting is not possible between input1 with shape=" << dim1 << " and input2 with shape=" << dim2;
+        out_shape[ndims - i - 1] = std::max(dim1, dim2);
+    }
+
+    return out_shape;
+}
+
+/**
+ * A matmul seen as a batch of M x K by K x N products. 1-D inputs are promoted NumPy style:
+ * the left one to a single row, the right one to a single column, and the batch dims of both
+ * inputs are broadcast against each other.
+ */
+struct MatmulProblem {
+    std::vector<uint32_t> batch_shape;
+    uint32_t M, N, K;
+    bool lhs_vector, rhs_vector;
+};
+
+/**
+ * One matmul operand (input, output or gradient) as a strided matrix per batch index.
+ * batch_stride is aligned with MatmulProblem::batch_shape and is 0 on broadcast dims.
+ */
+struct MatmulOperand {
+    void* data;
+    Type dtype;
+    int64_t row_stride, col_stride;
+    std::vector<int64_t> batch_stride;
+
+    MatmulOperand transposed() const {
+        MatmulOperand t = *this;
+        std::swap(t.row_stride, t.col_stride);
+        return t;
+    }
+};
+
+MatmulProblem get_matmul_problem(const Tensor& in1, const Tensor& in2) {
     int32_t in1_ndims = in1.m_shape.size();
     int32_t in2_ndims = in2.m_shape.size();
-    auto ndims = std::max(in1_ndims, in2_ndims);
-    std::vector<uint32_t> out_shape(ndims, 0);
-
-    for (int8_t i = 0; i < ndims; i++) {
-        auto in1_shape = in1.m_shape[in1_ndims - i - 1];
-        auto in2_shape = in2.m_shape[in2_ndims - i - 1];
-        if (i < in1_ndims && i < in2_ndims) {
-            LOG_IF(FATAL, (in1_shape != in2_shape) && (in1_shape != 1 && in2_shape != 1))
-                << "Broadcasting is not possible between input1 with shape=" << in1_shape
-                << " and input2 with shape=" << in2_shape;
-
-            out_shape[ndims - i - 1] = std::max(in1_shape, in2_shape);
-        } else if (i < in1_ndims) {
-            out_shape[ndims - i - 1] = in1_shape;
+    LOG_IF(FATAL, in1_ndims == 0 || in2_ndims == 0) << "Matmul can't operate on tensor with shape = 0";
+
+    MatmulProblem problem;
+    problem.lhs_vector = in1_ndims == 1;
+    problem.rhs_vector = in2_ndims == 1;
+    problem.M = problem.lhs_vector ? 1 : in1.m_shape[in1_ndims - 2];
+    problem.N = problem.rhs_vector ? 1 : in2.m_shape[in2_ndims - 1];
+    problem.K = in1.m_shape[in1_ndims - 1];
+
+    uint32_t in2_k = problem.rhs_vector ? in2.m_shape[0] : in2.m_shape[in2_ndims - 2];
+    LOG_IF(FATAL, problem.K != in2_k) << "Matmul input shapes are not compatible";
+
+    std::vector<uint32_t> in1_batch(in1.m_shape.begin(), in1.m_shape.end() - std::min(in1_ndims, 2));
+    std::vector<uint32_t> in2_batch(in2.m_shape.begin(), in2.m_shape.end() - std::min(in2_ndims, 2));
+    problem.batch_shape = broadcast_shapes(in1_batch, in2_batch);
+
+    return problem;
+}
+
+MatmulOperand get_matmul_operand(const Tensor& t, size_t batch_ndims, bool has_rows, bool has_cols) {
+    int32_t ndims = t.m_shape.size();
+    int32_t matrix_ndims = int32_t(has_rows) + int32_t(has_cols);
+
+    MatmulOperand operand;
+    operand.data = t.data_ptr<char>();
+    operand.dtype = t.m_dtype;
+    operand.row_stride = has_rows ? t.m_stride[ndims - matrix_ndims] : 0;
+    operand.col_stride = has_cols ? t.m_stride[ndims - 1] : 0;
+    operand.batch_stride.assign(batch_ndims, 0);
+
+    int32_t t_batch_ndims = ndims - matrix_ndims;
+    for (size_t i = 0; i < batch_ndims; i++) {
+        int32_t dim = t_batch_ndims - int32_t(batch_ndims) + int32_t(i);
+        if (dim < 0 || t.m_shape[dim] == 1) continue;
+        operand.batch_stride[i] = t.m_stride[dim];
+    }
+
+    return operand;
+}
+
+// c[b] (+)= a[b] * b[b] for every index b of batch_shape, each slice going through the GEMM engine.
+// Operands with a 0 batch stride are broadcast (inputs) or reduced into (accumulated outputs).
+// The epilogue is applied to every slice.
+template <typename T, typename TA, typename TB>
+void batched_gemm(const std::vector<uint32_t>& batch_shape, uint32_t M, uint32_t N, uint32_t K,
+                  const MatmulOperand& a, const MatmulOperand& b, const MatmulOperand& c, bool accumulate,
+                  const gemm::Epilogue<T>& epilogue) {
+    int64_t num_batches = 1;
+    bool reduces = false;
+    for (size_t d = 0; d < batch_shape.size(); d++) {
+        num_batches *= batch_shape[d];
+        reduces |= batch_shape[d] > 1 && c.batch_stride[d] == 0;
+    }
+
+    // Slices reducing into the same output block run in order and parallelize inside gemm.
+    // Otherwise small slices are spread across threads, each one running a serial gemm
+    int64_t slice_work = std::max<int64_t>(int64_t(M) * N * K, 1);
+    int64_t grain_size = reduces ? num_batches : std::max<int64_t>(1, MATMUL_GRAIN / slice_work);
+
+    StridedIterator<3> it(batch_shape, {a.batch_stride, b.batch_stride, c.batch_stride});
+
+    parallel_for(0, num_batches, grain_size, [&](int64_t begin, int64_t end) {
+        it.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+            for (int64_t i = 0; i < count; i++) {
+                gemm::gemm(M, N, K, static_cast<const TA*>(a.data) + offsets[0] + i * strides[0], a.row_stride,
+                           a.col_stride, static_cast<const TB*>(b.data) + offsets[1] + i * strides[1], b.row_stride,
+                           b.col_stride, static_cast<T*>(c.data) + offsets[2] + i * strides[2], c.row_stride,
+                           c.col_stride, accumulate, epilogue);
+            }
+        });
+    });
+}
+
+// Dispatches on the output dtype for inputs stored as TA and TB. Inputs stored as 16-bit floats
+// multiply into a float c; every other combination needs a, b and c to share one dtype. 8-bit
+// inputs go through int8_matmul_forward_impl instead. A bias holds N elements of c's dtype
+template <typename TA, typename TB>
+void batched_gemm(const std::vector<uint32_t>& batch_shape, uint32_t M, uint32_t N, uint32_t K,
+                  const MatmulOperand& a, const MatmulOperand& b, const MatmulOperand& c, bool accumulate,
+                  const void* bias, Activation activation) {
+    dispatch_type(c.dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        gemm::Epilogue<T> epilogue{static_cast<const T*>(bias), activation};
+        if constexpr (std::is_same_v<TA, T> && std::is_same_v<TB, T> && !is_half_precision_v<T> && !is_8bit_v<T>) {
+            batched_gemm<T, T, T>(batch_shape, M, N, K, a, b, c, accumulate, epilogue);
+        } else if constexpr (std::is_same_v<T, float> && std::is_same_v<compute_t<TA>, float> &&
+                             std::is_same_v<compute_t<TB>, float>) {
+            batched_gemm<T, TA, TB>(batch_shape, M, N, K, a, b, c, accumulate, epilogue);
         } else {
-            out_shape[ndims - i - 1] = in2_shape;
+            LOG(FATAL) << "Matmul operands don't share a compute type";
         }
+    });
+}
+
+void batched_gemm(const std::vector<uint32_t>& batch_shape, uint32_t M, uint32_t N, uint32_t K,
+                  const MatmulOperand& a, const MatmulOperand& b, const MatmulOperand& c, bool accumulate,
+                  const void* bias = nullptr, Activation activation = Activation::NONE) {
+    dispatch_type(a.dtype, [&](auto a_tag) {
+        using TA = typename decltype(a_tag)::type;
+        dispatch_type(b.dtype, [&](auto b_tag) {
+            using TB = typename decltype(b_tag)::type;
+            batched_gemm<TA, TB>(batch_shape, M, N, K, a, b, c, accumulate, bias, activation);
+        });
+    });
+}
+
+// Runs a gemm writing `out`. A 16-bit float `out` is computed into a float buffer (holding its
+// current values when accumulating) and rounded once at the end
+void Tensor::gemm_into(Tensor& out, bool accumulate, const std::function<void(const Tensor&, bool)>& gemm_fn) {
+    if (!is_half_precision(out.m_dtype)) return gemm_fn(out, accumulate);
+
+    Tensor result = accumulate ? promote(out, Type::FLOAT32) : Tensor(out.m_shape, Type::FLOAT32);
+    gemm_fn(result, accumulate);
+    cast_impl(result, out);
+}
+
+Tensor get_matmul_empty_output(const Tensor& in1, const Tensor& in2) {
+    auto problem = get_matmul_problem(in1, in2);
+    auto out_shape = problem.batch_shape;
+
+    if (!problem.lhs_vector) out_shape.push_back(problem.M);
+    if (!problem.rhs_vector) out_shape.push_back(problem.N);
+    if (out_shape.empty()) out_shape.push_back(1);
+
+    // Two 8-bit inputs multiply into int32, which quantized ones scale into FLOAT32
+    if (is_8bit(in1.m_dtype) && is_8bit(in2.m_dtype)) {
+        return Tensor(out_shape, in1.m_quant || in2.m_quant ? Type::FLOAT32 : Type::INT32);
     }
 
+    LOG_IF(FATAL, in1.m_quant || in2.m_quant) << "Matmul of a quantized tensor needs both inputs quantized, "
+                                              << "dequantize() the other one or quantize its partner";
     return Tensor(out_shape, get_output_type(in1.m_dtype, in2.m_dtype));
 }
 
-Tensor get_matmul_empty_output(const Tensor& in1, const Tensor& in2) {
-    LOG_IF(FATAL, in1.m_shape.size() != in2.m_shape.size()) << "Batch/Broadcast Matmul is not yet supported";
-    int32_t ndims = in1.m_shape.size();
-    LOG_IF(FATAL, ndims == 0) << "Matmul can't operate on tensor with shape = 0";
-    std::vector<uint32_t> out_shape(ndims);
+template <typename Op, typename T>
+void parallel_binary_kernel(const T* in1, bool in1_scalar, const T* in2, bool in2_scalar, T* out, size_t n) {
+    parallel_for(0, n, ELEMENT_WISE_GRAIN, [&](int64_t begin, int64_t end) {
+        vec::binary_kernel<Op>(in1 + (in1_scalar ? 0 : begin), in1_scalar, in2 + (in2_scalar ? 0 : begin), in2_scalar,
+                               out + begin, end - begin);
+    });
+}
 
-    for (int32_t i = 0; i < ndims - 2; i++) {
-        out_shape[i] = std::max(in1.m_shape[i], in2.m_shape[i]);
+// Flat SIMD loop over the storage buffers; scalar inputs are broadcast to every lane
+template <typename Op, typename T>
+void Tensor::binary_contiguous_kernel(const Tensor& in1, const Tensor& in2, Tensor& out) {
+    bool in1_scalar = in1.size() == 1 && out.size() != 1;
+    bool in2_scalar = in2.size() == 1 && out.size() != 1;
+
+    parallel_binary_kernel<Op>(in1.data_ptr<T>(), in1_scalar, in2.data_ptr<T>(), in2_scalar, out.data_ptr<T>(),
+                               out.size());
+}
+
+// One row of a strided element-wise op; rows that are unit stride (or broadcast) for every operand
+// go through the SIMD loop
+template <typename Op, typename T>
+void binary_row(const T* in1, int64_t in1_stride, const T* in2, int64_t in2_stride, T* out, int64_t out_stride,
+                int64_t n) {
+    if (out_stride == 1 && in1_stride <= 1 && in2_stride <= 1) {
+        vec::binary_kernel<Op>(in1, in1_stride == 0, in2, in2_stride == 0, out, n);
+        return;
     }
 
-    if (ndims == 1) {
-        LOG_IF(FATAL, in1.m_shape[0] != in2.m_shape[0]) << "Matmul input shapes are not compatible";
-        out_shape[0] = 1;
-    } else {
-        LOG_IF(FATAL, in1.m_shape[ndims - 1] != in2.m_shape[ndims - 2]) << "Matmul input shapes are not compatible";
-        out_shape[ndims - 2] = in1.m_shape[ndims - 2];
-        out_shape[ndims - 1] = in2.m_shape[ndims - 1];
+    using C = compute_t<T>;
+    for (int64_t i = 0; i < n; i++) {
+        out[i * out_stride] = T(Op::apply(C(in1[i * in1_stride]), C(in2[i * in2_stride])));
     }
+}
 
-    return Tensor(out_shape, get_output_type(in1.m_dtype, in2.m_dtype));
+template <typename Op, typename T>
+void Tensor::binary_strided_kernel(const Tensor& in1, const Tensor& in2, Tensor& out) {
+    StridedIterator<3> it(out.m_shape, {out.broadcast_strides(out.m_shape), in1.broadcast_strides(out.m_shape),
+                                        in2.broadcast_strides(out.m_shape)});
+    T* dst = out.data_ptr<T>();
+    const T* src1 = in1.data_ptr<T>();
+    const T* src2 = in2.data_ptr<T>();
+
+    parallel_for(0, it.numel(), ELEMENT_WISE_GRAIN, [&](int64_t begin, int64_t end) {
+        it.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+            binary_row<Op>(src1 + offsets[1], strides[1], src2 + offsets[2], strides[2], dst + offsets[0], strides[0],
+                           count);
+        });
+    });
 }
 
-void align_gradient_with_tensor(const Tensor& tensor, Tensor& gradient) {
-    auto t_shape = tensor.m_shape;
-    auto g_shape = gradient.m_shape;
+template <typename Op, typename T>
+void Tensor::scalar_contiguous_kernel(const Tensor& in, Element value, Tensor& out) {
+    T scalar = value;
+    parallel_binary_kernel<Op>(in.data_ptr<T>(), false, &scalar, true, out.data_ptr<T>(), out.size());
+}
 
-    LOG_IF(FATAL, t_shape.size() > g_shape.size()) << "for now tensor shape can have less dims than its gradient";
+template <typename Op, typename T>
+void Tensor::scalar_strided_kernel(const Tensor& in, Element value, Tensor& out) {
+    T scalar = value;
+    StridedIterator<2> it(out.m_shape, {out.broadcast_strides(out.m_shape), in.broadcast_strides(out.m_shape)});
+    T* dst = out.data_ptr<T>();
+    const T* src = in.data_ptr<T>();
+
+    parallel_for(0, it.numel(), ELEMENT_WISE_GRAIN, [&](int64_t begin, int64_t end) {
+        it.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+            binary_row<Op>(src + offsets[1], strides[1], &scalar, 0, dst + offsets[0], strides[0], count);
+        });
+    });
+}
 
-    size_t dims = t_shape.size();
+KernelRegistry::KernelRegistry() {
+    auto register_type = [this](Type dtype, auto tag) {
+        using T = typename decltype(tag)::type;
+        register_binary(BinaryOp::ADD, dtype, Layout::CONTIGUOUS, Tensor::binary_contiguous_kernel<vec::Add, T>);
+        register_binary(BinaryOp::SUB, dtype, Layout::CONTIGUOUS, Tensor::binary_contiguous_kernel<vec::Sub, T>);
+        register_binary(BinaryOp::MUL, dtype, Layout::CONTIGUOUS, Tensor::binary_contiguous_kernel<vec::Mul, T>);
+        register_binary(BinaryOp::DIV, dtype, Layout::CONTIGUOUS, Tensor::binary_contiguous_kernel<vec::Div, T>);
+        register_binary(BinaryOp::ADD, dtype, Layout::STRIDED, Tensor::binary_strided_kernel<vec::Add, T>);
+        register_binary(BinaryOp::SUB, dtype, Layout::STRIDED, Tensor::binary_strided_kernel<vec::Sub, T>);
+        register_binary(BinaryOp::MUL, dtype, Layout::STRIDED, Tensor::binary_strided_kernel<vec::Mul, T>);
+        register_binary(BinaryOp::DIV, dtype, Layout::STRIDED, Tensor::binary_strided_kernel<vec::Div, T>);
+
+        register_scalar(BinaryOp::ADD, dtype, Layout::CONTIGUOUS, Tensor::scalar_contiguous_kernel<vec::Add, T>);
+        register_scalar(BinaryOp::SUB, dtype, Layout::CONTIGUOUS, Tensor::scalar_contiguous_kernel<vec::Sub, T>);
+        register_scalar(BinaryOp::MUL, dtype, Layout::CONTIGUOUS, Tensor::scalar_contiguous_kernel<vec::Mul, T>);
+        register_scalar(BinaryOp::DIV, dtype, Layout::CONTIGUOUS, Tensor::scalar_contiguous_kernel<vec::Div, T>);
+        register_scalar(BinaryOp::ADD, dtype, Layout::STRIDED, Tensor::scalar_strided_kernel<vec::Add, T>);
+        register_scalar(BinaryOp::SUB, dtype, Layout::STRIDED, Tensor::scalar_strided_kernel<vec::Sub, T>);
+        register_scalar(BinaryOp::MUL, dtype, Layout::STRIDED, Tensor::scalar_strided_kernel<vec::Mul, T>);
+        register_scalar(BinaryOp::DIV, dtype, Layout::STRIDED, Tensor::scalar_strided_kernel<vec::Div, T>);
+    };
 
-    with_no_grad();
+#define MICRO_REGISTER_TYPE(type, cpp_type) register_type(type, TypeTag<cpp_type>{});
+    MICRO_FORALL_TYPES(MICRO_REGISTER_TYPE)
+#undef MICRO_REGISTER_TYPE
+}
 
-    for (size_t i = 0; i < dims; i++) {
-        if (t_shape[i] == g_shape[i]) continue;
+KernelRegistry& KernelRegistry::instance() {
+    static KernelRegistry registry;
+    return registry;
+}
 
-        if (t_shape[i] == 1) {
-            gradient = gradient.sum(i, true);
-            continue;
-        }
+void KernelRegistry::register_binary(BinaryOp op, Type dtype, Layout layout, BinaryKernel kernel) {
+    LOG_IF(FATAL, op >= BinaryOp::COUNT || dtype >= Type::UNKONWN || layout >= Layout::COUNT)
+        << "Can't register a kernel for an unknown op, type or layout";
+    m_binary[size_t(op)][size_t(dtype)][size_t(layout)] = kernel;
+}
 
-        LOG(FATAL) << "Tensor and its gradient have incompatible shapes";
-    }
+BinaryKernel KernelRegistry::binary(BinaryOp op, Type dtype, Layout layout) const {
+    LOG_IF(FATAL, op >= BinaryOp::COUNT || dtype >= Type::UNKONWN || layout >= Layout::COUNT)
+        << "Can't do element wise operation with unsupported types";
+    auto kernel = m_binary[size_t(op)][size_t(dtype)][size_t(layout)];
+    LOG_IF(FATAL, !kernel) << "No kernel registered for type " << dtype;
+    return kernel;
+}
+
+void KernelRegistry::register_scalar(BinaryOp op, Type dtype, Layout layout, ScalarKernel kernel) {
+    LOG_IF(FATAL, op >= BinaryOp::COUNT || dtype >= Type::UNKONWN || layout >= Layout::COUNT)
+        << "Can't register a kernel for an unknown op, type or layout";
+    m_scalar[size_t(op)][size_t(dtype)][size_t(layout)] = kernel;
+}
+
+ScalarKernel KernelRegistry::scalar(BinaryOp op, Type dtype, Layout layout) const {
+    LOG_IF(FATAL, op >= BinaryOp::COUNT || dtype >= Type::UNKONWN || layout >= Layout::COUNT)
+        << "Can't do scalar operation with unsupported types";
+    auto kernel = m_scalar[size_t(op)][size_t(dtype)][size_t(layout)];
+    LOG_IF(FATAL, !kernel) << "No kernel registered for type " << dtype;
+    return kernel;
+}
+
+void Tensor::cast_impl(const Tensor& in, Tensor& out) {
+    dispatch_type(in.m_dtype, [&](auto in_tag) {
+        using I = typename decltype(in_tag)::type;
+        dispatch_type(out.m_dtype, [&](auto out_tag) {
+            using O = typename decltype(out_tag)::type;
+
+            StridedIterator<2> it(out.m_shape, {out.broadcast_strides(out.m_shape), in.broadcast_strides(out.m_shape)});
+            O* dst = out.data_ptr<O>();
+            const I* src = in.data_ptr<I>();
+
+            // Widening or narrowing 16-bit floats goes through the SIMD conversions when both sides are dense
+            if constexpr (!std::is_same_v<I, O> && std::is_same_v<compute_t<I>, float> &&
+                          std::is_same_v<compute_t<O>, float>) {
+                if (in.m_shape == out.m_shape && in.is_contiguous() && out.is_contiguous()) {
+                    parallel_for(0, out.size(), ELEMENT_WISE_GRAIN, [&](int64_t begin, int64_t end) {
+                        vec::convert(src + begin, dst + begin, end - begin);
+                    });
+                    return;
+                }
+            }
+
+            parallel_for(0, it.numel(), ELEMENT_WISE_GRAIN, [&](int64_t begin, int64_t end) {
+                it.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+                    for (int64_t i = 0; i < count; i++) {
+                        dst[offsets[0] + i * strides[0]] = O(src[offsets[1] + i * strides[1]]);
+                    }
+                });
+            });
+        });
+    });
+}
+
+// A copy of `in` cast to dtype, for kernels computing in a wider type. Unlike to(), it is never
+// recorded into a captured graph or the autograd graph, since the kernel calling it promotes
+// again on replay and computes its own gradients
+Tensor Tensor::promote(const Tensor& in, Type dtype) {
+    Tensor out(in.m_shape, dtype);
+    cast_impl(in, out);
+    return out;
+}
+
+// Promotes the inputs to the output dtype, then looks up the typed kernel for the operands' layout
+void Tensor::binary_forward_impl(BinaryOp op, const Tensor& in1, const Tensor& in2, Tensor& out) {
+    std::optional<Tensor> promoted1, promoted2;
+    if (in1.m_dtype != out.m_dtype) promoted1 = promote(in1, out.m_dtype);
+    if (in2.m_dtype != out.m_dtype) promoted2 = promote(in2, out.m_dtype);
+
+    const Tensor& a = promoted1 ? *promoted1 : in1;
+    const Tensor& b = promoted2 ? *promoted2 : in2;
 
-    for (size_t i = g_shape.size() - 1; i >= dims; i--) {
-        gradient = gradient.sum(i);
+    bool contiguous = out.is_contiguous();
+    for (const Tensor* in : {&a, &b}) {
+        bool scalar = in->size() == 1;
+        contiguous &= scalar || (in->m_shape == out.m_shape && in->is_contiguous());
     }
 
-    with_grad();
+    auto layout = contiguous ? Layout::CONTIGUOUS : Layout::STRIDED;
+    KernelRegistry::instance().binary(op, out.m_dtype, layout)(a, b, out);
 }
 
-void Tensor::add_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
-    auto call_back = [&](std::vector<uint32_t> indices) {
-        EXECUTE_OPERATION(out[indices], in1.broadcasted_read(indices), in2.broadcasted_read(indices), out.m_dtype, +);
-    };
+void Tensor::scalar_forward_impl(BinaryOp op, const Tensor& in, Element value, Tensor& out) {
+    LOG_IF(FATAL, in.m_dtype != out.m_dtype || in.m_shape != out.m_shape) << "Scalar op output must match its input";
 
-    iterate_tensor(out.m_shape, call_back);
+    bool contiguous = in.is_contiguous() && out.is_contiguous();
+    auto layout = contiguous ? Layout::CONTIGUOUS : Layout::STRIDED;
+    KernelRegistry::instance().scalar(op, out.m_dtype, layout)(in, value, out);
 }
 
-void Tensor::sub_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
-    auto call_back = [&](std::vector<uint32_t> indices) {
-        EXECUTE_OPERATION(out[indices], in1.broadcasted_read(indices), in2.broadcasted_read(indices), out.m_dtype, -);
-    };
+void Tensor::add_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
+    binary_forward_impl(BinaryOp::ADD, in1, in2, out);
+}
 
-    iterate_tensor(out.m_shape, call_back);
+void Tensor::sub_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
+    binary_forward_impl(BinaryOp::SUB, in1, in2, out);
 }
 
 void Tensor::mul_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
-    auto call_back = [&](std::vector<uint32_t> indices) {
-        EXECUTE_OPERATION(out[indices], in1.broadcasted_read(indices), in2.broadcasted_read(indices), out.m_dtype, *);
-    };
-
-    iterate_tensor(out.m_shape, call_back);
+    binary_forward_impl(BinaryOp::MUL, in1, in2, out);
 }
 
 void Tensor::div_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
-    auto call_back = [&](std::vector<uint32_t> indices) {
-        EXECUTE_OPERATION(out[indices], in1.broadcasted_read(indices), in2.broadcasted_read(indices), out.m_dtype, /);
+    binary_forward_impl(BinaryOp::DIV, in1, in2, out);
+}
+
+void Tensor::matmul_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
+    if (is_8bit(in1.m_dtype) && is_8bit(in2.m_dtype)) return int8_matmul_forward_impl(in1, in2, out);
+    addmm_forward_impl(in1, in2, nullptr, Activation::NONE, out);
+}
+
+// out = activation(in1.mm(in2) + bias), the bias and the activation applied by the gemm epilogue
+// to the sums it stores. bias, when given, holds one element per column of out
+void Tensor::addmm_forward_impl(const Tensor& in1, const Tensor& in2, const Tensor* bias, Activation activation,
+                                Tensor& out) {
+    // 16-bit float inputs are widened inside the gemm, only other dtypes are promoted first
+    auto needs_promotion = [&](const Tensor& in) {
+        return in.m_dtype != out.m_dtype && !is_half_precision(in.m_dtype);
     };
 
-    iterate_tensor(out.m_shape, call_back);
+    std::optional<Tensor> promoted1, promoted2;
+    if (needs_promotion(in1)) promoted1 = promote(in1, out.m_dtype);
+    if (needs_promotion(in2)) promoted2 = promote(in2, out.m_dtype);
+
+    const Tensor& lhs = promoted1 ? *promoted1 : in1;
+    const Tensor& rhs = promoted2 ? *promoted2 : in2;
+
+    auto problem = get_matmul_problem(in1, in2);
+    auto ndims = problem.batch_shape.size();
+
+    auto a = get_matmul_operand(lhs, ndims, !problem.lhs_vector, true);
+    auto b = get_matmul_operand(rhs, ndims, true, !problem.rhs_vector);
+
+    gemm_into(out, false, [&](const Tensor& target, bool accumulate) {
+        // The epilogue reads the bias contiguous, in the dtype the gemm computes in
+        std::optional<Tensor> promoted_bias;
+        if (bias && (bias->m_dtype != target.m_dtype || !bias->is_contiguous())) {
+            promoted_bias = promote(*bias, target.m_dtype);
+        }
+        const Tensor* b_values = promoted_bias ? &*promoted_bias : bias;
+
+        auto c = get_matmul_operand(target, ndims, !problem.lhs_vector, !problem.rhs_vector);
+        batched_gemm(problem.batch_shape, problem.M, problem.N, problem.K, a, b, c, accumulate,
+                     b_values ? b_values->data_ptr<char>() : nullptr, activation);
+    });
 }
 
-void Tensor::matmul_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
-    auto call_back = [&](std::vector<uint32_t> indices) {
-        int32_t ndims = indices.size();
-        auto& out_value = out[indices];
-        out_value = 0;
-
-        if (ndims == 1) {
-            LOG_IF(FATAL, in1.m_shape.size() != in2.m_shape.size());
-            LOG_IF(FATAL, in1.m_shape.size() != out.m_shape.size());
-            LOG_IF(FATAL, in1.m_shape.size() != 1);
-            LOG_IF(FATAL, in1.m_shape[0] != in2.m_shape[0]);
-
-            for (uint32_t i = 0; i < in1.m_shape[0]; i++) {
-                auto v1 = in1.broadcasted_read(indices);
-                auto v2 = in2.broadcasted_read(indices);
-
-                Element tmp_value;
-                EXECUTE_OPERATION(tmp_value, v1, v2, out.m_dtype, *);
-                EXECUTE_OPERATION(out_value, out_value, tmp_value, out.m_dtype, +);
+// Scale and zero point of every row (axis = the rows dim) or column (the columns dim) of a matmul
+// input: per-channel params along that dim, copies of per-tensor ones, 1 and 0 when unquantized
+static void matmul_channel_params(const Tensor& t, int32_t axis, uint32_t count, std::vector<float>& scales,
+                                  std::vector<int32_t>& zero_points) {
+    if (!t.is_quantized()) {
+        scales.assign(count, 1.f);
+        zero_points.assign(count, 0);
+        return;
+    }
+
+    const QuantParams& params = t.quant_params();
+    if (!params.per_channel()) {
+        scales.assign(count, params.scales[0]);
+        zero_points.assign(count, params.zero_points[0]);
+        return;
+    }
+
+    LOG_IF(FATAL, params.axis != axis)
+        << "Quantized matmul takes per-channel params along the rows of its left input or the columns of its right "
+        << "one, not along dim " << params.axis;
+    scales = params.scales;
+    zero_points = params.zero_points;
+}
+
+// 8-bit inputs are multiplied by the int8 GEMM, which subtracts the zero points. Unquantized ones
+// give the INT32 products; quantized ones have them scaled into a FLOAT32 out
+void Tensor::int8_matmul_forward_impl(const Tensor& in1, const Tensor& in2, Tensor& out) {
+    auto problem = get_matmul_problem(in1, in2);
+    auto ndims = problem.batch_shape.size();
+    uint32_t M = problem.M, N = problem.N, K = problem.K;
+
+    std::vector<float> a_scales, b_scales;
+    std::vector<int32_t> a_zeros, b_zeros;
+    int32_t rows_dim = problem.lhs_vector ? -1 : int32_t(in1.m_shape.size()) - 2;
+    int32_t cols_dim = problem.rhs_vector ? -1 : int32_t(in2.m_shape.size()) - 1;
+    matmul_channel_params(in1, rows_dim, M, a_scales, a_zeros);
+    matmul_channel_params(in2, cols_dim, N, b_scales, b_zeros);
+
+    auto a = get_matmul_operand(in1, ndims, !problem.lhs_vector, true);
+    auto b = get_matmul_operand(in2, ndims, true, !problem.rhs_vector);
+    auto c = get_matmul_operand(out, ndims, !problem.lhs_vector, !problem.rhs_vector);
+    bool scaled = out.m_dtype == Type::FLOAT32;
+
+    int64_t num_batches = 1;
+    for (auto dim : problem.batch_shape) num_batches *= dim;
+    int64_t grain_size = std::max<int64_t>(1, MATMUL_GRAIN / std::max<int64_t>(int64_t(M) * N * K, 1));
+    StridedIterator<3> it(problem.batch_shape, {a.batch_stride, b.batch_stride, c.batch_stride});
+
+    dispatch_type(a.dtype, [&](auto a_tag) {
+        using TA = typename decltype(a_tag)::type;
+        dispatch_type(b.dtype, [&](auto b_tag) {
+            using TB = typename decltype(b_tag)::type;
+            if constexpr (is_8bit_v<TA> && is_8bit_v<TB>) {
+                parallel_for(0, num_batches, grain_size, [&](int64_t begin, int64_t end) {
+                    thread_local std::vector<int32_t> products;
+                    it.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+                        for (int64_t i = 0; i < count; i++) {
+                            const TA* lhs = static_cast<const TA*>(a.data) + offsets[0] + i * strides[0];
+                            const TB* rhs = static_cast<const TB*>(b.data) + offsets[1] + i * strides[1];
+                            int64_t c_offset = offsets[2] + i * strides[2];
+
+                            if (!scaled) {
+                                gemm::gemm_int8(M, N, K, lhs, a.row_stride, a.col_stride, a_zeros.data(), rhs,
+                                                b.row_stride, b.col_stride, b_zeros.data(),
+                                                static_cast<int32_t*>(c.data) + c_offset, c.row_stride, c.col_stride);
+                                continue;
+                            }
+
+                            products.resize(size_t(M) * N);
+                            gemm::gemm_int8(M, N, K, lhs, a.row_stride, a.col_stride, a_zeros.data(), rhs,
+                                            b.row_stride, b.col_stride, b_zeros.data(), products.data(), N, 1);
+
+                            float* dst = static_cast<float*>(c.data) + c_offset;
+                            for (uint32_t m = 0; m < M; m++) {
+                                for (uint32_t n = 0; n < N; n++) {
+                                    dst[m * c.row_stride + n * c.col_stride] =
+                                        float(products[m * N + n]) * (a_scales[m] * b_scales[n]);
+                                }
+                            }
+                        }
+                    });
+                });
             }
-            return;
+        });
+    });
+}
+
+// q = clamp(round(x / scale) + zero_point), with the scale and zero point of the channel of x.
+// The channel index is walked as a third operand with stride 1 along the channel dim, 0 elsewhere
+void Tensor::quantize_impl(const Tensor& in, Tensor& out) {
+    const QuantParams& params = out.quant_params();
+    std::vector<int64_t> channel_stride(in.m_shape.size(), 0);
+    if (params.per_channel()) channel_stride[params.axis] = 1;
+
+    StridedIterator<3> it(in.m_shape, {in.broadcast_strides(in.m_shape), out.broadcast_strides(in.m_shape),
+                                       channel_stride});
+    const float* src = in.data_ptr<float>();
+    const float* scales = params.scales.data();
+    const int32_t* zero_points = params.zero_points.data();
+
+    dispatch_type(out.m_dtype, [&](auto tag) {
+        using Q = typename decltype(tag)::type;
+        if constexpr (is_8bit_v<Q>) {
+            Q* dst = out.data_ptr<Q>();
+            constexpr float lowest = std::numeric_limits<Q>::lowest(), highest = std::numeric_limits<Q>::max();
+
+            parallel_for(0, it.numel(), ELEMENT_WISE_GRAIN, [&](int64_t begin, int64_t end) {
+                it.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+                    for (int64_t i = 0; i < count; i++) {
+                        int64_t channel = offsets[2] + i * strides[2];
+                        float q = std::nearbyint(src[offsets[0] + i * strides[0]] / scales[channel]) +
+                                  float(zero_points[channel]);
+                        dst[offsets[1] + i * strides[1]] = Q(std::clamp(q, lowest, highest));
+                    }
+                });
+            });
         }
+    });
+}
 
-        // TODO: Add asserts
-        auto tmp1_indices = indices;
-        auto tmp2_indices = indices;
-        uint32_t inner = in1.m_shape[ndims - 1];
-        for (uint32_t i = 0; i < inner; i++) {
-            tmp1_indices[ndims - 1] = i;
-            tmp2_indices[ndims - 2] = i;
-            auto v1 = in1.broadcasted_read(tmp1_indices);
-            auto v2 = in2.broadcasted_read(tmp2_indices);
-
-            Element tmp_value;
-            EXECUTE_OPERATION(tmp_value, v1, v2, out.m_dtype, *);
-            EXECUTE_OPERATION(out_value, out_value, tmp_value, out.m_dtype, +);
+// x = (q - zero_point) * scale, walking the channels as quantize_impl does
+void Tensor::dequantize_impl(const Tensor& in, Tensor& out) {
+    const QuantParams& params = in.quant_params();
+    std::vector<int64_t> channel_stride(in.m_shape.size(), 0);
+    if (params.per_channel()) channel_stride[params.axis] = 1;
+
+    StridedIterator<3> it(in.m_shape, {in.broadcast_strides(in.m_shape), out.broadcast_strides(in.m_shape),
+                                       channel_stride});
+    float* dst = out.data_ptr<float>();
+    const float* scales = params.scales.data();
+    const int32_t* zero_points = params.zero_points.data();
+
+    dispatch_type(in.m_dtype, [&](auto tag) {
+        using Q = typename decltype(tag)::type;
+        if constexpr (is_8bit_v<Q>) {
+            const Q* src = in.data_ptr<Q>();
+            parallel_for(0, it.numel(), ELEMENT_WISE_GRAIN, [&](int64_t begin, int64_t end) {
+                it.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+                    for (int64_t i = 0; i < count; i++) {
+                        int64_t channel = offsets[2] + i * strides[2];
+                        dst[offsets[1] + i * strides[1]] =
+                            float(int32_t(src[offsets[0] + i * strides[0]]) - zero_points[channel]) * scales[channel];
+                    }
+                });
+            });
         }
-    };
+    });
+}
+
+template <ReduceOp Op>
+struct Reducer {
+    template <typename T>
+    static T identity() {
+        if constexpr (Op == ReduceOp::SUM) {
+            return T(0);
+        } else if constexpr (Op == ReduceOp::PROD) {
+            return T(1);
+        } else if constexpr (Op == ReduceOp::MAX) {
+            return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity()
+                                                        : std::numeric_limits<T>::lowest();
+        } else {
+            return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                        : std::numeric_limits<T>::max();
+        }
+    }
 
-    iterate_tensor(out.m_shape, call_back);
+    // Works on scalars and on vec::Vec alike
+    template <typename V>
+    static V apply(V a, V b) {
+        if constexpr (Op == ReduceOp::SUM) {
+            return vec::Add::apply(a, b);
+        } else if constexpr (Op == ReduceOp::PROD) {
+            return vec::Mul::apply(a, b);
+        } else if constexpr (Op == ReduceOp::MAX) {
+            return vec::Max::apply(a, b);
+        } else {
+            return vec::Min::apply(a, b);
+        }
+    }
+};
+
+// Calls fn(std::integral_constant<ReduceOp, op>{}), so the op is a template argument inside fn
+template <typename Fn>
+void dispatch_reduce(ReduceOp op, Fn&& fn) {
+    switch (op) {
+        case ReduceOp::SUM:
+            fn(std::integral_constant<ReduceOp, ReduceOp::SUM>{});
+            return;
+        case ReduceOp::PROD:
+            fn(std::integral_constant<ReduceOp, ReduceOp::PROD>{});
+            return;
+        case ReduceOp::MAX:
+            fn(std::integral_constant<ReduceOp, ReduceOp::MAX>{});
+            return;
+        case ReduceOp::MIN:
+            fn(std::integral_constant<ReduceOp, ReduceOp::MIN>{});
+            return;
+        default:
+            LOG(FATAL) << "Unsupported reduction";
+    }
 }
 
-void Tensor::sum_forward_impl(const Tensor& in, const uint32_t dim, Tensor& out) {
-    auto in_shape = in.m_shape;
-    auto out_shape = out.m_shape;
+// Combines the results of consecutive blocks pairwise. Level k holds the result of 2^k blocks, and
+// two results of one level merge into the next, like the carries of a binary counter of blocks.
+template <ReduceOp Op, typename T>
+class PairwiseCascade {
+   public:
+    void push(T value) {
+        int32_t level = 0;
+        for (; m_count >> level & 1; level++) value = Reducer<Op>::apply(m_levels[level], value);
+        m_levels[level] = value;
+        m_count++;
+    }
 
-    LOG_IF(FATAL, in_shape.size() != out_shape.size()) << "Shapes are not compatible";
+    T result() const {
+        T value = Reducer<Op>::template identity<T>();
+        for (int32_t level = 0; level < 64; level++) {
+            if (m_count >> level & 1) value = Reducer<Op>::apply(m_levels[level], value);
+        }
+        return value;
+    }
+
+   private:
+    T m_levels[64];
+    uint64_t m_count = 0;
+};
+
+// Reduces n contiguous elements in compute_t<T>. Runs of up to PAIRWISE_BLOCK go through four
+// vector accumulators; longer ones are split in two halves whose results are combined.
+template <ReduceOp Op, typename T, typename C = compute_t<T>>
+C reduce_contiguous(const T* data, int64_t n) {
+    using R = Reducer<Op>;
+    using V = vec::Vec<C>;
+    constexpr int64_t W = V::size;
+
+    if (n > PAIRWISE_BLOCK) {
+        int64_t half = std::max(n / 2 / PAIRWISE_BLOCK, int64_t(1)) * PAIRWISE_BLOCK;
+        return R::apply(reduce_contiguous<Op>(data, half), reduce_contiguous<Op>(data + half, n - half));
+    }
 
-    uint32_t dim_size = in_shape[dim];
+    C identity = R::template identity<C>();
+    V acc0 = V::broadcast(identity), acc1 = acc0, acc2 = acc0, acc3 = acc0;
 
-    auto call_back = [&](std::vector<uint32_t> indices) {
-        auto tmp_indices = indices;
+    int64_t i = 0;
+    for (; i + 4 * W <= n; i += 4 * W) {
+        acc0 = R::apply(acc0, V::load(data + i));
+        acc1 = R::apply(acc1, V::load(data + i + W));
+        acc2 = R::apply(acc2, V::load(data + i + 2 * W));
+        acc3 = R::apply(acc3, V::load(data + i + 3 * W));
+    }
+    for (; i + W <= n; i += W) acc0 = R::apply(acc0, V::load(data + i));
 
-        Element sum(0);
+    alignas(64) C lanes[W];
+    R::apply(R::apply(acc0, acc1), R::apply(acc2, acc3)).store(lanes);
 
-        for (uint32_t i = 0; i < dim_size; i++) {
-            tmp_indices[dim] = i;
-            EXECUTE_INLINE_OPERATION(sum, in[tmp_indices], out.m_dtype, +);
-        }
+    C value = identity;
+    for (int64_t lane = 0; lane < W; lane++) value = R::apply(value, lanes[lane]);
+    for (; i < n; i++) value = R::apply(value, C(data[i]));
+    return value;
+}
 
-        out[indices] = sum;
-    };
+// acc[i] = acc[i] <op> row[i] over n elements, acc holding compute_t of the row's type
+template <ReduceOp Op, typename C, typename T>
+void combine_rows(C* acc, const T* row, int64_t n) {
+    using R = Reducer<Op>;
+    using V = vec::Vec<C>;
+    constexpr int64_t W = V::size;
 
-    iterate_tensor(out.m_shape, call_back);
+    int64_t i = 0;
+    for (; i + W <= n; i += W) R::apply(V::load(acc + i), V::load(row + i)).store(acc + i);
+    for (; i < n; i++) acc[i] = R::apply(acc[i], C(row[i]));
 }
 
-void Tensor::add_backward_impl(Tensor& out) {
-    if (!out.m_requires_grad) return;
-    LOG_IF(FATAL, !out.m_saved_context->grad()) << "Grad tensor is not initialized";
+/**
+ * Reduces every group of input elements walked by `inner` into the output element `outer` pairs
+ * it with; outer walks (out, in) offsets, inner the offsets of a group relative to its first
+ * element. The strategy follows the layout:
+ *  - inner: each group is one contiguous run (e.g. reducing the last dims), reduced with SIMD
+ *    and pairwise summation. A run longer than REDUCTION_CHUNK is split into chunks reduced in
+ *    parallel, whose results are then combined pairwise in order.
+ *  - outer: the kept dims end in a dim contiguous in both tensors (e.g. reducing the first dims),
+ *    so a row of outputs is accumulated with SIMD from one contiguous input row at a time.
+ *    PAIRWISE_ROWS input rows are accumulated before being combined pairwise.
+ *  - anything else walks each group through its strides, combining blocks pairwise.
+ * Apart from the chunked runs, work is split across output elements.
+ */
+template <ReduceOp Op, typename T>
+void reduce_kernel(const T* in, T* out, const StridedIterator<2>& outer, const StridedIterator<1>& inner) {
+    using R = Reducer<Op>;
+    using C = compute_t<T>;
+    C identity = R::template identity<C>();
+
+    int64_t outputs = outer.numel(), n = inner.numel();
+    int64_t grain_size = std::max<int64_t>(1, REDUCTION_GRAIN / n);
+
+    if (inner.ndims() == 1 && inner.inner_stride(0) == 1) {
+        if (n <= REDUCTION_CHUNK) {
+            parallel_for(0, outputs, grain_size, [&](int64_t begin, int64_t end) {
+                outer.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+                    for (int64_t i = 0; i < count; i++) {
+                        out[offsets[0] + i * strides[0]] = T(reduce_contiguous<Op>(in + offsets[1] + i * strides[1], n));
+                    }
+                });
+            });
+            return;
+        }
 
-    auto parents = out.m_saved_context->get_saved_variables();
-    LOG_IF(FATAL, parents.size() != 2) << "Add backward function expected 2 parents only";
+        int64_t chunks = (n + REDUCTION_CHUNK - 1) / REDUCTION_CHUNK;
+        std::vector<C> partials(outputs * chunks);
+        parallel_for(0, outputs * chunks, 1, [&](int64_t begin, int64_t end) {
+            for (int64_t task = begin; task < end; task++) {
+                int64_t first = task % chunks * REDUCTION_CHUNK;
+                outer.for_each(task / chunks, task / chunks + 1, [&](const int64_t* offsets, int64_t, const int64_t*) {
+                    partials[task] =
+                        reduce_contiguous<Op>(in + offsets[1] + first, std::min(REDUCTION_CHUNK, n - first));
+                });
+            }
+        });
 
-    with_no_grad();
+        const C* partial = partials.data();
+        outer.for_each(0, outputs, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+            for (int64_t i = 0; i < count; i++, partial += chunks) {
+                out[offsets[0] + i * strides[0]] = T(reduce_contiguous<Op>(partial, chunks));
+            }
+        });
+        return;
+    }
 
-    auto& in1 = parents[0];
-    auto& in2 = parents[1];
+    if (outputs > 1 && outer.inner_stride(0) == 1 && outer.inner_stride(1) == 1) {
+        int64_t blocks = (n + PAIRWISE_ROWS - 1) / PAIRWISE_ROWS;
+        int64_t levels = 1;
+        while ((int64_t(1) << levels) <= blocks) levels++;
+
+        parallel_for(0, outputs, grain_size, [&](int64_t begin, int64_t end) {
+            // levels partial rows of the cascade, then the rows being accumulated
+            std::vector<C> buffer((levels + 1) * REDUCTION_COLUMNS);
+            C* acc = buffer.data() + levels * REDUCTION_COLUMNS;
+
+            outer.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t*) {
+                for (int64_t column = 0; column < count; column += REDUCTION_COLUMNS) {
+                    int64_t width = std::min(REDUCTION_COLUMNS, count - column);
+                    const T* src = in + offsets[1] + column;
+                    uint64_t filled = 0;
+
+                    for (int64_t row = 0; row < n; row += PAIRWISE_ROWS) {
+                        std::fill(acc, acc + width, identity);
+                        inner.for_each(row, std::min(n, row + PAIRWISE_ROWS),
+                                       [&](const int64_t* in_offsets, int64_t rows, const int64_t* in_strides) {
+                                           for (int64_t r = 0; r < rows; r++) {
+                                               combine_rows<Op>(acc, src + in_offsets[0] + r * in_strides[0], width);
+                                           }
+                                       });
+
+                        int64_t level = 0;
+                        for (; filled >> level & 1; level++) {
+                            combine_rows<Op>(acc, buffer.data() + level * REDUCTION_COLUMNS, width);
+                        }
+                        std::copy(acc, acc + width, buffer.data() + level * REDUCTION_COLUMNS);
+                        filled++;
+                    }
+
+                    std::fill(acc, acc + width, identity);
+                    for (int64_t level = 0; level < levels; level++) {
+                        if (!(filled >> level & 1)) continue;
+                        combine_rows<Op>(acc, buffer.data() + level * REDUCTION_COLUMNS, width);
+                    }
+                    std::copy(acc, acc + width, out + offsets[0] + column);
+                }
+            });
+        });
+        return;
+    }
+
+    parallel_for(0, outputs, grain_size, [&](int64_t begin, int64_t end) {
+        outer.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+            for (int64_t i = 0; i < count; i++) {
+                const T* src = in + offsets[1] + i * strides[1];
+                PairwiseCascade<Op, C> cascade;
+
+                for (int64_t block = 0; block < n; block += PAIRWISE_BLOCK) {
+                    C value = identity;
+                    inner.for_each(block, std::min(n, block + PAIRWISE_BLOCK),
+                                   [&](const int64_t* in_offsets, int64_t m, const int64_t* in_strides) {
+                                       for (int64_t j = 0; j < m; j++) {
+                                           value = R::apply(value, C(src[in_offsets[0] + j * in_strides[0]]));
+                                       }
+                                   });
+                    cascade.push(value);
+                }
+
+                out[offsets[0] + i * strides[0]] = T(cascade.result());
+            }
+        });
+    });
+}
+
+// Max (min) of each group like reduce_kernel, along with the position of its first occurrence
+// within the group; outer walks (out, in, indices) offsets
+template <ReduceOp Op, typename T>
+void arg_reduce_kernel(const T* in, T* out, uint32_t* indices, const StridedIterator<3>& outer,
+                       const StridedIterator<1>& inner) {
+    int64_t n = inner.numel();
+    int64_t grain_size = std::max<int64_t>(1, REDUCTION_GRAIN / n);
+
+    parallel_for(0, outer.numel(), grain_size, [&](int64_t begin, int64_t end) {
+        outer.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+            for (int64_t i = 0; i < count; i++) {
+                const T* src = in + offsets[1] + i * strides[1];
+                T best = *src;
+                uint32_t best_position = 0, position = 0;
+
+                inner.for_each(0, n, [&](const int64_t* in_offsets, int64_t m, const int64_t* in_strides) {
+                    for (int64_t j = 0; j < m; j++, position++) {
+                        T value = src[in_offsets[0] + j * in_strides[0]];
+                        bool better = Op == ReduceOp::MAX ? best < value : value < best;
+                        if (!better) continue;
+                        best = value;
+                        best_position = position;
+                    }
+                });
+
+                out[offsets[0] + i * strides[0]] = best;
+                indices[offsets[2] + i * strides[2]] = best_position;
+            }
+        });
+    });
+}
 
-    auto& in1_grad = in1.m_saved_context->grad();
-    auto& in2_grad = in2.m_saved_context->grad();
-    auto& out_grad = out.m_saved_context->grad();
+// Splits `in` into the dims a reduction into `out` keeps (out isn't 1 there) and the dims it
+// reduces, returning the shape of each
+static std::pair<std::vector<uint32_t>, std::vector<uint32_t>> split_reduction(const std::vector<uint32_t>& in_shape,
+                                                                               const std::vector<uint32_t>& out_shape) {
+    LOG_IF(FATAL, in_shape.size() != out_shape.size()) << "Shapes are not compatible";
 
-    if (!in1_grad) {
-        in1_grad = std::make_shared<Tensor>(in1.m_shape);
-        *(in1_grad) = 0;
+    std::vector<uint32_t> kept_shape(in_shape), reduced_shape(in_shape);
+    for (size_t d = 0; d < in_shape.size(); d++) {
+        if (out_shape[d] == 1) {
+            kept_shape[d] = 1;
+        } else {
+            reduced_shape[d] = 1;
+        }
     }
+    return {kept_shape, reduced_shape};
+}
+
+void Tensor::reduce_forward_impl(ReduceOp op, const Tensor& in, Tensor& out) {
+    LOG_IF(FATAL, in.m_dtype != out.m_dtype) << "Reduction output must have the input dtype";
+
+    auto [kept_shape, reduced_shape] = split_reduction(in.m_shape, out.m_shape);
+    auto in_strides = in.broadcast_strides(in.m_shape);
 
-    if (!in2_grad) {
-        in2_grad = std::make_shared<Tensor>(in2.m_shape);
-        *(in2_grad) = 0;
+    StridedIterator<2> outer(kept_shape, {out.broadcast_strides(in.m_shape), in_strides});
+    StridedIterator<1> inner(reduced_shape, {in_strides});
+
+    dispatch_type(in.m_dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        dispatch_reduce(op, [&](auto op_tag) {
+            reduce_kernel<decltype(op_tag)::value>(in.data_ptr<T>(), out.data_ptr<T>(), outer, inner);
+        });
+    });
+}
+
+void Tensor::arg_reduce_forward_impl(ReduceOp op, const Tensor& in, Tensor& out, Tensor& indices) {
+    LOG_IF(FATAL, op != ReduceOp::MAX && op != ReduceOp::MIN) << "Only max and min have an arg reduction";
+    LOG_IF(FATAL, in.m_dtype != out.m_dtype || indices.m_dtype != Type::UINT32)
+        << "Arg reduction outputs must have the input dtype and UINT32 indices";
+    LOG_IF(FATAL, out.m_shape != indices.m_shape) << "Arg reduction outputs must have one shape";
+
+    auto [kept_shape, reduced_shape] = split_reduction(in.m_shape, out.m_shape);
+    auto in_strides = in.broadcast_strides(in.m_shape);
+
+    StridedIterator<3> outer(kept_shape, {out.broadcast_strides(in.m_shape), in_strides,
+                                          indices.broadcast_strides(in.m_shape)});
+    StridedIterator<1> inner(reduced_shape, {in_strides});
+
+    dispatch_type(in.m_dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        uint32_t* index_data = indices.data_ptr<uint32_t>();
+        if (op == ReduceOp::MAX) {
+            arg_reduce_kernel<ReduceOp::MAX>(in.data_ptr<T>(), out.data_ptr<T>(), index_data, outer, inner);
+        } else {
+            arg_reduce_kernel<ReduceOp::MIN>(in.data_ptr<T>(), out.data_ptr<T>(), index_data, outer, inner);
+        }
+    });
+}
+
+// dst (+)= grad * factor, summed over the dims dst is broadcast along, then multiplied (or divided)
+// by scale. Reduced dims are walked by an inner iterator per output element, so the output can be
+// split across threads without two chunks ever writing the same element.
+template <typename T, bool HasFactor>
+void Tensor::accumulate_grad_kernel(const Tensor& grad, const Tensor* factor, compute_t<T> scale, bool divide,
+                                    Tensor& dst, bool accumulate) {
+    using C = compute_t<T>;
+    auto shape = broadcast_shapes(dst.m_shape, grad.m_shape);
+    if constexpr (HasFactor) shape = broadcast_shapes(shape, factor->m_shape);
+
+    auto dst_strides = dst.broadcast_strides(shape);
+    auto grad_strides = grad.broadcast_strides(shape);
+    auto factor_strides = HasFactor ? factor->broadcast_strides(shape) : std::vector<int64_t>(shape.size(), 0);
+
+    std::vector<uint32_t> kept_shape(shape), reduced_shape(shape);
+    for (size_t d = 0; d < shape.size(); d++) {
+        if (shape[d] > 1 && dst_strides[d] == 0) {
+            kept_shape[d] = 1;
+        } else {
+            reduced_shape[d] = 1;
+        }
     }
 
-    *(in1_grad) = *(in1_grad) + *(out_grad);
-    *(in2_grad) = *(in2_grad) + *(out_grad);
+    StridedIterator<3> outer(kept_shape, {dst_strides, grad_strides, factor_strides});
+    StridedIterator<2> inner(reduced_shape, {grad_strides, factor_strides});
 
-    align_gradient_with_tensor(in1, *(in1_grad));
-    align_gradient_with_tensor(in2, *(in2_grad));
+    T* out = dst.data_ptr<T>();
+    const T* g = grad.data_ptr<T>();
+    const T* f = nullptr;
+    if constexpr (HasFactor) f = factor->data_ptr<T>();
 
-    with_grad();
+    auto store = [&](T& slot, C value) {
+        value = divide ? value / scale : value * scale;
+        slot = T(accumulate ? slot + value : value);
+    };
+
+    int64_t grain_size = std::max<int64_t>(1, REDUCTION_GRAIN / inner.numel());
+    parallel_for(0, outer.numel(), grain_size, [&](int64_t begin, int64_t end) {
+        outer.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+            if (inner.numel() == 1) {
+                for (int64_t i = 0; i < count; i++) {
+                    C value = g[offsets[1] + i * strides[1]];
+                    if constexpr (HasFactor) value *= C(f[offsets[2] + i * strides[2]]);
+                    store(out[offsets[0] + i * strides[0]], value);
+                }
+                return;
+            }
+
+            for (int64_t i = 0; i < count; i++) {
+                int64_t g_base = offsets[1] + i * strides[1];
+                int64_t f_base = offsets[2] + i * strides[2];
+                C sum = C(0);
+
+                inner.for_each(0, inner.numel(), [&](const int64_t* in_offsets, int64_t n, const int64_t* in_strides) {
+                    for (int64_t j = 0; j < n; j++) {
+                        C value = g[g_base + in_offsets[0] + j * in_strides[0]];
+                        if constexpr (HasFactor) value *= C(f[f_base + in_offsets[1] + j * in_strides[1]]);
+                        sum += value;
+                    }
+                });
+
+                store(out[offsets[0] + i * strides[0]], sum);
+            }
+        });
+    });
 }
 
-void Tensor::sub_backward_impl(Tensor& out) {
-    if (!out.m_requires_grad) return;
+// The grad buffer the gradient of `in` is written to, and whether it has to be accumulated into.
+// A gradient always has the dtype of the tensor it belongs to, whatever dtype the op producing it
+// computed in. A stale buffer that still fits is overwritten instead of reallocated.
+Tensor& Tensor::grad_buffer(const Tensor& in, bool& accumulate) {
+    auto& ctx = *in.m_saved_context;
+    auto& in_grad = ctx.grad();
+
+    accumulate = ctx.has_grad();
+    ctx.mark_grad_fresh();
+    bool reusable = in_grad && !in_grad->m_expr && in_grad->m_shape == in.m_shape && in_grad->m_dtype == in.m_dtype;
+    if (!accumulate && !reusable) in_grad = std::make_shared<Tensor>(in.m_shape, in.m_dtype);
+
+    // The buffer may have been read by a lazy expression since the last pass
+    in_grad->evaluate_pending_readers();
+    return *in_grad;
+}
 
-    LOG_IF(FATAL, !out.m_saved_context->grad()) << "Grad tensor is not initialized";
+// Adds one contribution to the gradient of `in`, reduced to in's shape in the same pass. The
+// first contribution of a pass is written without reading the grad buffer.
+void Tensor::accumulate_grad(const Tensor& in, const Tensor& grad, const Tensor* factor, Element scale, bool divide) {
+    if (!in.m_requires_grad) return;
 
-    auto parents = out.m_saved_context->get_saved_variables();
+    auto& ctx = *in.m_saved_context;
+    auto& in_grad = ctx.grad();
 
-    LOG_IF(FATAL, parents.size() != 2) << "Subtract backward function expected 2 parents only";
+    // Gradients of a lazy forward are built as lazy expressions as well. They stay lazy while
+    // `in` is itself lazy, so the backward of a fused chain fuses the same way, and are evaluated
+    // straight into the grad buffer of the first tensor that isn't
+    bool lazy = in.m_expr || grad.m_expr || (factor && factor->m_expr);
+    auto shape = factor ? broadcast_shapes(grad.m_shape, factor->m_shape) : grad.m_shape;
+    bool fusable = shape == in.m_shape && grad.m_dtype == in.m_dtype && (!factor || factor->m_dtype == grad.m_dtype);
 
-    with_no_grad();
+    if (lazy && fusable) {
+        bool unit_scale = !divide && scale.data.u32 == grad.to_element(1).data.u32;
+        auto scale_op = divide ? BinaryOp::DIV : BinaryOp::MUL;
 
-    auto& in1 = parents[0];
-    auto& in2 = parents[1];
+        Tensor contribution = factor ? lazy_op(BinaryOp::MUL, grad, *factor) : lazy_scalar_op(scale_op, grad, scale);
+        if (factor && !unit_scale) contribution = lazy_scalar_op(scale_op, contribution, scale);
 
-    auto& in1_grad = in1.m_saved_context->grad();
-    auto& in2_grad = in2.m_saved_context->grad();
-    auto& out_grad = out.m_saved_context->grad();
+        if (in.m_expr) {
+            in_grad = std::make_shared<Tensor>(ctx.has_grad() ? lazy_op(BinaryOp::ADD, *in_grad, contribution)
+                                                               : std::move(contribution));
+            ctx.mark_grad_fresh();
+            return;
+        }
 
-    if (!in1_grad) {
-        in1_grad = std::make_shared<Tensor>(in1.m_shape);
-        *(in1_grad) = 0;
+        bool accumulate;
+        Tensor& buffer = grad_buffer(in, accumulate);
+        fused_forward_impl(*contribution.m_expr, buffer, accumulate);
+        return;
     }
 
-    if (!in2_grad) {
-        in2_grad = std::make_shared<Tensor>(in2.m_shape);
-        *(in2_grad) = 0;
-    }
+    bool accumulate;
+    Tensor& buffer = grad_buffer(in, accumulate);
 
-    *(in1_grad) = *(in1_grad) + *(out_grad);
-    *(in2_grad) = *(in2_grad) - *(out_grad);
+    Type dtype = buffer.m_dtype;
+    std::optional<Tensor> promoted_grad, promoted_factor;
+    if (grad.m_dtype != dtype) promoted_grad = promote(grad, dtype);
+    if (factor && factor->m_dtype != dtype) promoted_factor = promote(*factor, dtype);
 
-    align_gradient_with_tensor(in1, *(in1_grad));
-    align_gradient_with_tensor(in2, *(in2_grad));
+    const Tensor& g = promoted_grad ? *promoted_grad : grad;
+    const Tensor* f = promoted_factor ? &*promoted_factor : factor;
+    scale = cast_element(scale, grad.m_dtype, dtype);
 
-    with_grad();
+    dispatch_type(dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        if (f) {
+            accumulate_grad_kernel<T, true>(g, f, compute_t<T>(scale), divide, buffer, accumulate);
+        } else {
+            accumulate_grad_kernel<T, false>(g, nullptr, compute_t<T>(scale), divide, buffer, accumulate);
+        }
+    });
 }
 
-void Tensor::mul_backward_impl(Tensor& out) {
-    if (!out.m_requires_grad) return;
+void Tensor::add_backward_impl(AutogradContext& ctx) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
 
-    LOG_IF(FATAL, !out.m_saved_context->grad()) << "Grad tensor is not initialized";
+    auto& parents = ctx.get_saved_variables();
+    LOG_IF(FATAL, parents.size() != 2) << "Add backward function expected 2 parents only";
 
-    auto parents = out.m_saved_context->get_saved_variables();
+    auto& out_grad = *(ctx.grad());
+    auto one = out_grad.to_element(1);
+
+    accumulate_grad(parents[0], out_grad, nullptr, one);
+    accumulate_grad(parents[1], out_grad, nullptr, one);
+}
+
+void Tensor::sub_backward_impl(AutogradContext& ctx) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
+
+    auto& parents = ctx.get_saved_variables();
 
     LOG_IF(FATAL, parents.size() != 2) << "Subtract backward function expected 2 parents only";
 
-    with_no_grad();
+    auto& out_grad = *(ctx.grad());
+
+    accumulate_grad(parents[0], out_grad, nullptr, out_grad.to_element(1));
+    accumulate_grad(parents[1], out_grad, nullptr, out_grad.to_element(-1));
+}
+
+void Tensor::mul_backward_impl(AutogradContext& ctx) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
+
+    auto& parents = ctx.get_saved_variables();
+
+    LOG_IF(FATAL, parents.size() != 2) << "Multiply backward function expected 2 parents only";
 
     auto& in1 = parents[0];
     auto& in2 = parents[1];
+    auto& out_grad = *(ctx.grad());
+    auto one = out_grad.to_element(1);
 
-    auto& in1_grad = in1.m_saved_context->grad();
-    auto& in2_grad = in2.m_saved_context->grad();
-    auto& out_grad = out.m_saved_context->grad();
-
-    if (!in1_grad) {
-        in1_grad = std::make_shared<Tensor>(in1.m_shape);
-        *(in1_grad) = 0;
+    if (&ctx != in1.m_saved_context.get()) {
+        accumulate_grad(in1, out_grad, &in2, one);
     }
 
-    if (!in2_grad) {
-        in2_grad = std::make_shared<Tensor>(in2.m_shape);
-        *(in2_grad) = 0;
+    if (&ctx != in2.m_saved_context.get()) {
+        accumulate_grad(in2, out_grad, &in1, one);
     }
+}
 
-    if (out.m_saved_context != in1.m_saved_context) {
-        *(in1_grad) = *(in1_grad) + (*(out_grad)*in2);
-    }
+void Tensor::scalar_backward_impl(AutogradContext& ctx, BinaryOp op, Element value) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
 
-    if (out.m_saved_context != in2.m_saved_context) {
-        *(in2_grad) = *(in2_grad) + (*(out_grad)*in1);
-    }
+    auto& parents = ctx.get_saved_variables();
 
-    align_gradient_with_tensor(in1, *(in1_grad));
-    align_gradient_with_tensor(in2, *(in2_grad));
+    LOG_IF(FATAL, parents.size() != 1) << "Scalar backward function expected only 1 parent";
 
-    with_grad();
+    auto& in = parents[0];
+    auto& out_grad = *(ctx.grad());
+
+    switch (op) {
+        case BinaryOp::ADD:
+        case BinaryOp::SUB:
+            accumulate_grad(in, out_grad, nullptr, out_grad.to_element(1));
+            break;
+        case BinaryOp::MUL:
+        case BinaryOp::DIV:
+            accumulate_grad(in, out_grad, nullptr, cast_element(value, in.m_dtype, out_grad.m_dtype),
+                            op == BinaryOp::DIV);
+            break;
+        default:
+            LOG(FATAL) << "Unsupported scalar operation";
+    }
 }
 
-void Tensor::div_backward_impl(Tensor& out) {
-    (void)out;
+void Tensor::div_backward_impl(AutogradContext& ctx) {
+    (void)ctx;
     LOG(FATAL) << "Not yet implemented";
 }
 
-void Tensor::matmul_backward_impl(Tensor& out) {
-    if (!out.m_requires_grad) return;
+void Tensor::matmul_backward_impl(AutogradContext& ctx) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
 
-    LOG_IF(FATAL, !out.m_saved_context->grad()) << "Grad tensor is not initialized";
+    auto& parents = ctx.get_saved_variables();
 
-    auto parents = out.m_saved_context->get_saved_variables();
+    LOG_IF(FATAL, parents.size() != 2) << "Matmul backward function expected 2 parents only";
 
-    LOG_IF(FATAL, parents.size() != 2) << "Subtract backward function expected 2 parents only";
+    matmul_backward(ctx, parents[0], parents[1], *ctx.grad());
+}
 
-    with_no_grad();
+// One pass over the gradient of an addmm output seen as rows x N: multiplies it by the derivative
+// of the activation at the result into masked (unless it is nullptr), and sums its rows into
+// bias_grad (unless it is nullptr). Rows are summed in fixed blocks, then the blocks in order, so
+// the bias gradient doesn't depend on the number of threads
+template <typename T>
+void addmm_grad_kernel(const T* grad, const T* result, Activation activation, T* masked, T* bias_grad,
+                       bool accumulate, int64_t rows, int64_t N) {
+    using C = compute_t<T>;
+    int64_t blocks = (rows + PAIRWISE_ROWS - 1) / PAIRWISE_ROWS;
+    std::vector<C> partials(bias_grad ? blocks * N : 0);
+
+    int64_t grain = std::max<int64_t>(1, ELEMENT_WISE_GRAIN / (PAIRWISE_ROWS * N));
+    parallel_for(0, blocks, grain, [&](int64_t begin, int64_t end) {
+        for (int64_t block = begin; block < end; block++) {
+            C* sums = bias_grad ? partials.data() + block * N : nullptr;
+            for (int64_t row = block * PAIRWISE_ROWS; row < std::min(rows, (block + 1) * PAIRWISE_ROWS); row++) {
+                const T* g = grad + row * N;
+                const T* r = result + row * N;
+                for (int64_t j = 0; j < N; j++) {
+                    C value = C(g[j]);
+                    if (activation == Activation::RELU && !(C(r[j]) > C(0))) value = C(0);
+                    if (masked) masked[row * N + j] = T(value);
+                    if (sums) sums[j] = row % PAIRWISE_ROWS ? C(sums[j] + value) : value;
+                }
+            }
+        }
+    });
+
+    if (!bias_grad) return;
+    parallel_for(0, N, REDUCTION_GRAIN / std::max<int64_t>(blocks, 1) + 1, [&](int64_t begin, int64_t end) {
+        for (int64_t j = begin; j < end; j++) {
+            C sum = accumulate ? C(bias_grad[j]) : C(0);
+            for (int64_t block = 0; block < blocks; block++) sum += partials[block * N + j];
+            bias_grad[j] = T(sum);
+        }
+    });
+}
 
-    auto& in1 = parents[0];
-    auto& in2 = parents[1];
+void Tensor::addmm_backward_impl(AutogradContext& ctx, Activation activation) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
 
-    auto& in1_grad = in1.m_saved_context->grad();
-    auto& in2_grad = in2.m_saved_context->grad();
-    auto& out_grad = out.m_saved_context->grad();
+    auto& parents = ctx.get_saved_variables();
+    size_t expected = activation == Activation::NONE ? 3 : 4;
+    LOG_IF(FATAL, parents.size() != expected) << "Addmm backward function expected " << expected << " saved tensors";
 
-    if (!in1_grad) {
-        in1_grad = std::make_shared<Tensor>(in1.m_shape);
-        *(in1_grad) = 0;
+    auto& in = parents[0];
+    auto& weight = parents[1];
+    auto& bias = parents[2];
+    const Tensor& out_grad = *ctx.grad();
+    bool bias_needs_grad = bias.m_requires_grad && &ctx != bias.m_saved_context.get();
+    if (activation == Activation::NONE && !bias_needs_grad) return matmul_backward(ctx, in, weight, out_grad);
+
+    // The pass reads the gradient and the result row by row
+    Tensor grad = out_grad.is_contiguous() ? out_grad : promote(out_grad, out_grad.m_dtype);
+    const Tensor& result = activation == Activation::NONE ? grad : parents[3];
+    LOG_IF(FATAL, result.m_dtype != grad.m_dtype)
+        << "Addmm backward expects the result and gradient to share one dtype";
+
+    std::optional<Tensor> masked;
+    if (activation != Activation::NONE) masked = Tensor(grad.m_shape, grad.m_dtype);
+
+    // The pass sums the bias gradient in the dtype of the output gradient. A bias of another dtype
+    // gets the sums through a temporary, which accumulate_grad rounds into its grad buffer
+    std::optional<Tensor> bias_sums;
+    Tensor* bias_grad = nullptr;
+    bool accumulate = false;
+    if (bias_needs_grad && bias.m_dtype == grad.m_dtype) {
+        bias_grad = &grad_buffer(bias, accumulate);
+    } else if (bias_needs_grad) {
+        bias_grad = &bias_sums.emplace(bias.m_shape, grad.m_dtype);
     }
 
-    if (!in2_grad) {
-        in2_grad = std::make_shared<Tensor>(in2.m_shape);
-        *(in2_grad) = 0;
-    }
+    int64_t N = grad.m_shape.back();
+    dispatch_type(grad.m_dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        T* masked_data = masked ? masked->data_ptr<T>() : nullptr;
+        T* bias_grad_data = bias_grad ? bias_grad->data_ptr<T>() : nullptr;
+        addmm_grad_kernel(grad.data_ptr<T>(), result.data_ptr<T>(), activation, masked_data, bias_grad_data, accumulate,
+                          int64_t(grad.size()) / N, N);
+    });
+
+    if (bias_sums) accumulate_grad(bias, *bias_sums, nullptr, bias_sums->to_element(1));
+    matmul_backward(ctx, in, weight, masked ? *masked : grad);
+}
+
+// Writes the gradients of in1 and in2 from the gradient of in1.mm(in2), computed by the node ctx
+void Tensor::matmul_backward(AutogradContext& ctx, const Tensor& in1, const Tensor& in2, const Tensor& out_grad) {
+    // A half input multiplied with a float one has a float output, whose gradient the gemm rounds
+    // into the half grad buffer of the input
+    auto compute_type = [](Type dtype) { return is_half_precision(dtype) ? Type::FLOAT32 : dtype; };
+    LOG_IF(FATAL, compute_type(in1.m_dtype) != compute_type(out_grad.m_dtype) ||
+                      compute_type(in2.m_dtype) != compute_type(out_grad.m_dtype))
+        << "Matmul backward expects inputs and gradients to share one dtype";
+
+    // Gradients are written slice by slice straight into the grad buffers. Broadcast batch dims
+    // have a 0 stride in the buffer, which sums their contributions, so a fresh buffer is only
+    // zeroed first when that happens
+    auto problem = get_matmul_problem(in1, in2);
+    auto ndims = problem.batch_shape.size();
+    auto grad = get_matmul_operand(out_grad, ndims, !problem.lhs_vector, !problem.rhs_vector);
+
+    auto needs_grad = [&](const Tensor& in) {
+        return in.m_requires_grad && &ctx != in.m_saved_context.get();
+    };
+
+    // Returns whether the gemm has to accumulate into the grad buffer of `in`
+    auto prepare_grad = [&](const Tensor& in, const MatmulOperand& operand) {
+        bool accumulate;
+        Tensor& buffer = grad_buffer(in, accumulate);
+        if (accumulate) return true;
+
+        for (size_t d = 0; d < ndims; d++) {
+            if (problem.batch_shape[d] == 1 || operand.batch_stride[d] != 0) continue;
+            buffer = 0;
+            return true;
+        }
+        return false;
+    };
 
-    if (out.m_saved_context != in1.m_saved_context) {
-        *(in1_grad) = *(in1_grad) + out_grad->mm(in2.transpose());
+    if (needs_grad(in1)) {
+        auto in2_t = get_matmul_operand(in2, ndims, true, !problem.rhs_vector).transposed();
+        auto batch = get_matmul_operand(in1, ndims, !problem.lhs_vector, true);
+        bool accumulate = prepare_grad(in1, batch);
+        gemm_into(*in1.m_saved_context->grad(), accumulate, [&](const Tensor& target, bool accumulate) {
+            auto g1 = get_matmul_operand(target, ndims, !problem.lhs_vector, true);
+            batched_gemm(problem.batch_shape, problem.M, problem.K, problem.N, grad, in2_t, g1, accumulate);
+        });
     }
 
-    if (out.m_saved_context != in2.m_saved_context) {
-        *(in2_grad) = *(in2_grad) + in1.transpose().mm(*(out_grad));
+    if (needs_grad(in2)) {
+        auto in1_t = get_matmul_operand(in1, ndims, !problem.lhs_vector, true).transposed();
+        auto batch = get_matmul_operand(in2, ndims, true, !problem.rhs_vector);
+        bool accumulate = prepare_grad(in2, batch);
+        gemm_into(*in2.m_saved_context->grad(), accumulate, [&](const Tensor& target, bool accumulate) {
+            auto g2 = get_matmul_operand(target, ndims, true, !problem.rhs_vector);
+            batched_gemm(problem.batch_shape, problem.K, problem.N, problem.M, in1_t, grad, g2, accumulate);
+        });
     }
+}
+
+// A view picks elements of its parent without combining them, so its gradient is written as is
+// into the same view of the parent's grad buffer. Elements left out of the view get no gradient.
+void Tensor::view_backward_impl(AutogradContext& ctx, const std::function<Tensor(const Tensor&)>& view_fn) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
+
+    auto& parents = ctx.get_saved_variables();
+
+    LOG_IF(FATAL, parents.size() != 1) << "View backward function expected only 1 parent";
+
+    auto& parent = parents[0];
+    if (!parent.m_requires_grad) return;
+
+    auto& out_grad = *(ctx.grad());
+    bool accumulate;
+    Tensor& buffer = grad_buffer(parent, accumulate);
+    if (buffer.m_expr) buffer.materialize();
+
+    Tensor target = view_fn(buffer);
+    bool covers = target.size() == buffer.size();
+    if (!accumulate && !covers) buffer = 0;
 
-    // align_gradient_with_tensor(in1, *(in1_grad));
-    // align_gradient_with_tensor(in2, *(in2_grad));
+    std::optional<Tensor> promoted;
+    if (out_grad.m_dtype != buffer.m_dtype) promoted = promote(out_grad, buffer.m_dtype);
+    const Tensor& g = promoted ? *promoted : out_grad;
 
-    with_grad();
+    dispatch_type(buffer.m_dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        accumulate_grad_kernel<T, false>(g, nullptr, compute_t<T>(1), false, target, accumulate || !covers);
+    });
 }
 
-void Tensor::sum_backward_impl(Tensor& out) {
-    if (!out.m_requires_grad) return;
+void Tensor::expand_backward_impl(AutogradContext& ctx) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
 
-    LOG_IF(FATAL, !out.m_saved_context->grad()) << "Grad tensor is not initialized";
+    auto& parents = ctx.get_saved_variables();
 
-    auto parents = out.m_saved_context->get_saved_variables();
+    LOG_IF(FATAL, parents.size() != 1) << "Expand backward function expected only 1 parent";
+
+    // Summed over the broadcast dims on the way into the parent's grad buffer
+    auto& out_grad = *(ctx.grad());
+    accumulate_grad(parents[0], out_grad, nullptr, out_grad.to_element(1));
+}
+
+void Tensor::sum_backward_impl(AutogradContext& ctx, const std::vector<bool>& reduced) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
+
+    auto& parents = ctx.get_saved_variables();
 
     LOG_IF(FATAL, parents.size() != 1) << "Sum backward function expected  only 1 parent";
 
-    with_no_grad();
+    // The gradient is spread along the reduced dims by a stride-0 view of it, which keeps the
+    // backward of a lazy chain ending in a sum fusable
+    auto out_grad = ctx.grad()->keep_reduced_dims(reduced).expand(parents[0].m_shape);
+    accumulate_grad(parents[0], out_grad, nullptr, out_grad.to_element(1));
+}
+
+// The gradient of a product is the product of the other elements, out / x as long as none is
+// zero. With a single zero, only that element gets a gradient (the product of the rest); with
+// more, every product of the others is zero.
+template <typename T>
+void prod_backward_kernel(const T* in, const T* grad, T* dst, bool accumulate, const StridedIterator<3>& outer,
+                          const StridedIterator<2>& inner) {
+    using C = compute_t<T>;
+    int64_t n = inner.numel();
+    int64_t grain_size = std::max<int64_t>(1, REDUCTION_GRAIN / n);
+
+    parallel_for(0, outer.numel(), grain_size, [&](int64_t begin, int64_t end) {
+        outer.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+            for (int64_t i = 0; i < count; i++) {
+                const T* src = in + offsets[1] + i * strides[1];
+                T* out = dst + offsets[0] + i * strides[0];
+                C g = grad[offsets[2] + i * strides[2]];
+
+                C nonzero = C(1);
+                int64_t zeros = 0;
+                inner.for_each(0, n, [&](const int64_t* in_offsets, int64_t m, const int64_t* in_strides) {
+                    for (int64_t j = 0; j < m; j++) {
+                        C x = src[in_offsets[1] + j * in_strides[1]];
+                        if (x == C(0)) {
+                            zeros++;
+                        } else {
+                            nonzero *= x;
+                        }
+                    }
+                });
+
+                inner.for_each(0, n, [&](const int64_t* in_offsets, int64_t m, const int64_t* in_strides) {
+                    for (int64_t j = 0; j < m; j++) {
+                        C x = src[in_offsets[1] + j * in_strides[1]];
+                        C value = C(0);
+                        if (zeros == 0) {
+                            value = g * (nonzero / x);
+                        } else if (zeros == 1 && x == C(0)) {
+                            value = g * nonzero;
+                        }
+
+                        T& slot = out[in_offsets[0] + j * in_strides[0]];
+                        slot = T(accumulate ? slot + value : value);
+                    }
+                });
+            }
+        });
+    });
+}
+
+void Tensor::prod_backward_impl(AutogradContext& ctx, const std::vector<bool>& reduced) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
+
+    auto& parents = ctx.get_saved_variables();
+    LOG_IF(FATAL, parents.size() != 1) << "Prod backward function expected only 1 parent";
 
     auto& in = parents[0];
+    if (!in.m_requires_grad) return;
+
+    auto out_grad = ctx.grad()->keep_reduced_dims(reduced);
+    LOG_IF(FATAL, out_grad.m_dtype != in.m_dtype) << "Prod backward expects the input and gradient to share one dtype";
+
+    bool accumulate;
+    Tensor& buffer = grad_buffer(in, accumulate);
+
+    auto [kept_shape, reduced_shape] = split_reduction(in.m_shape, out_grad.m_shape);
+    auto in_strides = in.broadcast_strides(in.m_shape);
+    auto buffer_strides = buffer.broadcast_strides(in.m_shape);
+
+    StridedIterator<3> outer(kept_shape, {buffer_strides, in_strides, out_grad.broadcast_strides(in.m_shape)});
+    StridedIterator<2> inner(reduced_shape, {buffer_strides, in_strides});
+
+    dispatch_type(in.m_dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        prod_backward_kernel(in.data_ptr<T>(), out_grad.data_ptr<T>(), buffer.data_ptr<T>(), accumulate, outer, inner);
+    });
+}
 
-    auto& in_grad = in.m_saved_context->grad();
-    auto& out_grad = out.m_saved_context->grad();
+// The gradient of a max (min) goes to the element it was taken from. indices holds its position
+// in its group, which is unraveled over the reduced dims of the grad buffer
+void Tensor::select_backward_impl(AutogradContext& ctx, const std::vector<bool>& reduced, const Tensor& indices) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
 
-    if (!in_grad) {
-        in_grad = std::make_shared<Tensor>(in.m_shape);
-        *(in_grad) = 0;
+    auto& parents = ctx.get_saved_variables();
+    LOG_IF(FATAL, parents.size() != 1) << "Max/min backward function expected only 1 parent";
+
+    auto& in = parents[0];
+    if (!in.m_requires_grad) return;
+
+    auto out_grad = ctx.grad()->keep_reduced_dims(reduced);
+    LOG_IF(FATAL, out_grad.m_dtype != in.m_dtype)
+        << "Max/min backward expects the input and gradient to share one dtype";
+
+    bool accumulate;
+    Tensor& buffer = grad_buffer(in, accumulate);
+    if (!accumulate) buffer = 0;
+
+    auto [kept_shape, reduced_shape] = split_reduction(in.m_shape, indices.m_shape);
+    auto buffer_strides = buffer.broadcast_strides(in.m_shape);
+    StridedIterator<3> outer(kept_shape, {buffer_strides, out_grad.broadcast_strides(in.m_shape),
+                                          indices.broadcast_strides(in.m_shape)});
+
+    std::vector<int64_t> sizes, strides;
+    for (size_t d = 0; d < reduced_shape.size(); d++) {
+        if (reduced_shape[d] == 1) continue;
+        sizes.push_back(reduced_shape[d]);
+        strides.push_back(buffer_strides[d]);
     }
 
-    *(in_grad) = *(in_grad) + (*out_grad);
+    const uint32_t* index_data = indices.data_ptr<uint32_t>();
+
+    dispatch_type(buffer.m_dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        const T* g = out_grad.data_ptr<T>();
+        T* dst = buffer.data_ptr<T>();
+
+        parallel_for(0, outer.numel(), ELEMENT_WISE_GRAIN, [&](int64_t begin, int64_t end) {
+            outer.for_each(begin, end, [&](const int64_t* offsets, int64_t count, const int64_t* inner_strides) {
+                for (int64_t i = 0; i < count; i++) {
+                    int64_t position = index_data[offsets[2] + i * inner_strides[2]];
+                    int64_t offset = offsets[0] + i * inner_strides[0];
+                    for (int32_t d = int32_t(sizes.size()) - 1; d >= 0; d--) {
+                        offset += position % sizes[d] * strides[d];
+                        position /= sizes[d];
+                    }
+                    dst[offset] += g[offsets[1] + i * inner_strides[1]];
+                }
+            });
+        });
+    });
+}
+
+// The gradient of a cast is the output gradient, which accumulate_grad casts back to the dtype of the input
+void Tensor::cast_backward_impl(AutogradContext& ctx) {
+    LOG_IF(FATAL, !ctx.grad()) << "Grad tensor is not initialized";
+
+    auto& parents = ctx.get_saved_variables();
+
+    LOG_IF(FATAL, parents.size() != 1) << "Cast backward function expected only 1 parent";
 
-    with_grad();
+    auto& out_grad = *(ctx.grad());
+    accumulate_grad(parents[0], out_grad, nullptr, out_grad.to_element(1));
 }
 
 };  // namespace micro
\ No newline at end of file
@@ -0,0 +1,367 @@
+#include "lazy_expr.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "strided_iterator.hpp"
+#include "thread_pool.hpp"
+#include "vectorized.hpp"
+
+namespace micro {
+
+// Element count below which a fused loop runs serially
+constexpr int64_t FUSED_GRAIN = 32768;
+
+// Elements computed per op before moving on to the next one, small enough for every temporary
+// of a fused loop to stay in L1/L2
+constexpr int64_t FUSED_BLOCK = 1024;
+
+// Longest chain of pending ops a lazy tensor may build up before its operands are evaluated
+constexpr uint32_t MAX_FUSED_OPS = 32;
+
+// The unevaluated nodes reading each storage. Guards the readers and watched lists of every
+// node as well, and whether it has been evaluated
+static std::mutex readers_mutex;
+static std::unordered_map<StorageBlock*, std::vector<LazyExpr*>> storage_readers;
+
+// Registers expr as a reader of storage. Called with readers_mutex held
+static void watch_storage(LazyExpr& expr, const Storage& storage) {
+    StorageBlock* block = storage.block();
+    if (!block) return;
+
+    storage_readers[block].push_back(&expr);
+    expr.watched.push_back(block);
+    block->lazy_readers.fetch_add(1, std::memory_order_release);
+}
+
+// Drops every registration of expr as a reader. Called with readers_mutex held
+static void unwatch_storages(LazyExpr& expr) {
+    for (auto* block : expr.watched) {
+        auto it = storage_readers.find(block);
+        auto& readers = it->second;
+        readers.erase(std::find(readers.begin(), readers.end(), &expr));
+        if (readers.empty()) storage_readers.erase(it);
+        block->lazy_readers.fetch_sub(1, std::memory_order_release);
+    }
+    expr.watched.clear();
+}
+
+template <typename T>
+void apply_op(BinaryOp op, const T* in1, bool in1_scalar, const T* in2, bool in2_scalar, T* out, int64_t n) {
+    switch (op) {
+        case BinaryOp::ADD:
+            vec::binary_kernel<vec::Add>(in1, in1_scalar, in2, in2_scalar, out, n);
+            break;
+        case BinaryOp::SUB:
+            vec::binary_kernel<vec::Sub>(in1, in1_scalar, in2, in2_scalar, out, n);
+            break;
+        case BinaryOp::MUL:
+            vec::binary_kernel<vec::Mul>(in1, in1_scalar, in2, in2_scalar, out, n);
+            break;
+        case BinaryOp::DIV:
+            vec::binary_kernel<vec::Div>(in1, in1_scalar, in2, in2_scalar, out, n);
+            break;
+        default:
+            LOG(FATAL) << "Unsupported element wise operation";
+    }
+}
+
+/**
+ * A tree of unevaluated LazyExprs flattened into one loop. Every value of the expression gets a
+ * slot: the inputs (already evaluated tensors) and the result of each instruction. The output is
+ * computed FUSED_BLOCK elements at a time: inputs are read (or gathered through their broadcast
+ * strides) into their slots, then each instruction runs the SIMD element-wise loop from slot to
+ * slot. Nodes reached twice are compiled once, so shared subexpressions are computed once.
+ */
+class FusedKernel {
+   public:
+    explicit FusedKernel(const LazyExpr& root) : m_shape(root.shape), m_dtype(root.dtype) { compile(root); }
+
+    void run(Tensor& out, bool accumulate) const {
+        dispatch_type(m_dtype, [&](auto tag) {
+            using T = typename decltype(tag)::type;
+            run<T>(out, accumulate);
+        });
+    }
+
+   private:
+    struct Input {
+        Tensor tensor;
+        int32_t slot;
+    };
+
+    // slot = lhs <op> rhs, or lhs <op> value when rhs is -1
+    struct Instruction {
+        BinaryOp op;
+        int32_t lhs, rhs;
+        Element value;
+        int32_t slot;
+    };
+
+    int32_t compile(const LazyExpr& expr) {
+        for (auto& [compiled, slot] : m_compiled) {
+            if (compiled == &expr) return slot;
+        }
+
+        int32_t lhs = compile_operand(expr.lhs);
+        int32_t rhs = expr.scalar_rhs ? -1 : compile_operand(expr.rhs);
+        m_instructions.push_back({expr.op, lhs, rhs, expr.value, m_num_slots});
+        m_compiled.push_back({&expr, m_num_slots});
+        return m_num_slots++;
+    }
+
+    // A lazy operand is fused in when it is the unevaluated result of its node as is. Anything
+    // else (a view of a lazy result, another dtype, an evaluated node) becomes an input
+    int32_t compile_operand(const Tensor& t) {
+        auto* expr = t.m_expr.get();
+        if (expr && !expr->evaluated && expr->dtype == m_dtype && t.m_shape == expr->shape && t.m_offset == 0 &&
+            t.is_contiguous()) {
+            return compile(*expr);
+        }
+
+        const char* data = t.data_ptr<char>();
+        for (auto& input : m_inputs) {
+            const Tensor& other = input.tensor;
+            if (other.data_ptr<char>() == data && other.m_dtype == t.m_dtype && other.m_shape == t.m_shape &&
+                other.m_stride == t.m_stride) {
+                return input.slot;
+            }
+        }
+
+        m_inputs.push_back({t, m_num_slots});
+        return m_num_slots++;
+    }
+
+    // Slots hold C values, so 16-bit float expressions are computed in float and rounded once on store
+    template <typename T, typename C = compute_t<T>>
+    void run(Tensor& out, bool accumulate) const {
+        LOG_IF(FATAL, out.m_shape != m_shape || out.m_dtype != m_dtype)
+            << "Fused kernel output must have the expression's shape and dtype";
+
+        constexpr bool same_type = std::is_same_v<T, C>;
+
+        struct InputView {
+            const char* data;
+            Type dtype;
+            bool scalar, direct;
+            C scalar_value;
+            StridedIterator<1> it;
+        };
+
+        std::vector<InputView> inputs;
+        inputs.reserve(m_inputs.size());
+        for (auto& input : m_inputs) {
+            const Tensor& t = input.tensor;
+            bool direct = same_type && t.m_dtype == m_dtype && t.m_shape == m_shape && t.is_contiguous();
+            C scalar_value = C(0);
+            dispatch_type(t.m_dtype, [&](auto tag) {
+                using I = typename decltype(tag)::type;
+                scalar_value = C(T(*t.data_ptr<I>()));
+            });
+            inputs.push_back({t.data_ptr<char>(), t.m_dtype, t.size() == 1, direct, scalar_value,
+                              StridedIterator<1>(m_shape, {t.broadcast_strides(m_shape)})});
+        }
+
+        T* dst = out.data_ptr<T>();
+        bool direct_out = same_type && !accumulate && out.is_contiguous();
+        StridedIterator<1> out_it(m_shape, {out.broadcast_strides(m_shape)});
+
+        auto gather = [](const InputView& view, int64_t begin, int64_t n, C* buffer) {
+            dispatch_type(view.dtype, [&](auto tag) {
+                using I = typename decltype(tag)::type;
+                const I* src = reinterpret_cast<const I*>(view.data);
+                view.it.for_each(begin, begin + n, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+                    for (int64_t i = 0; i < count; i++) *buffer++ = C(T(src[offsets[0] + i * strides[0]]));
+                });
+            });
+        };
+
+        parallel_for(0, out_it.numel(), FUSED_GRAIN, [&](int64_t begin, int64_t end) {
+            std::vector<C> buffers(size_t(m_num_slots) * FUSED_BLOCK);
+            std::vector<const C*> values(m_num_slots);
+            std::vector<char> scalar(m_num_slots, 0);
+
+            for (int64_t block = begin; block < end; block += FUSED_BLOCK) {
+                int64_t n = std::min(FUSED_BLOCK, end - block);
+
+                for (size_t k = 0; k < inputs.size(); k++) {
+                    auto& view = inputs[k];
+                    int32_t slot = m_inputs[k].slot;
+                    scalar[slot] = view.scalar;
+
+                    if (view.scalar) {
+                        values[slot] = &view.scalar_value;
+                    } else if (view.direct) {
+                        values[slot] = reinterpret_cast<const C*>(view.data) + block;
+                    } else {
+                        C* buffer = buffers.data() + slot * FUSED_BLOCK;
+                        gather(view, block, n, buffer);
+                        values[slot] = buffer;
+                    }
+                }
+
+                for (size_t k = 0; k < m_instructions.size(); k++) {
+                    auto& instruction = m_instructions[k];
+                    bool last = k + 1 == m_instructions.size();
+                    C* target = last && direct_out ? reinterpret_cast<C*>(dst) + block
+                                                   : buffers.data() + instruction.slot * FUSED_BLOCK;
+
+                    C value = instruction.value;
+                    const C* rhs = instruction.rhs < 0 ? &value : values[instruction.rhs];
+                    bool rhs_scalar = instruction.rhs < 0 || scalar[instruction.rhs];
+
+                    apply_op(instruction.op, values[instruction.lhs], scalar[instruction.lhs], rhs, rhs_scalar,
+                             target, n);
+                    values[instruction.slot] = target;
+                }
+
+                if (direct_out) continue;
+
+                const C* result = values[m_instructions.back().slot];
+                out_it.for_each(block, block + n, [&](const int64_t* offsets, int64_t count, const int64_t* strides) {
+                    for (int64_t i = 0; i < count; i++) {
+                        T& slot = dst[offsets[0] + i * strides[0]];
+                        slot = T(accumulate ? C(slot) + *result : *result);
+                        result++;
+                    }
+                });
+            }
+        });
+    }
+
+   private:
+    std::vector<uint32_t> m_shape;
+    Type m_dtype;
+
+    std::vector<Input> m_inputs;
+    std::vector<Instruction> m_instructions;
+    std::vector<std::pair<const LazyExpr*, int32_t>> m_compiled;
+    int32_t m_num_slots = 0;
+};
+
+Tensor Tensor::lazy_op(BinaryOp op, const Tensor& lhs, const Tensor& rhs) {
+    auto expr = std::make_shared<LazyExpr>();
+    expr->op = op;
+    expr->lhs = lhs;
+    expr->rhs = rhs;
+    expr->shape = broadcast_shapes(lhs.m_shape, rhs.m_shape);
+    expr->dtype = get_output_type(lhs.m_dtype, rhs.m_dtype);
+    return from_expr(std::move(expr));
+}
+
+Tensor Tensor::lazy_scalar_op(BinaryOp op, const Tensor& in, Element value) {
+    auto expr = std::make_shared<LazyExpr>();
+    expr->op = op;
+    expr->lhs = in;
+    expr->scalar_rhs = true;
+    expr->value = value;
+    expr->shape = in.m_shape;
+    expr->dtype = in.m_dtype;
+    return from_expr(std::move(expr));
+}
+
+Tensor Tensor::from_expr(std::shared_ptr<LazyExpr> expr) {
+    auto pending_ops = [](const Tensor& t) -> uint32_t {
+        return t.m_expr && !t.m_expr->evaluated ? t.m_expr->num_ops : 0;
+    };
+
+    expr->num_ops = 1 + pending_ops(expr->lhs) + (expr->scalar_rhs ? 0 : pending_ops(expr->rhs));
+    if (expr->num_ops > MAX_FUSED_OPS) {
+        expr->lhs.materialize();
+        if (!expr->scalar_rhs) expr->rhs.materialize();
+        expr->num_ops = 1;
+    }
+
+    {
+        // An unevaluated operand hands its readers over to its result once it has one
+        std::lock_guard<std::mutex> lock(readers_mutex);
+        auto watch = [&](const Tensor& operand) {
+            auto* source = operand.m_expr.get();
+            if (source && !source->evaluated) {
+                source->readers.push_back(expr);
+            } else {
+                watch_storage(*expr, source ? source->result : operand.m_storage);
+            }
+        };
+
+        watch(expr->lhs);
+        if (!expr->scalar_rhs) watch(expr->rhs);
+    }
+
+    Tensor out;
+    out.m_dtype = expr->dtype;
+    out.m_shape = expr->shape;
+    out.set_default_strides();
+    out.m_expr = std::move(expr);
+    return out;
+}
+
+LazyExpr::~LazyExpr() {
+    if (watched.empty()) return;
+
+    std::lock_guard<std::mutex> lock(readers_mutex);
+    unwatch_storages(*this);
+}
+
+void LazyExpr::evaluate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (evaluated) return;
+
+    Tensor out(shape, dtype);
+    Tensor::fused_forward_impl(*this, out, false);
+
+    // Readers are only released once readers_mutex is no longer held, as dropping the last
+    // reference to one unregisters it
+    std::vector<std::shared_ptr<LazyExpr>> pending;
+    {
+        std::lock_guard<std::mutex> readers_lock(readers_mutex);
+        result = std::move(out.m_storage);
+        unwatch_storages(*this);
+
+        for (auto& weak_reader : readers) {
+            auto reader = weak_reader.lock();
+            if (!reader || reader->evaluated) continue;
+            watch_storage(*reader, result);
+            pending.push_back(std::move(reader));
+        }
+        readers.clear();
+        evaluated = true;
+    }
+
+    lhs = Tensor();
+    rhs = Tensor();
+}
+
+void Tensor::materialize() const {
+    if (!m_expr) return;
+    auto expr = std::move(m_expr);
+
+    expr->evaluate();
+    m_storage = expr->result;
+}
+
+void Tensor::evaluate_pending_readers() const {
+    if (m_expr) materialize();
+
+    StorageBlock* block = m_storage.block();
+    if (!block || block->lazy_readers.load(std::memory_order_acquire) == 0) return;
+
+    std::vector<std::shared_ptr<LazyExpr>> readers;
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex);
+        auto it = storage_readers.find(block);
+        if (it == storage_readers.end()) return;
+
+        for (auto* expr : it->second) {
+            if (auto reader = expr->weak_from_this().lock()) readers.push_back(std::move(reader));
+        }
+    }
+
+    for (auto& reader : readers) reader->evaluate();
+}
+
+void Tensor::fused_forward_impl(const LazyExpr& expr, Tensor& out, bool accumulate) {
+    FusedKernel(expr).run(out, accumulate);
+}
+
+};  // namespace micro
@@ -0,0 +1,49 @@
+#include "linear.hpp"
+
+#include <cmath>
+#include <random>
+
+namespace micro {
+namespace nn {
+
+// A tensor of shape filled uniformly in [-bound, bound], in dtype
+static Tensor uniform(std::vector<uint32_t> shape, float bound, std::mt19937_64& generator, Type dtype) {
+    Tensor values(std::move(shape));
+    std::vector<Element> elements(values.size());
+    std::uniform_real_distribution<float> distribution(-bound, bound);
+    for (auto& element : elements) element = distribution(generator);
+    values = elements;
+
+    Tensor t = dtype == Type::FLOAT32 ? values : values.to(dtype);
+    t.requires_grad(true);
+    return t;
+}
+
+Linear::Linear(uint32_t in_features, uint32_t out_features, Activation activation, uint64_t seed, Type dtype)
+    : m_activation(activation) {
+    LOG_IF(FATAL, in_features == 0 || out_features == 0) << "Linear layers need at least one input and one output";
+
+    std::mt19937_64 generator(seed);
+    float bound = 1.f / std::sqrt(float(in_features));
+    weight = uniform({in_features, out_features}, bound, generator, dtype);
+    bias = uniform({out_features}, bound, generator, dtype);
+}
+
+TensorDict Linear::parameters(const std::string& prefix) const {
+    return {{prefix + "weight", weight}, {prefix + "bias", bias}};
+}
+
+void Linear::load_parameters(const TensorDict& parameters, const std::string& prefix) {
+    NoGradGuard no_grad;
+    for (auto [name, param] : {std::make_pair("weight", &weight), std::make_pair("bias", &bias)}) {
+        auto it = parameters.find(prefix + name);
+        LOG_IF(FATAL, it == parameters.end()) << "No parameter named " << prefix + name;
+        LOG_IF(FATAL, it->second.size() != param->size())
+            << "Parameter " << prefix + name << " has " << it->second.size() << " elements, expected "
+            << param->size();
+        param->copy_from(it->second);
+    }
+}
+
+};  // namespace nn
+};  // namespace micro
@@ -0,0 +1,152 @@
+#include "quantization.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+#include "graph_capture.hpp"
+
+namespace micro {
+
+// The values an INT8 or UINT8 tensor holds
+static std::pair<int32_t, int32_t> quantized_range(Type dtype) {
+    LOG_IF(FATAL, !is_8bit(dtype)) << "Tensors are quantized to int8 or uint8, not " << dtype;
+    if (dtype == Type::INT8) return {std::numeric_limits<int8_t>::lowest(), std::numeric_limits<int8_t>::max()};
+    return {std::numeric_limits<uint8_t>::lowest(), std::numeric_limits<uint8_t>::max()};
+}
+
+QuantParams QuantParams::from_range(float min, float max, Type dtype, bool symmetric) {
+    auto [qmin, qmax] = quantized_range(dtype);
+    LOG_IF(FATAL, !(min <= max)) << "Quantization range [" << min << ", " << max << "] is empty";
+
+    if (symmetric) {
+        float bound = std::max(std::abs(min), std::abs(max));
+        float scale = bound > 0.f ? bound / (float(qmax - qmin) / 2.f) : 1.f;
+        return QuantParams(scale, dtype == Type::INT8 ? 0 : (qmax + 1) / 2);
+    }
+
+    min = std::min(min, 0.f);
+    max = std::max(max, 0.f);
+    float scale = (max - min) / float(qmax - qmin);
+    if (scale == 0.f) scale = 1.f;
+
+    int32_t zero_point = std::clamp(qmin - int32_t(std::nearbyint(min / scale)), qmin, qmax);
+    return QuantParams(scale, zero_point);
+}
+
+QuantParams QuantParams::per_channel_from(const Tensor& t, uint32_t axis, Type dtype, bool symmetric) {
+    LOG_IF(FATAL, axis >= t.m_shape.size()) << "Can't quantize along non-existing dimension " << axis;
+
+    // The range of every channel is reduced over the other dims; a 1-d tensor is its own range
+    Tensor mins = t.to(Type::FLOAT32), maxs = mins;
+    if (t.m_shape.size() > 1) {
+        NoGradGuard no_grad;
+        std::vector<uint32_t> dims;
+        for (uint32_t d = 0; d < t.m_shape.size(); d++) {
+            if (d != axis) dims.push_back(d);
+        }
+        mins = mins.min(dims);
+        maxs = maxs.max(dims);
+    }
+
+    QuantParams params({}, {}, axis);
+    const Tensor& channel_mins = mins;
+    const Tensor& channel_maxs = maxs;
+    for (uint32_t c = 0; c < t.m_shape[axis]; c++) {
+        auto channel = from_range(channel_mins[{c}], channel_maxs[{c}], dtype, symmetric);
+        params.scales.push_back(channel.scales[0]);
+        params.zero_points.push_back(channel.zero_points[0]);
+    }
+    return params;
+}
+
+Tensor Calibrator::observe(const std::string& name, const Tensor& t) {
+    NoGradGuard no_grad;
+    const Tensor min = t.min().to(Type::FLOAT32), max = t.max().to(Type::FLOAT32);
+    float lo = min[{0}], hi = max[{0}];
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto [it, inserted] = m_ranges.try_emplace(name, lo, hi);
+    if (!inserted) {
+        it->second.first = std::min(it->second.first, lo);
+        it->second.second = std::max(it->second.second, hi);
+    }
+    return t;
+}
+
+std::pair<float, float> Calibrator::range(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_ranges.find(name);
+    LOG_IF(FATAL, it == m_ranges.end()) << "No activation named " << name << " was observed";
+    return it->second;
+}
+
+QuantParams Calibrator::params(const std::string& name, Type dtype, bool symmetric) const {
+    auto [min, max] = range(name);
+    return QuantParams::from_range(min, max, dtype, symmetric);
+}
+
+std::string QuantParams::check(const std::vector<uint32_t>& shape, Type dtype) const {
+    std::ostringstream error;
+    if (!is_8bit(dtype)) {
+        error << "Tensors are quantized to int8 or uint8, not " << dtype;
+        return error.str();
+    }
+    auto [qmin, qmax] = quantized_range(dtype);
+
+    size_t channels = 1;
+    if (axis < -1 || (per_channel() && size_t(axis) >= shape.size())) {
+        error << "Can't quantize along non-existing dimension " << axis;
+        return error.str();
+    }
+    if (per_channel()) channels = shape[axis];
+
+    if (scales.size() != channels || zero_points.size() != channels) {
+        error << "Quantization needs " << channels << " scales and zero points, got " << scales.size() << " and "
+              << zero_points.size();
+        return error.str();
+    }
+
+    for (size_t c = 0; c < channels; c++) {
+        if (!(scales[c] > 0.f) || !std::isfinite(scales[c])) {
+            error << "Quantization scale " << scales[c] << " is not a positive number";
+            return error.str();
+        }
+        if (zero_points[c] < qmin || zero_points[c] > qmax) {
+            error << "Zero point " << zero_points[c] << " is out of the range of " << dtype;
+            return error.str();
+        }
+    }
+    return "";
+}
+
+Tensor Tensor::quantize(const QuantParams& params, Type dtype) const {
+    auto error = params.check(m_shape, dtype);
+    LOG_IF(FATAL, !error.empty()) << error;
+
+    // Quantization reads floats; to() records its cast when a step is being captured
+    Tensor in = m_dtype == Type::FLOAT32 ? *this : to(Type::FLOAT32);
+    Tensor out(m_shape, dtype);
+    out.m_quant = std::make_shared<const QuantParams>(params);
+
+    quantize_impl(in, out);
+    if (is_capturing()) record_replay([in, out]() mutable { quantize_impl(in, out); });
+    return out;
+}
+
+Tensor Tensor::dequantize() const {
+    LOG_IF(FATAL, !m_quant) << "Only quantized tensors can be dequantized";
+
+    Tensor out(m_shape, Type::FLOAT32);
+    dequantize_impl(*this, out);
+    if (is_capturing()) record_replay([in = *this, out]() mutable { dequantize_impl(in, out); });
+    return out;
+}
+
+const QuantParams& Tensor::quant_params() const {
+    LOG_IF(FATAL, !m_quant) << "Tensor is not quantized";
+    return *m_quant;
+}
+
+};  // namespace micro
@@ -0,0 +1,259 @@
+#include "serialization.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "quantization.hpp"
+
+namespace micro {
+
+static constexpr char MAGIC[8] = {'M', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+static constexpr uint32_t VERSION = 1;
+// Tensor data starts on cache lines, where the kernels expect a fresh Storage to start
+static constexpr uint64_t DATA_ALIGNMENT = 64;
+
+static uint64_t align_data(uint64_t offset) { return (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT; }
+
+template <typename T>
+static void put(std::string& header, const T& value) {
+    header.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Reads the header of a checkpoint, failing on any field that runs past the end of the file
+class HeaderReader {
+   public:
+    HeaderReader(const char* data, uint64_t size, const std::string& path) : m_data(data), m_size(size), m_path(path) {}
+
+    const char* take(uint64_t bytes) {
+        LOG_IF(FATAL, bytes > m_size - m_position) << m_path << " is truncated";
+        const char* field = m_data + m_position;
+        m_position += bytes;
+        return field;
+    }
+
+    template <typename T>
+    T get() {
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+   private:
+    const char* m_data;
+    uint64_t m_size, m_position = 0;
+    const std::string& m_path;
+};
+
+void save(const std::string& path, const TensorDict& tensors) {
+    // Views are written as the elements they cover, in row-major order
+    std::vector<std::pair<std::string, Tensor>> contiguous;
+    {
+        NoGradGuard no_grad;
+        for (const auto& [name, t] : tensors) {
+            LOG_IF(FATAL, t.m_shape.size() > UINT8_MAX) << "Tensor " << name << " has too many dims to save";
+            contiguous.emplace_back(name, t.contiguous());
+        }
+    }
+
+    // The header of the checkpoint, with the data of tensor i at offsets[i]
+    auto encode_header = [&](const std::vector<uint64_t>& offsets) {
+        std::string header(MAGIC, sizeof(MAGIC));
+        put(header, VERSION);
+        put(header, uint32_t(contiguous.size()));
+
+        for (size_t i = 0; i < contiguous.size(); i++) {
+            const auto& [name, t] = contiguous[i];
+            put(header, uint32_t(name.size()));
+            header += name;
+
+            put(header, uint8_t(t.m_dtype));
+            put(header, uint8_t(t.m_shape.size()));
+            for (auto dim : t.m_shape) put(header, dim);
+            for (auto dim : t.m_stride) put(header, dim);
+            put(header, offsets[i]);
+            put(header, uint64_t(t.number_bytes()));
+
+            put(header, uint8_t(t.is_quantized()));
+            if (!t.is_quantized()) continue;
+            const QuantParams& params = t.quant_params();
+            put(header, params.axis);
+            put(header, uint32_t(params.scales.size()));
+            for (auto scale : params.scales) put(header, scale);
+            for (auto zero_point : params.zero_points) put(header, zero_point);
+        }
+        return header;
+    };
+
+    // Every field of the header has a fixed width, so its size doesn't depend on the offsets
+    std::vector<uint64_t> offsets(contiguous.size());
+    uint64_t offset = align_data(encode_header(offsets).size());
+    for (size_t i = 0; i < contiguous.size(); i++) {
+        offsets[i] = offset;
+        offset = align_data(offset + contiguous[i].second.number_bytes());
+    }
+    const std::string header = encode_header(offsets);
+
+    const std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    LOG_IF(FATAL, !file) << "Can't open " << temporary << " for writing: " << std::strerror(errno);
+
+    file.write(header.data(), header.size());
+    uint64_t written = header.size();
+    const char padding[DATA_ALIGNMENT] = {};
+    for (size_t i = 0; i < contiguous.size(); i++) {
+        const Tensor& t = contiguous[i].second;
+        file.write(padding, offsets[i] - written);
+        if (t.number_bytes()) file.write(t.data_ptr<char>(), t.number_bytes());
+        written = offsets[i] + t.number_bytes();
+    }
+
+    file.close();
+    LOG_IF(FATAL, !file) << "Failed writing " << temporary << ": " << std::strerror(errno);
+    LOG_IF(FATAL, std::rename(temporary.c_str(), path.c_str()) != 0)
+        << "Can't move " << temporary << " to " << path << ": " << std::strerror(errno);
+}
+
+// The whole file at path in memory, released when the last copy of the pointer is dropped
+static std::shared_ptr<char> map_file(const std::string& path, uint64_t& size) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    LOG_IF(FATAL, fd < 0) << "Can't open " << path << ": " << std::strerror(errno);
+
+    struct stat status;
+    LOG_IF(FATAL, ::fstat(fd, &status) != 0) << "Can't stat " << path << ": " << std::strerror(errno);
+    size = status.st_size;
+    LOG_IF(FATAL, size == 0) << path << " is empty";
+
+    // A private writable mapping: pages stay shared with the file until a tensor writes to them
+    void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    LOG_IF(FATAL, data == MAP_FAILED) << "Can't map " << path << ": " << std::strerror(errno);
+
+    return std::shared_ptr<char>(static_cast<char*>(data), [size](char* data) { ::munmap(data, size); });
+#else
+    // No mmap here: read the file into memory aligned like a mapping would be
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    LOG_IF(FATAL, !file) << "Can't open " << path << ": " << std::strerror(errno);
+    size = file.tellg();
+    LOG_IF(FATAL, size == 0) << path << " is empty";
+
+    auto* data = static_cast<char*>(::operator new(size, std::align_val_t(DATA_ALIGNMENT)));
+    std::shared_ptr<char> memory(data, [](char* data) { ::operator delete(data, std::align_val_t(DATA_ALIGNMENT)); });
+    file.seekg(0);
+    file.read(data, size);
+    LOG_IF(FATAL, !file) << "Failed reading " << path;
+    return memory;
+#endif
+}
+
+TensorDict load(const std::string& path) {
+    uint64_t size = 0;
+    std::shared_ptr<char> file = map_file(path, size);
+
+    HeaderReader header(file.get(), size, path);
+    LOG_IF(FATAL, std::memcmp(header.take(sizeof(MAGIC)), MAGIC, sizeof(MAGIC)) != 0) << path << " is not a checkpoint";
+    auto version = header.get<uint32_t>();
+    LOG_IF(FATAL, version != VERSION) << path << " has checkpoint version " << version << ", expected " << VERSION;
+
+    TensorDict tensors;
+    auto count = header.get<uint32_t>();
+    for (uint32_t i = 0; i < count; i++) {
+        auto name_size = header.get<uint32_t>();
+        std::string name(header.take(name_size), name_size);
+
+        Tensor t;
+        auto dtype = header.get<uint8_t>();
+        LOG_IF(FATAL, dtype >= NUM_TYPES) << "Tensor " << name << " in " << path << " has unknown dtype " << +dtype;
+        t.m_dtype = Type(dtype);
+
+        t.m_shape.resize(header.get<uint8_t>());
+        t.m_stride.resize(t.m_shape.size());
+        for (auto& dim : t.m_shape) dim = header.get<uint32_t>();
+        for (auto& dim : t.m_stride) dim = header.get<uint32_t>();
+        auto offset = header.get<uint64_t>();
+        auto bytes = header.get<uint64_t>();
+
+        // The strides must keep every element inside the bytes of the tensor
+        uint64_t extent = 1;
+        for (size_t d = 0; d < t.m_shape.size(); d++) {
+            if (t.m_shape[d] == 0) extent = 0;
+            if (extent) extent += uint64_t(t.m_shape[d] - 1) * t.m_stride[d];
+        }
+        LOG_IF(FATAL, extent * element_size(t.m_dtype) > bytes || bytes > UINT32_MAX || offset % DATA_ALIGNMENT ||
+                          offset > size || bytes > size - offset)
+            << "Tensor " << name << " in " << path << " is corrupted";
+
+        if (header.get<uint8_t>()) {
+            QuantParams params;
+            params.axis = header.get<int32_t>();
+            auto channels = header.get<uint32_t>();
+
+            // Taken before sizing the params, so a bogus channel count fails as a truncated file
+            const char* scales = header.take(uint64_t(channels) * sizeof(float));
+            const char* zero_points = header.take(uint64_t(channels) * sizeof(int32_t));
+            params.scales.resize(channels);
+            params.zero_points.resize(channels);
+            std::memcpy(params.scales.data(), scales, channels * sizeof(float));
+            std::memcpy(params.zero_points.data(), zero_points, channels * sizeof(int32_t));
+
+            auto error = params.check(t.m_shape, t.m_dtype);
+            LOG_IF(FATAL, !error.empty()) << "Tensor " << name << " in " << path << " is corrupted: " << error;
+            t.m_quant = std::make_shared<const QuantParams>(std::move(params));
+        }
+
+        // Each tensor borrows its bytes of the file, which stays mapped while any of them is alive
+        if (bytes) {
+            t.m_storage = Storage(file.get() + offset, uint32_t(bytes), [file]() {});
+        } else {
+            t.m_storage = Storage(0);
+        }
+
+        LOG_IF(FATAL, !tensors.emplace(std::move(name), std::move(t)).second)
+            << path << " holds two tensors with the same name";
+    }
+    return tensors;
+}
+
+Tensor load_raw(const std::string& path, std::vector<uint32_t> shape, Type dtype, uint64_t offset) {
+    uint64_t size = 0;
+    std::shared_ptr<char> file = map_file(path, size);
+
+    Tensor t;
+    t.m_dtype = dtype;
+    t.m_shape = std::move(shape);
+    t.set_default_strides();
+    uint64_t bytes = uint64_t(t.size()) * element_size(dtype);
+    LOG_IF(FATAL, offset > size || bytes > size - offset)
+        << path << " holds " << size << " bytes, too few for " << bytes << " bytes at offset " << offset;
+    LOG_IF(FATAL, bytes == 0 || bytes > UINT32_MAX) << "Can't map " << bytes << " bytes of " << path << " as a tensor";
+
+    t.m_storage = Storage(file.get() + offset, uint32_t(bytes), [file]() {});
+    return t;
+}
+
+std::future<void> save_async(const std::string& path, const TensorDict& tensors) {
+    TensorDict snapshot;
+    {
+        NoGradGuard no_grad;
+        for (const auto& [name, t] : tensors) {
+            Tensor copy(t.m_shape, t.m_dtype);
+            copy.copy_from(t);
+            copy.m_quant = t.m_quant;
+            snapshot.emplace(name, std::move(copy));
+        }
+    }
+
+    return std::async(std::launch::async, [path, snapshot = std::move(snapshot)]() { save(path, snapshot); });
+}
+
+};  // namespace micro
@@ -1,12 +1,26 @@
 #include "tensor.hpp"
 
+#include "backward_plan.hpp"
+#include "graph_capture.hpp"
+#include "lazy_expr.hpp"
+
 namespace micro {
 
-static bool enable_global_grad = true;
+static thread_local bool grad_enabled = true;
+
+void with_no_grad() { grad_enabled = false; }
+
+void with_grad() { grad_enabled = true; }
+
+bool is_grad_enabled() { return grad_enabled; }
 
-void with_no_grad() { enable_global_grad = false; }
+static thread_local bool lazy_enabled = false;
 
-void with_grad() { enable_global_grad = true; }
+void with_lazy() { lazy_enabled = true; }
+
+void with_eager() { lazy_enabled = false; }
+
+bool is_lazy_enabled() { return lazy_enabled; }
 
 std::ostream& operator<<(std::ostream& os, const Type& type) {
 #define ToOStream(type, st) \
@@ -18,6 +32,10 @@ std::ostream& operator<<(std::ostream& os, const Type& type) {
         ToOStream(Type::UINT32, uint32);
         ToOStream(Type::INT32, int32);
         ToOStream(Type::FLOAT32, float32);
+        ToOStream(Type::FLOAT16, float16);
+        ToOStream(Type::BFLOAT16, bfloat16);
+        ToOStream(Type::INT8, int8);
+        ToOStream(Type::UINT8, uint8);
         ToOStream(Type::UNKONWN, unknown);
         default:
             break;
@@ -38,6 +56,24 @@ size_t Tensor::size() const {
     return size;
 }
 
+bool Tensor::is_contiguous() const {
+    uint32_t expected_stride = 1;
+    for (int32_t i = int32_t(m_shape.size()) - 1; i >= 0; i--) {
+        if (m_shape[i] != 1 && m_stride[i] != expected_stride) return false;
+        expected_stride *= m_shape[i];
+    }
+
+    return true;
+}
+
+bool Tensor::is_expanded() const {
+    for (size_t i = 0; i < m_shape.size(); i++) {
+        if (m_shape[i] > 1 && m_stride[i] == 0) return true;
+    }
+
+    return false;
+}
+
 void Tensor::set_default_strides() {
     LOG_IF(FATAL, m_shape.size() == 0);
 
@@ -55,12 +91,18 @@ Tensor Tensor::grad() {
     return *(m_saved_context->grad());
 }
 
+void Tensor::requires_grad(bool requires_grad) {
+    LOG_IF(FATAL, m_saved_context && m_saved_context->grad_fn())
+        << "you can only change requires_grad flags of leaf variables";
+    m_requires_grad = requires_grad;
+}
+
 void Tensor::reset_grad() {
     LOG_IF(FATAL, !m_saved_context) << "Trying to read gradients from a tensor without gradients";
     m_saved_context->grad() = nullptr;
 }
 
-Element& Tensor::operator[](const std::vector<uint32_t>& indices) {
+uint32_t Tensor::element_offset(const std::vector<uint32_t>& indices) const {
     LOG_IF(FATAL, indices.size() != m_shape.size())
         << "Indices size=" << indices.size() << " don't match the full_shape=" << m_shape.size();
     uint32_t offset = 0, i = 0;
@@ -71,145 +113,364 @@ Element& Tensor::operator[](const std::vector<uint32_t>& indices) {
         i++;
     }
 
-    return this->operator[](offset);
+    return offset;
 }
 
+Element& Tensor::operator[](const std::vector<uint32_t>& indices) { return this->operator[](element_offset(indices)); }
+
 Tensor Tensor::operator+(const Tensor& other) const {
-    Tensor out = get_element_wise_empty_output(*this, other);
-    add_forward_impl(*this, other, out);
+    Tensor out = lazy_enabled ? lazy_op(BinaryOp::ADD, *this, other) : get_element_wise_empty_output(*this, other);
+    if (!lazy_enabled) add_forward_impl(*this, other, out);
+    if (is_capturing()) record_replay([in1 = *this, in2 = other, out]() mutable { add_forward_impl(in1, in2, out); });
 
-    if (!enable_global_grad || !(this->m_requires_grad || other.m_requires_grad)) return out;
+    if (!grad_enabled || !(this->m_requires_grad || other.m_requires_grad)) return out;
 
     out.m_saved_context->save_for_backward({*this, other});
     out.m_requires_grad = true;
-    out.m_grad_fn = add_backward_impl;
+    out.m_saved_context->set_grad_fn(add_backward_impl);
     return out;
 }
 
 Tensor Tensor::operator-(const Tensor& other) const {
-    Tensor out = get_element_wise_empty_output(*this, other);
-    sub_forward_impl(*this, other, out);
+    Tensor out = lazy_enabled ? lazy_op(BinaryOp::SUB, *this, other) : get_element_wise_empty_output(*this, other);
+    if (!lazy_enabled) sub_forward_impl(*this, other, out);
+    if (is_capturing()) record_replay([in1 = *this, in2 = other, out]() mutable { sub_forward_impl(in1, in2, out); });
 
-    if (!enable_global_grad || !(this->m_requires_grad || other.m_requires_grad)) return out;
+    if (!grad_enabled || !(this->m_requires_grad || other.m_requires_grad)) return out;
 
     out.m_saved_context->save_for_backward({*this, other});
     out.m_requires_grad = true;
-    out.m_grad_fn = sub_backward_impl;
+    out.m_saved_context->set_grad_fn(sub_backward_impl);
     return out;
 }
 
 Tensor Tensor::operator*(const Tensor& other) const {
-    Tensor out = get_element_wise_empty_output(*this, other);
-    mul_forward_impl(*this, other, out);
+    Tensor out = lazy_enabled ? lazy_op(BinaryOp::MUL, *this, other) : get_element_wise_empty_output(*this, other);
+    if (!lazy_enabled) mul_forward_impl(*this, other, out);
+    if (is_capturing()) record_replay([in1 = *this, in2 = other, out]() mutable { mul_forward_impl(in1, in2, out); });
 
-    if (!enable_global_grad || !(this->m_requires_grad || other.m_requires_grad)) return out;
+    if (!grad_enabled || !(this->m_requires_grad || other.m_requires_grad)) return out;
 
     out.m_saved_context->save_for_backward({*this, other});
     out.m_requires_grad = true;
-    out.m_grad_fn = mul_backward_impl;
+    out.m_saved_context->set_grad_fn(mul_backward_impl);
     return out;
 }
 
 Tensor Tensor::operator/(const Tensor& other) const {
-    Tensor out = get_element_wise_empty_output(*this, other);
-    div_forward_impl(*this, other, out);
+    Tensor out = lazy_enabled ? lazy_op(BinaryOp::DIV, *this, other) : get_element_wise_empty_output(*this, other);
+    if (!lazy_enabled) div_forward_impl(*this, other, out);
+    if (is_capturing()) record_replay([in1 = *this, in2 = other, out]() mutable { div_forward_impl(in1, in2, out); });
 
-    if (!enable_global_grad || !(this->m_requires_grad || other.m_requires_grad)) return out;
+    if (!grad_enabled || !(this->m_requires_grad || other.m_requires_grad)) return out;
 
     out.m_saved_context->save_for_backward({*this, other});
     out.m_requires_grad = true;
-    out.m_grad_fn = div_backward_impl;
+    out.m_saved_context->set_grad_fn(div_backward_impl);
+    return out;
+}
+
+Tensor Tensor::scalar_op(BinaryOp op, Element value) const {
+    Tensor out = lazy_enabled ? lazy_scalar_op(op, *this, value) : Tensor(m_shape, m_dtype);
+    if (!lazy_enabled) scalar_forward_impl(op, *this, value, out);
+    if (is_capturing()) {
+        record_replay([op, in = *this, value, out]() mutable { scalar_forward_impl(op, in, value, out); });
+    }
+
+    if (!grad_enabled || !this->m_requires_grad) return out;
+
+    out.m_saved_context->save_for_backward({*this});
+    out.m_requires_grad = true;
+    out.m_saved_context->set_grad_fn([op, value](AutogradContext& ctx) { scalar_backward_impl(ctx, op, value); });
     return out;
 }
 
+void Tensor::operator+=(const Tensor& other) { inplace_op(BinaryOp::ADD, other); }
+
+void Tensor::operator-=(const Tensor& other) { inplace_op(BinaryOp::SUB, other); }
+
+void Tensor::operator*=(const Tensor& other) { inplace_op(BinaryOp::MUL, other); }
+
+void Tensor::operator/=(const Tensor& other) { inplace_op(BinaryOp::DIV, other); }
+
+void Tensor::inplace_op(BinaryOp op, const Tensor& other) {
+    LOG_IF(FATAL, is_expanded()) << "Can't write to an expanded view";
+    LOG_IF(FATAL, broadcast_shapes(m_shape, other.m_shape) != m_shape)
+        << "In-place op can't broadcast its output to another shape";
+    evaluate_pending_readers();
+
+    binary_forward_impl(op, *this, other, *this);
+    if (is_capturing()) record_replay([op, out = *this, other]() mutable { binary_forward_impl(op, out, other, out); });
+}
+
+void Tensor::inplace_scalar_op(BinaryOp op, Element value) {
+    LOG_IF(FATAL, is_expanded()) << "Can't write to an expanded view";
+    evaluate_pending_readers();
+    scalar_forward_impl(op, *this, value, *this);
+    if (is_capturing()) record_replay([op, out = *this, value]() mutable { scalar_forward_impl(op, out, value, out); });
+}
+
+void Tensor::copy_from(const Tensor& src) {
+    LOG_IF(FATAL, is_expanded()) << "Can't write to an expanded view";
+    evaluate_pending_readers();
+    cast_impl(src, *this);
+    if (is_capturing()) record_replay([src, out = *this]() mutable { cast_impl(src, out); });
+}
+
 Tensor Tensor::mm(const Tensor& other) const {
     Tensor out = get_matmul_empty_output(*this, other);
     matmul_forward_impl(*this, other, out);
-    if (!enable_global_grad || !(this->m_requires_grad || other.m_requires_grad)) return out;
+    if (is_capturing()) {
+        record_replay([in1 = *this, in2 = other, out]() mutable { matmul_forward_impl(in1, in2, out); });
+    }
+
+    if (!grad_enabled || !(this->m_requires_grad || other.m_requires_grad)) return out;
 
     out.m_saved_context->save_for_backward({*this, other});
     out.m_requires_grad = true;
-    out.m_grad_fn = matmul_backward_impl;
+    out.m_saved_context->set_grad_fn(matmul_backward_impl);
 
     return out;
 }
 
-Tensor Tensor::sum(uint32_t dim, bool keep_dims) const {
-    auto out_shape = this->m_shape;
-    LOG_IF(FATAL, dim >= (uint32_t)out_shape.size()) << "Trying to sum over non-existing dimension";
+Tensor Tensor::addmm(const Tensor& weight, const Tensor& bias, Activation activation) const {
+    LOG_IF(FATAL, is_8bit(m_dtype) || is_8bit(weight.m_dtype))
+        << "addmm doesn't take 8-bit inputs, multiply quantized tensors with mm";
+    LOG_IF(FATAL, weight.m_shape.size() < 2 || bias.m_shape != std::vector<uint32_t>{weight.m_shape.back()})
+        << "addmm needs a bias with one element per column of the weight";
+
+    Tensor out = get_matmul_empty_output(*this, weight);
+    addmm_forward_impl(*this, weight, &bias, activation, out);
+    if (is_capturing()) {
+        record_replay([in = *this, weight, bias, activation, out]() mutable {
+            addmm_forward_impl(in, weight, &bias, activation, out);
+        });
+    }
 
-    out_shape[dim] = 1;
+    if (!grad_enabled || !(m_requires_grad || weight.m_requires_grad || bias.m_requires_grad)) return out;
 
-    Tensor out(out_shape, this->m_dtype);
+    // The derivative of the activation is read from the result, saved without its autograd node
+    // so that the node doesn't own itself
+    std::vector<Tensor> saved{*this, weight, bias};
+    if (activation != Activation::NONE) {
+        Tensor result = out;
+        result.m_saved_context = std::make_shared<AutogradContext>();
+        saved.push_back(std::move(result));
+    }
 
-    sum_forward_impl(*this, dim, out);
+    out.m_saved_context->save_for_backward(std::move(saved));
+    out.m_requires_grad = true;
+    out.m_saved_context->set_grad_fn([activation](AutogradContext& ctx) { addmm_backward_impl(ctx, activation); });
 
-    if (!keep_dims && out_shape.size() > 1) {
-        out.m_shape.erase(out.m_shape.begin() + dim);
-        out.set_default_strides();
-    }
+    return out;
+}
+
+Tensor Tensor::to(Type dtype) const {
+    Tensor out = promote(*this, dtype);
+    if (is_capturing()) record_replay([in = *this, out]() mutable { cast_impl(in, out); });
 
-    if (!enable_global_grad || !this->m_requires_grad) return out;
+    if (!grad_enabled || !this->m_requires_grad) return out;
 
     out.m_saved_context->save_for_backward({*this});
     out.m_requires_grad = true;
-    out.m_grad_fn = sum_backward_impl;
+    out.m_saved_context->set_grad_fn(cast_backward_impl);
 
     return out;
 }
 
-Element Tensor::broadcasted_read(const std::vector<uint32_t>& indices) const {
-    int32_t nindecies = indices.size();
-    int32_t ndims = m_shape.size();
-    int32_t i = 0, j = 0;
-    uint32_t offset = 0;
+std::vector<bool> Tensor::reduced_dims(const std::vector<uint32_t>& dims) const {
+    std::vector<bool> reduced(m_shape.size(), dims.empty());
+    for (auto dim : dims) {
+        LOG_IF(FATAL, dim >= m_shape.size()) << "Trying to reduce over non-existing dimension";
+        reduced[dim] = true;
+    }
 
-    for (auto idx : indices) {
-        if ((nindecies - i) > ndims) {
-            i++;
-            continue;
-        }
+    return reduced;
+}
+
+void Tensor::drop_reduced_dims(const std::vector<bool>& reduced) {
+    std::vector<uint32_t> shape;
+    for (size_t d = 0; d < m_shape.size(); d++) {
+        if (!reduced[d]) shape.push_back(m_shape[d]);
+    }
+    if (shape.empty()) shape.push_back(1);
+
+    m_shape = std::move(shape);
+    set_default_strides();
+}
+
+Tensor Tensor::keep_reduced_dims(const std::vector<bool>& reduced) const {
+    if (m_shape.size() == reduced.size()) return *this;
+
+    Tensor t = *this;
+    t.m_shape.clear();
+    t.m_stride.clear();
+    for (size_t d = 0, kept = 0; d < reduced.size(); d++) {
+        bool dropped = reduced[d];
+        t.m_shape.push_back(dropped ? 1 : m_shape[kept]);
+        t.m_stride.push_back(dropped ? 0 : m_stride[kept]);
+        if (!dropped) kept++;
+    }
 
-        if (idx < m_shape[j]) {
-            offset += idx * m_stride[j];
-        } else {
-            LOG_IF(FATAL, m_shape[j] != 1) << "Broadcasting failed";
+    return t;
+}
+
+Tensor Tensor::reduce(ReduceOp op, const std::vector<uint32_t>& dims, bool keep_dims) const {
+    auto reduced = reduced_dims(dims);
+    auto shape = m_shape;
+    for (size_t d = 0; d < shape.size(); d++) {
+        if (reduced[d]) shape[d] = 1;
+    }
+
+    Tensor out(shape, m_dtype);
+    bool requires_grad = grad_enabled && m_requires_grad;
+
+    // The gradient of max and min goes to the element each was taken from, so those are found
+    // along with the values when backward will need them
+    Tensor indices;
+    if (requires_grad && (op == ReduceOp::MAX || op == ReduceOp::MIN)) {
+        indices = Tensor(shape, Type::UINT32);
+        arg_reduce_forward_impl(op, *this, out, indices);
+        if (is_capturing()) {
+            record_replay([op, in = *this, out, indices]() mutable { arg_reduce_forward_impl(op, in, out, indices); });
         }
+    } else {
+        reduce_forward_impl(op, *this, out);
+        if (is_capturing()) record_replay([op, in = *this, out]() mutable { reduce_forward_impl(op, in, out); });
+    }
+
+    if (!keep_dims) out.drop_reduced_dims(reduced);
 
-        j++;
+    if (!requires_grad) return out;
+
+    out.m_saved_context->save_for_backward({*this});
+    out.m_requires_grad = true;
+
+    switch (op) {
+        case ReduceOp::SUM:
+            out.m_saved_context->set_grad_fn([reduced](AutogradContext& ctx) { sum_backward_impl(ctx, reduced); });
+            break;
+        case ReduceOp::PROD:
+            out.m_saved_context->set_grad_fn([reduced](AutogradContext& ctx) { prod_backward_impl(ctx, reduced); });
+            break;
+        default:
+            out.m_saved_context->set_grad_fn(
+                [reduced, indices](AutogradContext& ctx) { select_backward_impl(ctx, reduced, indices); });
     }
 
-    return this->operator[](offset);
+    return out;
 }
 
-void Tensor::topological_sort(Tensor& curr, std::vector<Tensor>& list,
-                              std::unordered_set<std::shared_ptr<AutogradContext>>& visited) {
-    if (visited.count(curr.m_saved_context)) return;
-    visited.insert(curr.m_saved_context);
+Tensor Tensor::arg_reduce(ReduceOp op, const std::vector<uint32_t>& dims, bool keep_dims) const {
+    auto reduced = reduced_dims(dims);
+    auto shape = m_shape;
+    for (size_t d = 0; d < shape.size(); d++) {
+        if (reduced[d]) shape[d] = 1;
+    }
+
+    Tensor values(shape, m_dtype), indices(shape, Type::UINT32);
+    arg_reduce_forward_impl(op, *this, values, indices);
+    if (is_capturing()) {
+        record_replay(
+            [op, in = *this, values, indices]() mutable { arg_reduce_forward_impl(op, in, values, indices); });
+    }
 
-    auto parents = curr.m_saved_context->get_saved_variables();
+    if (!keep_dims) indices.drop_reduced_dims(reduced);
+    return indices;
+}
 
-    for (auto p : parents) {
-        topological_sort(p, list, visited);
+Tensor Tensor::sum(const std::vector<uint32_t>& dims, bool keep_dims) const {
+    return reduce(ReduceOp::SUM, dims, keep_dims);
+}
+
+Tensor Tensor::prod(const std::vector<uint32_t>& dims, bool keep_dims) const {
+    return reduce(ReduceOp::PROD, dims, keep_dims);
+}
+
+Tensor Tensor::max(const std::vector<uint32_t>& dims, bool keep_dims) const {
+    return reduce(ReduceOp::MAX, dims, keep_dims);
+}
+
+Tensor Tensor::min(const std::vector<uint32_t>& dims, bool keep_dims) const {
+    return reduce(ReduceOp::MIN, dims, keep_dims);
+}
+
+Tensor Tensor::argmax(const std::vector<uint32_t>& dims, bool keep_dims) const {
+    return arg_reduce(ReduceOp::MAX, dims, keep_dims);
+}
+
+Tensor Tensor::argmin(const std::vector<uint32_t>& dims, bool keep_dims) const {
+    return arg_reduce(ReduceOp::MIN, dims, keep_dims);
+}
+
+// Elements reduced into each output of a reduction over dims
+static uint32_t reduced_count(const std::vector<uint32_t>& shape, const std::vector<bool>& reduced) {
+    uint32_t count = 1;
+    for (size_t d = 0; d < shape.size(); d++) {
+        if (reduced[d]) count *= shape[d];
+    }
+    return count;
+}
+
+// Integer tensors are averaged in FLOAT32 rather than with an integer division
+Tensor Tensor::mean(const std::vector<uint32_t>& dims, bool keep_dims) const {
+    if (!is_floating_point(m_dtype)) return to(Type::FLOAT32).mean(dims, keep_dims);
+    return sum(dims, keep_dims) / reduced_count(m_shape, reduced_dims(dims));
+}
+
+Tensor Tensor::var(const std::vector<uint32_t>& dims, bool unbiased, bool keep_dims) const {
+    if (!is_floating_point(m_dtype)) return to(Type::FLOAT32).var(dims, unbiased, keep_dims);
+    uint32_t count = reduced_count(m_shape, reduced_dims(dims));
+    auto centered = *this - mean(dims, true);
+    return (centered * centered).sum(dims, keep_dims) / (unbiased ? count - 1 : count);
+}
+
+std::vector<int64_t> Tensor::broadcast_strides(const std::vector<uint32_t>& shape) const {
+    int32_t ndims = m_shape.size();
+    int32_t out_ndims = shape.size();
+    LOG_IF(FATAL, ndims > out_ndims) << "Can't broadcast a tensor with " << ndims << " dims to " << out_ndims
+                                     << " dims";
+
+    std::vector<int64_t> strides(out_ndims, 0);
+    for (int32_t i = 0; i < ndims; i++) {
+        int32_t dim = out_ndims - ndims + i;
+        LOG_IF(FATAL, m_shape[i] != shape[dim] && m_shape[i] != 1)
+            << "Broadcasting failed between shape=" << m_shape[i] << " and shape=" << shape[dim];
+        if (m_shape[i] != 1) strides[dim] = m_stride[i];
     }
 
-    list.push_back(curr);
+    return strides;
 }
 
-void Tensor::backward() {
+void Tensor::backward(bool retain_graph) {
     if (!this->m_requires_grad) return;
-    // Need to topologically sort the graph
-    std::vector<Tensor> list;
-    std::unordered_set<std::shared_ptr<AutogradContext>> visited;
 
-    topological_sort(*this, list, visited);
-    m_saved_context->grad() = std::make_shared<Tensor>(m_shape);
+    // Training loops rebuild the same graph every step, so the plan of the previous backward on
+    // this thread is checked against the new graph before building a fresh one. A captured step
+    // keeps its graph and a plan of its own instead, which every replay runs again
+    thread_local BackwardPlan cached_plan;
+    auto captured_plan = is_capturing() ? std::make_shared<BackwardPlan>() : nullptr;
+    auto& plan = captured_plan ? *captured_plan : cached_plan;
+    plan.prepare(*m_saved_context);
+
+    if (captured_plan) {
+        // The root node holds on to the retained graph the plan points into
+        record_replay([captured_plan, root = m_saved_context] {
+            NoGradGuard no_grad;
+            captured_plan->replay();
+        });
+    }
+
+    // Grad functions compute with tensor ops, which must not extend the graph being walked, nor
+    // be recorded next to the plan that reruns them
+    NoGradGuard no_grad;
+    CapturePause no_capture;
+
+    // Like every gradient, the seed has the dtype of the tensor it belongs to
+    m_saved_context->grad() = std::make_shared<Tensor>(m_shape, m_dtype);
     *(m_saved_context->grad()) = 1;
 
-    for (int32_t i = int32_t(list.size()) - 1; i >= 0; i--) {
-        if (list[i].m_grad_fn == nullptr) continue;
-        list[i].m_grad_fn(list[i]);
-    }
+    plan.run(retain_graph || captured_plan);
 }
 
 };  // namespace micro
\ No newline at end of file
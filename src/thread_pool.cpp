@@ -0,0 +1,160 @@
+#include "thread_pool.hpp"
+
+#include <cstdlib>
+
+namespace micro {
+
+static thread_local bool in_parallel_region = false;
+
+ThreadPool::ThreadPool(uint32_t num_threads) {
+    LOG_IF(FATAL, num_threads == 0) << "Thread pool needs at least one thread";
+
+    for (uint32_t i = 0; i + 1 < num_threads; i++) {
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    for (size_t i = 0; i < m_queues.size(); i++) {
+        m_threads.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_sleep_cv.notify_all();
+
+    for (auto& thread : m_threads) thread.join();
+}
+
+bool ThreadPool::try_pop(size_t queue, Task& task) {
+    auto& q = *m_queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) return false;
+
+    task = q.tasks.front();
+    q.tasks.pop_front();
+    m_queued--;
+    return true;
+}
+
+bool ThreadPool::try_steal(size_t thief, Task& task) {
+    size_t n = m_queues.size();
+    for (size_t i = 1; i <= n; i++) {
+        auto& q = *m_queues[(thief + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) continue;
+
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        m_queued--;
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::execute(const Task& task) {
+    bool was_in_parallel_region = in_parallel_region;
+    in_parallel_region = true;
+    (*task.fn)(task.begin, task.end);
+    in_parallel_region = was_in_parallel_region;
+
+    task.pending->fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ThreadPool::worker_loop(size_t id) {
+    while (true) {
+        Task task;
+        if (try_pop(id, task) || try_steal(id, task)) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_sleep_cv.wait(lock, [this] { return m_stop || m_queued.load() > 0; });
+        if (m_stop && m_queued.load() == 0) return;
+    }
+}
+
+void ThreadPool::run(int64_t begin, int64_t end, int64_t grain_size, const RangeFn& fn) {
+    int64_t range = end - begin;
+    int64_t max_chunks = int64_t(size()) * 4;
+    int64_t num_chunks = std::min((range + grain_size - 1) / grain_size, max_chunks);
+    int64_t chunk_size = (range + num_chunks - 1) / num_chunks;
+    num_chunks = (range + chunk_size - 1) / chunk_size;
+
+    std::atomic<int64_t> pending(num_chunks);
+
+    // Consecutive chunks go to the same worker so each one walks a contiguous part of memory
+    size_t n = m_queues.size();
+    for (int64_t c = 0; c < num_chunks; c++) {
+        Task task{&fn, begin + c * chunk_size, std::min(end, begin + (c + 1) * chunk_size), &pending};
+        auto& q = *m_queues[c * n / num_chunks];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(task);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_queued += num_chunks;
+    }
+    m_sleep_cv.notify_all();
+
+    while (pending.load(std::memory_order_acquire) > 0) {
+        Task task;
+        if (try_steal(0, task)) {
+            execute(task);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+static uint32_t default_num_threads() {
+    if (const char* env = std::getenv("MICRO_TORCH_NUM_THREADS")) {
+        int32_t value = std::atoi(env);
+        if (value > 0) return value;
+        LOG(WARNING) << "Ignoring invalid MICRO_TORCH_NUM_THREADS=" << env;
+    }
+
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+static std::mutex pool_mutex;
+static std::unique_ptr<ThreadPool> pool;
+
+static ThreadPool& get_thread_pool() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!pool) pool = std::make_unique<ThreadPool>(default_num_threads());
+    return *pool;
+}
+
+uint32_t get_num_threads() { return get_thread_pool().size(); }
+
+void set_num_threads(uint32_t num_threads) {
+    LOG_IF(FATAL, num_threads == 0) << "Number of threads must be positive";
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    pool = std::make_unique<ThreadPool>(num_threads);
+}
+
+void parallel_for(int64_t begin, int64_t end, int64_t grain_size, const ThreadPool::RangeFn& fn) {
+    if (end <= begin) return;
+    grain_size = std::max<int64_t>(grain_size, 1);
+
+    if (end - begin <= grain_size || in_parallel_region) {
+        fn(begin, end);
+        return;
+    }
+
+    auto& thread_pool = get_thread_pool();
+    if (thread_pool.size() == 1) {
+        fn(begin, end);
+        return;
+    }
+
+    thread_pool.run(begin, end, grain_size, fn);
+}
+
+};  // namespace micro
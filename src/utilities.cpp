@@ -2,33 +2,27 @@
 
 namespace micro {
 
-#define PRINT_ELEMENT(dtype, element, os)                                   \
-    {                                                                       \
-        switch (dtype) {                                                    \
-            case Type::UINT32:                                              \
-                os << uint32_t(element);                                    \
-                break;                                                      \
-            case Type::INT32:                                               \
-                os << int32_t(element);                                     \
-                break;                                                      \
-            case Type::FLOAT32:                                             \
-                os << float(element);                                       \
-                break;                                                      \
-            default:                                                        \
-                LOG(FATAL) << "Can't print value with unknown tensor type"; \
-        }                                                                   \
-    }
-
 std::ostream& operator<<(std::ostream& os, const Tensor& t) {
     int32_t ndims = t.m_shape.size();
 
     os << "Tensor(";
     os << "[";
 
-    for (size_t i = 0; i < t.size(); i++) {
-        PRINT_ELEMENT(t.m_dtype, t[i], os);
-        if (i != t.size() - 1) os << ", ";
-    }
+    // Views are printed from a row-major copy of their elements
+    Tensor values = t.is_contiguous() ? t : Tensor::promote(t, t.m_dtype);
+    dispatch_type(t.m_dtype, [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        const T* data = values.data_ptr<T>();
+        for (size_t i = 0; i < t.size(); i++) {
+            // 8-bit values are printed as numbers rather than characters
+            if constexpr (is_8bit_v<T>) {
+                os << int32_t(data[i]);
+            } else {
+                os << data[i];
+            }
+            if (i != t.size() - 1) os << ", ";
+        }
+    });
 
     os << "], ";
 
@@ -0,0 +1,216 @@
+#include <numeric>
+#include <optional>
+
+#include "graph_capture.hpp"
+#include "quantization.hpp"
+#include "tensor.hpp"
+
+namespace micro {
+
+// Strides that read a tensor of shape/stride as new_shape, when it has as many elements. Every
+// run of dims the old strides lay out as one contiguous chunk can be split into new dims freely;
+// a new dim spanning two such chunks can't be strided, and the view is impossible
+static std::optional<std::vector<uint32_t>> view_strides(const std::vector<uint32_t>& shape,
+                                                         const std::vector<uint32_t>& stride,
+                                                         const std::vector<uint32_t>& new_shape) {
+    std::vector<uint32_t> new_stride(new_shape.size());
+    int32_t view_d = int32_t(new_shape.size()) - 1;
+    int64_t chunk_stride = stride.back();
+    int64_t numel = 1, view_numel = 1;
+
+    for (int32_t d = int32_t(shape.size()) - 1; d >= 0; d--) {
+        numel *= shape[d];
+
+        // A chunk ends at the first dim (going left) whose stride doesn't continue the chunk
+        bool chunk_ends = d == 0 || (shape[d - 1] != 1 && stride[d - 1] != numel * chunk_stride);
+        if (!chunk_ends) continue;
+
+        while (view_d >= 0 && (view_numel < numel || new_shape[view_d] == 1)) {
+            new_stride[view_d] = uint32_t(view_numel * chunk_stride);
+            view_numel *= new_shape[view_d];
+            view_d--;
+        }
+        if (view_numel != numel) return std::nullopt;
+
+        if (d > 0) {
+            chunk_stride = stride[d - 1];
+            numel = 1;
+            view_numel = 1;
+        }
+    }
+
+    if (view_d != -1) return std::nullopt;
+    return new_stride;
+}
+
+Tensor Tensor::make_view(std::vector<uint32_t> shape, std::vector<uint32_t> stride, int64_t offset,
+                         std::function<Tensor(const Tensor&)> view_fn) const {
+    // Views of every dim away keep a single element, with the {1} shape of a scalar
+    if (shape.empty()) {
+        shape = {1};
+        stride = {1};
+    }
+
+    // Per-tensor quant params hold for any view, per-channel ones are tied to a dim of this layout
+    LOG_IF(FATAL, m_quant && m_quant->per_channel())
+        << "Can't take a view of a per-channel quantized tensor, dequantize() it first";
+
+    Tensor out = *this;
+    out.m_shape = std::move(shape);
+    out.m_stride = std::move(stride);
+    out.m_offset = offset;
+    out.m_saved_context = std::make_shared<AutogradContext>();
+    out.m_requires_grad = false;
+
+    if (!is_grad_enabled() || !this->m_requires_grad) return out;
+
+    out.m_saved_context->save_for_backward({*this});
+    out.m_requires_grad = true;
+    out.m_saved_context->set_grad_fn(
+        [view_fn = std::move(view_fn)](AutogradContext& ctx) { view_backward_impl(ctx, view_fn); });
+    return out;
+}
+
+Tensor Tensor::view(const std::vector<uint32_t>& shape) const {
+    size_t numel = std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<size_t>());
+    LOG_IF(FATAL, shape.empty() || numel != size())
+        << "Can't view a tensor of size " << size() << " with a shape of size " << numel;
+
+    auto stride = view_strides(m_shape, m_stride, shape);
+    LOG_IF(FATAL, !stride) << "Tensor strides can't express this view, use reshape() to copy it";
+
+    return make_view(shape, std::move(*stride), m_offset, [shape](const Tensor& t) { return t.view(shape); });
+}
+
+Tensor Tensor::reshape(const std::vector<uint32_t>& shape) const {
+    if (view_strides(m_shape, m_stride, shape)) return view(shape);
+    return contiguous().view(shape);
+}
+
+Tensor Tensor::slice(uint32_t dim, uint32_t start, uint32_t end, uint32_t step) const {
+    LOG_IF(FATAL, dim >= m_shape.size()) << "Trying to slice a non-existing dimension";
+    LOG_IF(FATAL, start >= end || end > m_shape[dim] || step == 0)
+        << "Can't slice [" << start << ", " << end << ") with step " << step << " from a dim of size "
+        << m_shape[dim];
+
+    auto shape = m_shape;
+    auto stride = m_stride;
+    shape[dim] = (end - start + step - 1) / step;
+    stride[dim] *= step;
+
+    return make_view(shape, stride, m_offset + int64_t(start) * m_stride[dim],
+                     [=](const Tensor& t) { return t.slice(dim, start, end, step); });
+}
+
+Tensor Tensor::select(uint32_t dim, uint32_t index) const {
+    LOG_IF(FATAL, dim >= m_shape.size()) << "Trying to select from a non-existing dimension";
+    LOG_IF(FATAL, index >= m_shape[dim]) << "index is out of range, full_shape= " << m_shape[dim]
+                                         << " and index=" << index;
+
+    auto shape = m_shape;
+    auto stride = m_stride;
+    shape.erase(shape.begin() + dim);
+    stride.erase(stride.begin() + dim);
+
+    return make_view(shape, stride, m_offset + int64_t(index) * m_stride[dim],
+                     [=](const Tensor& t) { return t.select(dim, index); });
+}
+
+Tensor Tensor::permute(const std::vector<uint32_t>& dims) const {
+    LOG_IF(FATAL, dims.size() != m_shape.size())
+        << "Permutation of " << dims.size() << " dims given for a tensor with " << m_shape.size() << " dims";
+
+    std::vector<uint32_t> shape(dims.size()), stride(dims.size());
+    std::vector<bool> seen(dims.size(), false);
+    for (size_t i = 0; i < dims.size(); i++) {
+        LOG_IF(FATAL, dims[i] >= dims.size() || seen[dims[i]]) << "Invalid permutation of dims";
+        seen[dims[i]] = true;
+        shape[i] = m_shape[dims[i]];
+        stride[i] = m_stride[dims[i]];
+    }
+
+    return make_view(shape, stride, m_offset, [dims](const Tensor& t) { return t.permute(dims); });
+}
+
+Tensor Tensor::transpose(uint32_t dim0, uint32_t dim1) const {
+    LOG_IF(FATAL, dim0 >= m_shape.size() || dim1 >= m_shape.size()) << "Trying to transpose a non-existing dimension";
+
+    std::vector<uint32_t> dims(m_shape.size());
+    std::iota(dims.begin(), dims.end(), 0);
+    std::swap(dims[dim0], dims[dim1]);
+    return permute(dims);
+}
+
+Tensor Tensor::squeeze() const {
+    std::vector<uint32_t> shape, stride;
+    for (size_t d = 0; d < m_shape.size(); d++) {
+        if (m_shape[d] == 1) continue;
+        shape.push_back(m_shape[d]);
+        stride.push_back(m_stride[d]);
+    }
+
+    return make_view(shape, stride, m_offset, [](const Tensor& t) { return t.squeeze(); });
+}
+
+Tensor Tensor::squeeze(uint32_t dim) const {
+    LOG_IF(FATAL, dim >= m_shape.size()) << "Trying to squeeze a non-existing dimension";
+    if (m_shape[dim] != 1) return *this;
+
+    auto shape = m_shape;
+    auto stride = m_stride;
+    shape.erase(shape.begin() + dim);
+    stride.erase(stride.begin() + dim);
+
+    return make_view(shape, stride, m_offset, [dim](const Tensor& t) { return t.squeeze(dim); });
+}
+
+Tensor Tensor::unsqueeze(uint32_t dim) const {
+    LOG_IF(FATAL, dim > m_shape.size()) << "Trying to unsqueeze past the last dimension";
+
+    // The new dim is never stepped along, so any stride reads it; this one keeps a contiguous
+    // tensor contiguous
+    auto shape = m_shape;
+    auto stride = m_stride;
+    uint32_t inner_stride = dim < m_shape.size() ? m_stride[dim] * m_shape[dim] : 1;
+    shape.insert(shape.begin() + dim, 1);
+    stride.insert(stride.begin() + dim, inner_stride);
+
+    return make_view(shape, stride, m_offset, [dim](const Tensor& t) { return t.unsqueeze(dim); });
+}
+
+Tensor Tensor::expand(const std::vector<uint32_t>& shape) const {
+    auto strides = broadcast_strides(shape);
+
+    Tensor out = *this;
+    out.m_shape = shape;
+    out.m_stride.assign(strides.begin(), strides.end());
+    out.m_saved_context = std::make_shared<AutogradContext>();
+    out.m_requires_grad = false;
+
+    if (!is_grad_enabled() || !this->m_requires_grad) return out;
+
+    out.m_saved_context->save_for_backward({*this});
+    out.m_requires_grad = true;
+    out.m_saved_context->set_grad_fn(expand_backward_impl);
+    return out;
+}
+
+Tensor Tensor::contiguous() const {
+    if (is_contiguous()) return *this;
+
+    Tensor out(m_shape, m_dtype);
+    out.m_quant = m_quant;
+    cast_impl(*this, out);
+    if (is_capturing()) record_replay([in = *this, out]() mutable { cast_impl(in, out); });
+
+    if (!is_grad_enabled() || !this->m_requires_grad) return out;
+
+    // The copy takes its gradient like a view covering every element
+    out.m_saved_context->save_for_backward({*this});
+    out.m_requires_grad = true;
+    out.m_saved_context->set_grad_fn(
+        [](AutogradContext& ctx) { view_backward_impl(ctx, [](const Tensor& t) { return t; }); });
+    return out;
+}
+
+};  // namespace micro
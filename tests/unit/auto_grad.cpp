@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <future>
+#include <thread>
+
+#include <graph_capture.hpp>
 #include <tensor.hpp>
 
 using namespace micro;
@@ -46,4 +50,569 @@ TEST(AutoGrad, BasicGradient2) {
         EXPECT_EQ((float)t2_grad[{i}], 1.f);
         EXPECT_EQ((float)t3_grad[{i}], 1.f);
     }
+}
+TEST(AutoGrad, BatchedMatmulGradient) {
+    Tensor t1({2, 3, 4}), t2({4, 5});
+    for (uint32_t i = 0; i < 24; i++) t1[{i / 12, (i / 4) % 3, i % 4}] = float(i);
+    for (uint32_t i = 0; i < 20; i++) t2[{i / 5, i % 5}] = float(i % 3);
+    t1.requires_grad(true);
+    t2.requires_grad(true);
+
+    auto out = t1.mm(t2);
+    out.backward();
+
+    auto t1_grad = t1.grad();
+    auto t2_grad = t2.grad();
+
+    for (uint32_t k = 0; k < 4; k++) {
+        float row_sum = 0.f;
+        for (uint32_t n = 0; n < 5; n++) row_sum += (float)(t2[{k, n}]);
+
+        float col_sum = 0.f;
+        for (uint32_t b = 0; b < 2; b++) {
+            for (uint32_t m = 0; m < 3; m++) {
+                EXPECT_EQ((float)(t1_grad[{b, m, k}]), row_sum);
+                col_sum += (float)(t1[{b, m, k}]);
+            }
+        }
+
+        for (uint32_t n = 0; n < 5; n++) {
+            EXPECT_EQ((float)(t2_grad[{k, n}]), col_sum);
+        }
+    }
+}
+
+TEST(AutoGrad, CastGradient) {
+    uint32_t tensor_size = 4;
+    Tensor t1({tensor_size}), t2({tensor_size}, Type::INT32);
+    for (uint32_t i = 0; i < tensor_size; i++) {
+        t1[{i}] = float(i);
+        t2[{i}] = int32_t(i + 1);
+    }
+    t1.requires_grad(true);
+    t2.requires_grad(true);
+
+    // The gradient of each cast comes back in the dtype of its source
+    auto out = t1.to(Type::FLOAT32) * t1 + t2.to(Type::FLOAT32) * t1;
+    out.backward();
+
+    auto t1_grad = t1.grad();
+    auto t2_grad = t2.grad();
+
+    for (uint32_t i = 0; i < tensor_size; i++) {
+        EXPECT_EQ((float)t1_grad[{i}], float(3 * i + 1));
+        EXPECT_EQ((int32_t)t2_grad[{i}], int32_t(i));
+    }
+}
+
+TEST(AutoGrad, ScalarOperationsGradient) {
+    uint32_t tensor_size = 5;
+
+    Tensor t1({tensor_size});
+    t1 = 2.f;
+    t1.requires_grad(true);
+
+    auto t2 = (t1 * 3.f + 1.f) / 2.f - 0.5f;
+    t2.backward();
+
+    auto t1_grad = t1.grad();
+    for (uint32_t i = 0; i < tensor_size; i++) {
+        EXPECT_EQ((float)t2[{i}], 3.f);
+        EXPECT_EQ((float)t1_grad[{i}], 1.5f);
+    }
+}
+
+TEST(AutoGrad, BroadcastGradientIsReduced) {
+    Tensor x({4, 3}), bias({3}), scale({4, 1});
+    for (uint32_t i = 0; i < 12; i++) x[{i / 3, i % 3}] = float(i);
+    bias = {1.f, 2.f, 3.f};
+    scale = {1.f, 2.f, 3.f, 4.f};
+    bias.requires_grad(true);
+    scale.requires_grad(true);
+
+    auto out = (x + bias) * scale + bias;
+    auto loss = out.sum(1).sum(0);
+    loss.backward();
+
+    auto bias_grad = bias.grad();
+    auto scale_grad = scale.grad();
+    ASSERT_EQ(bias_grad.size(), 3u);
+    ASSERT_EQ(scale_grad.size(), 4u);
+
+    for (uint32_t j = 0; j < 3; j++) {
+        EXPECT_EQ((float)(bias_grad[{j}]), 1.f + 2.f + 3.f + 4.f + 4.f);
+    }
+
+    for (uint32_t i = 0; i < 4; i++) {
+        float expected = 0.f;
+        for (uint32_t j = 0; j < 3; j++) expected += (float)(x[{i, j}]) + (float)(bias[{j}]);
+        EXPECT_EQ((float)(scale_grad[{i, 0}]), expected);
+    }
+}
+
+TEST(AutoGrad, BackwardFollowsGraphChanges) {
+    Tensor a({2}), b({2});
+    a = {2.f, 3.f};
+    b = {5.f, 7.f};
+    a.requires_grad(true);
+    b.requires_grad(true);
+
+    // Same structure twice, then the same number of nodes with a shared input, then back again
+    for (int step = 0; step < 4; step++) {
+        a.reset_grad();
+        b.reset_grad();
+
+        bool shared = step == 2;
+        auto out = shared ? a * a : a * b;
+        out.backward();
+
+        auto a_grad = a.grad();
+        EXPECT_EQ((float)(a_grad[{0}]), shared ? 4.f : 5.f);
+        EXPECT_EQ((float)(a_grad[{1}]), shared ? 6.f : 7.f);
+    }
+}
+
+TEST(AutoGrad, DeepGraphBackward) {
+    uint32_t depth = 20000;
+
+    Tensor x({1});
+    x = 1.f;
+    x.requires_grad(true);
+
+    auto out = x + 0.f;
+    for (uint32_t i = 1; i < depth; i++) out = out + x;
+    out.backward();
+
+    EXPECT_EQ((float)(x.grad()[{0}]), float(depth));
+}
+
+TEST(AutoGrad, BackwardFreesSavedTensors) {
+    Tensor x({256, 256});
+    x = 1.f;
+    x.requires_grad(true);
+
+    auto out = ((x * 2.f) * 3.f).sum(1).sum(0);
+    size_t before_backward = CachingAllocator::instance().allocated_bytes();
+    out.backward();
+
+    // The two 256 x 256 intermediates are gone, only the gradient of x was added
+    EXPECT_LT(CachingAllocator::instance().allocated_bytes(), before_backward);
+    EXPECT_EQ((float)(x.grad()[{3, 5}]), 6.f);
+}
+
+TEST(AutoGrad, RetainGraphAllowsRepeatedBackward) {
+    Tensor x({3});
+    x = 2.f;
+    x.requires_grad(true);
+
+    auto out = x * x + x;
+    out.backward(true);
+    out.backward();
+
+    for (uint32_t i = 0; i < 3; i++) EXPECT_EQ((float)(x.grad()[{i}]), 10.f);
+}
+
+TEST(AutoGrad, NoGradGuardNests) {
+    Tensor x({2});
+    x = 1.f;
+    x.requires_grad(true);
+
+    {
+        NoGradGuard outer;
+        {
+            NoGradGuard inner;
+            EXPECT_FALSE((x * x).requires_grad());
+        }
+        EXPECT_FALSE(is_grad_enabled());
+        EXPECT_FALSE((x * x).requires_grad());
+
+        {
+            EnableGradGuard enable_grad;
+            EXPECT_TRUE((x * x).requires_grad());
+        }
+        EXPECT_FALSE(is_grad_enabled());
+    }
+
+    EXPECT_TRUE(is_grad_enabled());
+    EXPECT_TRUE((x * x).requires_grad());
+
+    {
+        EnableGradGuard enable_grad;
+    }
+    EXPECT_TRUE(is_grad_enabled());
+}
+
+TEST(AutoGrad, GradModeIsPerThread) {
+    Tensor x({2});
+    x = 1.f;
+    x.requires_grad(true);
+
+    std::promise<void> guard_held, main_done;
+    std::thread inference([&] {
+        NoGradGuard no_grad;
+        guard_held.set_value();
+        main_done.get_future().wait();
+        EXPECT_FALSE((x * x).requires_grad());
+    });
+
+    guard_held.get_future().wait();
+    EXPECT_TRUE(is_grad_enabled());
+    EXPECT_TRUE((x * x).requires_grad());
+    main_done.set_value();
+    inference.join();
+}
+
+TEST(AutoGrad, LazyBackwardMatchesEager) {
+    Tensor x({4, 3}), w({3}), bias({4, 1});
+    for (uint32_t i = 0; i < 12; i++) x[{i / 3, i % 3}] = float(i) / 3.f;
+    w = {1.f, -2.f, 0.5f};
+    bias = {1.f, 2.f, 3.f, 4.f};
+    w.requires_grad(true);
+    bias.requires_grad(true);
+
+    auto step = [&] {
+        w.reset_grad();
+        bias.reset_grad();
+
+        auto diff = x * w + bias - x;
+        auto loss = (diff * diff * 0.5f).sum(1).sum(0);
+        loss.backward();
+        return std::make_pair(w.grad(), bias.grad());
+    };
+
+    auto [w_grad, bias_grad] = step();
+
+    LazyGuard lazy;
+    auto [lazy_w_grad, lazy_bias_grad] = step();
+
+    for (uint32_t j = 0; j < 3; j++) EXPECT_FLOAT_EQ((float)(lazy_w_grad[{j}]), (float)(w_grad[{j}]));
+    for (uint32_t i = 0; i < 4; i++) EXPECT_FLOAT_EQ((float)(lazy_bias_grad[{i, 0}]), (float)(bias_grad[{i, 0}]));
+}
+
+TEST(AutoGrad, LazyTrainingStepsFreeTheirGraph) {
+    Tensor x({64, 32}), w({32});
+    x = 0.5f;
+    w = 2.f;
+    w.requires_grad(true);
+
+    auto& allocator = CachingAllocator::instance();
+    auto step = [&] {
+        LazyGuard lazy;
+        auto diff = x * w - x;
+        auto loss = (diff * diff * 0.5f).sum(1).sum(0);
+        loss.backward();
+    };
+
+    // Every step frees what it allocated once its graph is gone
+    step();
+    size_t allocated = allocator.allocated_bytes();
+    for (int i = 0; i < 10; i++) step();
+    EXPECT_EQ(allocator.allocated_bytes(), allocated);
+
+    // The gradient of a lazy leaf is evaluated rather than kept as an expression holding the leaf
+    {
+        LazyGuard lazy;
+        Tensor leaf = x * 2.f;
+        leaf.requires_grad(true);
+        (leaf * leaf).sum(1).sum(0).backward();
+        EXPECT_FLOAT_EQ((float)(leaf.grad()[{3, 5}]), 2.f);
+    }
+    EXPECT_EQ(allocator.allocated_bytes(), allocated);
+}
+
+TEST(AutoGrad, CapturedStepReplaysIntoSameBuffers) {
+    Tensor x({3}), w({3});
+    x = {1.f, 2.f, 3.f};
+    w = 2.f;
+    w.requires_grad(true);
+
+    Tensor loss;
+    auto step = CapturedGraph::capture([&] {
+        loss = (x * w * w + w).sum(0);
+        loss.backward();
+    });
+    EXPECT_EQ((float)(loss[{0}]), 30.f);
+    EXPECT_EQ((float)(w.grad()[{1}]), 9.f);
+
+    Element* loss_data = &loss.at({0});
+    Element* grad_data = &w.grad().at({1});
+
+    // Inputs are rebound in place, and the gradients of every replay start over
+    Tensor new_x({3});
+    new_x = 3.f;
+    x.copy_from(new_x);
+    step.replay();
+    step.replay();
+
+    EXPECT_EQ((float)(loss[{0}]), 42.f);
+    EXPECT_EQ((float)(w.grad()[{1}]), 13.f);
+    EXPECT_EQ(&loss.at({0}), loss_data);
+    EXPECT_EQ(&w.grad().at({1}), grad_data);
+}
+
+TEST(AutoGrad, CheckpointRecomputesSegment) {
+    auto block = [](const std::vector<Tensor>& in) { return (in[0] * 2.f + in[1]) * in[1]; };
+
+    auto run = [&](bool checkpointed, Tensor& x, Tensor& w) {
+        x = Tensor({64, 64});
+        w = Tensor({64, 64});
+        x = 1.f;
+        w = 0.5f;
+        x.requires_grad(true);
+        w.requires_grad(true);
+
+        size_t before = CachingAllocator::instance().allocated_bytes();
+        auto h = x;
+        for (int i = 0; i < 4; i++) h = checkpointed ? checkpoint(block, {h, w}) : block({h, w});
+        auto loss = h.sum(1).sum(0);
+        size_t activations = CachingAllocator::instance().allocated_bytes() - before;
+
+        loss.backward();
+        return activations;
+    };
+
+    Tensor x, w, ckpt_x, ckpt_w;
+    size_t eager_bytes = run(false, x, w);
+    size_t checkpoint_bytes = run(true, ckpt_x, ckpt_w);
+    EXPECT_LT(checkpoint_bytes, eager_bytes);
+
+    for (uint32_t i : {0u, 17u, 63u}) {
+        EXPECT_FLOAT_EQ((float)(ckpt_x.grad()[{i, i}]), (float)(x.grad()[{i, i}]));
+        EXPECT_FLOAT_EQ((float)(ckpt_w.grad()[{i, 3}]), (float)(w.grad()[{i, 3}]));
+    }
+}
+
+TEST(AutoGrad, CheckpointReachesCapturedWeights) {
+    // Only w needs a gradient, and the segment reaches it through its closure, not its inputs
+    Tensor x({4, 3}), w({3, 2});
+    x = 1.f;
+    w = 0.5f;
+    w.requires_grad(true);
+
+    auto y = checkpoint([&](const std::vector<Tensor>& in) { return in[0].mm(w); }, {x});
+    EXPECT_TRUE(y.requires_grad());
+    y.backward();
+
+    auto w_grad = w.grad();
+    for (uint32_t i = 0; i < 3; i++) {
+        for (uint32_t j = 0; j < 2; j++) {
+            EXPECT_EQ((float)(w_grad[{i, j}]), 4.f);
+        }
+    }
+}
+
+TEST(AutoGrad, ReductionGradients) {
+    Tensor t1({2, 3});
+    t1 = {1.f, 5.f, 2.f, 4.f, 0.f, 3.f};
+    t1.requires_grad(true);
+
+    // Max sends the gradient to the position it picked, prod to the others' product
+    auto t2 = t1.max(1) + t1.prod(1);
+    t2.sum().backward();
+
+    auto grad = t1.grad();
+    float expected[] = {10.f, 3.f, 5.f, 1.f, 12.f, 0.f};
+    for (uint32_t i = 0; i < 6; i++) EXPECT_FLOAT_EQ(float(grad[{i / 3, i % 3}]), expected[i]);
+
+    Tensor t3({2, 3});
+    t3 = {1.f, 2.f, 3.f, 2.f, 2.f, 8.f};
+    t3.requires_grad(true);
+
+    // d/dx var = 2 (x - mean) / (n - 1), and mean adds 1 / n
+    auto t4 = t3.var(1) + t3.mean(1);
+    t4.sum().backward();
+
+    auto grad2 = t3.grad();
+    float x[] = {1.f, 2.f, 3.f, 2.f, 2.f, 8.f};
+    float mean[] = {2.f, 4.f};
+    for (uint32_t i = 0; i < 6; i++) {
+        EXPECT_NEAR(float(grad2[{i / 3, i % 3}]), x[i] - mean[i / 3] + 1.f / 3.f, 1e-5);
+    }
+}
+
+TEST(AutoGrad, ExpandGradientIsSummed) {
+    Tensor t1({3, 1}), t2({2, 3, 4});
+    t1 = {1.f, 2.f, 3.f};
+    for (uint32_t i = 0; i < 24; i++) t2[{i / 12, (i / 4) % 3, i % 4}] = float(i);
+    t1.requires_grad(true);
+
+    auto t3 = (t1.expand({2, 3, 4}) * t2).sum();
+    t3.backward();
+
+    // Each element of t1 is read by the 2 x 4 elements of t2 in its row
+    auto grad = t1.grad();
+    for (uint32_t r = 0; r < 3; r++) {
+        float expected = 0;
+        for (uint32_t b = 0; b < 2; b++)
+            for (uint32_t c = 0; c < 4; c++) expected += float(b * 12 + r * 4 + c);
+        EXPECT_EQ(float(grad[{r, 0}]), expected);
+    }
+}
+
+TEST(AutoGrad, ViewGradients) {
+    Tensor t1({3, 4});
+    for (uint32_t i = 0; i < 12; i++) t1[{i / 4, i % 4}] = float(i);
+    t1.requires_grad(true);
+
+    // Columns 1 and 3, plus column 0 read through a transpose; column 2 is never read
+    auto t2 = t1.slice(1, 1, 4, 2).sum(1) + t1.transpose().select(0, 0);
+    t2.unsqueeze(0).reshape({3}).sum().backward();
+
+    auto grad = t1.grad();
+    float expected[] = {1.f, 1.f, 0.f, 1.f};
+    for (uint32_t i = 0; i < 12; i++) EXPECT_EQ(float(grad[{i / 4, i % 4}]), expected[i % 4]);
+
+    // Flattening the transpose copies, and each element's gradient is its position in the copy
+    Tensor t3({3, 4}), weights({12});
+    for (uint32_t i = 0; i < 12; i++) weights[{i}] = float(i);
+    t3.requires_grad(true);
+    (t3.transpose().reshape({12}) * weights).sum().backward();
+
+    auto grad2 = t3.grad();
+    for (uint32_t i = 0; i < 12; i++) EXPECT_EQ(float(grad2[{i / 4, i % 4}]), float((i % 4) * 3 + i / 4));
+}
+
+TEST(AutoGrad, HalfPrecisionGradients) {
+    Tensor t1({2, 3, 4}), t2({4, 5});
+    for (uint32_t i = 0; i < 24; i++) t1[{i / 12, (i / 4) % 3, i % 4}] = float(i);
+    for (uint32_t i = 0; i < 20; i++) t2[{i / 5, i % 5}] = float(i % 3);
+
+    // A gradient has the dtype of its tensor, whatever dtype the ops producing it computed in
+    auto x = t1.to(Type::FLOAT16), w = t2.to(Type::FLOAT16);
+    x.requires_grad(true);
+    w.requires_grad(true);
+    (x.mm(w) * 2.f).sum().backward();
+
+    // A half weight used with float activations computes in float but still gets a half gradient
+    auto w2 = t2.to(Type::BFLOAT16);
+    w2.requires_grad(true);
+    t1.mm(w2).sum().backward();
+
+    const Tensor x_grad = x.grad(), w_grad = w.grad(), w2_grad = w2.grad();
+    EXPECT_EQ(x_grad.dtype(), Type::FLOAT16);
+    EXPECT_EQ(w_grad.dtype(), Type::FLOAT16);
+    EXPECT_EQ(w2_grad.dtype(), Type::BFLOAT16);
+
+    for (uint32_t k = 0; k < 4; k++) {
+        float row_sum = 0.f;
+        for (uint32_t n = 0; n < 5; n++) row_sum += (float)(t2[{k, n}]);
+
+        float col_sum = 0.f;
+        for (uint32_t b = 0; b < 2; b++) {
+            for (uint32_t m = 0; m < 3; m++) {
+                EXPECT_EQ((float)(x_grad[{b, m, k}]), 2 * row_sum);
+                col_sum += (float)(t1[{b, m, k}]);
+            }
+        }
+
+        for (uint32_t n = 0; n < 5; n++) {
+            EXPECT_EQ((float)(w_grad[{k, n}]), 2 * col_sum);
+            EXPECT_EQ((float)(w2_grad[{k, n}]), col_sum);
+        }
+    }
+}
+
+TEST(AutoGrad, HalfPrecisionGradientDtype) {
+    Tensor t1({2, 3});
+    t1 = {1.f, 2.f, 3.f, 4.f, 5.f, 6.f};
+
+    // Element-wise ops and reductions follow the same rule as mm
+    auto w = t1.to(Type::BFLOAT16);
+    w.requires_grad(true);
+    (w * t1).sum().backward();
+
+    auto h = t1.to(Type::FLOAT16);
+    h.requires_grad(true);
+    (h * h).mean().backward();
+
+    // A float tensor cast to half for the forward gets its gradient back in float
+    Tensor m({2, 3});
+    m = {1.f, 2.f, 3.f, 4.f, 5.f, 6.f};
+    m.requires_grad(true);
+    auto m16 = m.to(Type::FLOAT16);
+    (m16 * m16).sum().backward();
+
+    const Tensor w_grad = w.grad(), h_grad = h.grad(), m_grad = m.grad();
+    EXPECT_EQ(w_grad.dtype(), Type::BFLOAT16);
+    EXPECT_EQ(h_grad.dtype(), Type::FLOAT16);
+    EXPECT_EQ(m_grad.dtype(), Type::FLOAT32);
+
+    for (uint32_t i = 0; i < 6; i++) {
+        float value = float(i + 1);
+        EXPECT_EQ((float)(w_grad[{i / 3, i % 3}]), value);
+        EXPECT_NEAR((float)(h_grad[{i / 3, i % 3}]), value / 3.f, 1e-2);
+        EXPECT_EQ((float)(m_grad[{i / 3, i % 3}]), 2.f * value);
+    }
+}
+
+TEST(AutoGrad, AddmmGradients) {
+    // A batch of inputs against one weight, wider than a register tile so the epilogue runs on full
+    // tiles and on the edge, with signs mixed so that ReLU zeroes part of the result
+    uint32_t B = 3, M = 10, K = 7, N = 40;
+    Tensor x({B, M, K}), w({K, N}), b({N});
+    for (uint32_t i = 0; i < B * M * K; i++) x[{i / (M * K), i / K % M, i % K}] = float(int32_t(i % 9) - 4) / 4.f;
+    for (uint32_t i = 0; i < K * N; i++) w[{i / N, i % N}] = float(int32_t(i % 7) - 3) / 2.f;
+    for (uint32_t i = 0; i < N; i++) b[{i}] = float(int32_t(i % 5) - 2);
+
+    for (auto activation : {Activation::NONE, Activation::RELU}) {
+        // Fresh leaves for both sides, so gradients don't carry over between activations
+        Tensor x1({B, M, K}), w1({K, N}), b1({N}), x2({B, M, K}), w2({K, N}), b2({N});
+        for (auto [src, dst] : {std::make_pair(&x, &x1), std::make_pair(&w, &w1), std::make_pair(&b, &b1),
+                                std::make_pair(&x, &x2), std::make_pair(&w, &w2), std::make_pair(&b, &b2)}) {
+            dst->copy_from(*src);
+            dst->requires_grad(true);
+        }
+
+        // The reference runs mm, then adds the bias and masks out the negative sums
+        const auto out = x1.addmm(w1, b1, activation);
+        Tensor mask({B, M, N});
+        mask = 1.f;
+        {
+            NoGradGuard no_grad;
+            const auto sums = x.mm(w) + b;
+            for (uint32_t i = 0; i < B * M * N; i++) {
+                float value = sums[{i / (M * N), i / N % M, i % N}];
+                if (activation == Activation::RELU && value <= 0.f) mask[{i / (M * N), i / N % M, i % N}] = 0.f;
+            }
+        }
+        const auto reference = (x2.mm(w2) + b2) * mask;
+        (out * 2.f).sum().backward();
+        (reference * 2.f).sum().backward();
+
+        // Results match exactly; gradients up to the order their sums are taken in
+        auto expect_match = [](const Tensor& t1, const Tensor& t2, bool exact) {
+            const Tensor flat1 = t1.reshape({uint32_t(t1.size())}), flat2 = t2.reshape({uint32_t(t2.size())});
+            for (uint32_t i = 0; i < t1.size(); i++) {
+                if (exact) {
+                    EXPECT_EQ((float)(flat1[{i}]), (float)(flat2[{i}]));
+                } else {
+                    EXPECT_FLOAT_EQ((float)(flat1[{i}]), (float)(flat2[{i}]));
+                }
+            }
+        };
+        expect_match(out, reference, true);
+        expect_match(x1.grad(), x2.grad(), false);
+        expect_match(w1.grad(), w2.grad(), false);
+        expect_match(b1.grad(), b2.grad(), false);
+    }
+}
+
+TEST(AutoGrad, AddmmHalfBiasGradient) {
+    // The output is float, so the bias sums are float and get rounded into the half bias gradient
+    Tensor x({5, 3}), w({3, 4}), b({4});
+    x = 1.f;
+    w = 0.5f;
+    b = 1.f;
+    auto b16 = b.to(Type::BFLOAT16);
+    w.requires_grad(true);
+    b16.requires_grad(true);
+
+    x.addmm(w, b16, Activation::RELU).sum().backward();
+
+    const Tensor b_grad = b16.grad(), w_grad = w.grad();
+    EXPECT_EQ(b_grad.dtype(), Type::BFLOAT16);
+    for (uint32_t j = 0; j < 4; j++) {
+        EXPECT_EQ((float)(b_grad[{j}]), 5.f);
+        for (uint32_t k = 0; k < 3; k++) EXPECT_EQ((float)(w_grad[{k, j}]), 5.f);
+    }
 }
\ No newline at end of file
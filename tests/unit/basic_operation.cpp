@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <cmath>
+
+#include <quantization.hpp>
+#include <serialization.hpp>
 #include <tensor.hpp>
 
 using namespace micro;
@@ -128,4 +132,637 @@ TEST(BasicTensorOperations, AssignToArrayOfElements) {
     EXPECT_EQ((float)t1[{0}], 0.1f);
     EXPECT_EQ((float)t1[{1}], 0.2f);
     EXPECT_EQ((float)t1[{2}], 0.3f);
+}
+
+TEST(BasicTensorOperations, ContiguousElementWise) {
+    uint32_t tensor_size = 37;
+    Tensor t1({tensor_size}), t2({tensor_size}), scalar({1});
+    for (uint32_t i = 0; i < tensor_size; i++) {
+        t1[{i}] = float(i);
+        t2[{i}] = 2.f;
+    }
+    scalar = 4.f;
+
+    auto sum = t1 + t2;
+    auto diff = scalar - t1;
+    auto prod = t1 * scalar;
+    auto quot = t1 / t2;
+
+    for (uint32_t i = 0; i < tensor_size; i++) {
+        EXPECT_EQ((float)sum[{i}], float(i) + 2.f);
+        EXPECT_EQ((float)diff[{i}], 4.f - float(i));
+        EXPECT_EQ((float)prod[{i}], float(i) * 4.f);
+        EXPECT_EQ((float)quot[{i}], float(i) / 2.f);
+    }
+}
+
+TEST(BasicTensorOperations, StridedElementWise) {
+    Tensor t1({2, 3}, Type::INT32), t2({3, 2}, Type::INT32);
+    t1 = {0, 1, 2, 3, 4, 5};
+    t2 = 10;
+
+    auto t3 = t2 + t1.transpose();
+    for (uint32_t i = 0; i < 3; i++) {
+        for (uint32_t j = 0; j < 2; j++) {
+            EXPECT_EQ((int32_t)(t3[{i, j}]), 10 + (int32_t)(t1[{j, i}]));
+        }
+    }
+}
+
+TEST(BasicTensorOperations, MatmulTensor) {
+    uint32_t M = 13, K = 300, N = 37;
+    Tensor t1({M, K}), t2({N, K});
+    for (uint32_t i = 0; i < M * K; i++) t1[{i / K, i % K}] = float(i % 7) - 3.f;
+    for (uint32_t i = 0; i < N * K; i++) t2[{i / K, i % K}] = float(i % 5) - 2.f;
+
+    auto t3 = t1.mm(t2.transpose());
+    for (uint32_t i = 0; i < M; i++) {
+        for (uint32_t j = 0; j < N; j++) {
+            float expected = 0.f;
+            for (uint32_t k = 0; k < K; k++) expected += (float)(t1[{i, k}]) * (float)(t2[{j, k}]);
+            EXPECT_EQ((float)(t3[{i, j}]), expected);
+        }
+    }
+}
+
+TEST(BasicTensorOperations, MatmulIntegerTensor) {
+    Tensor t1({2, 3}, Type::INT32), t2({3, 2}, Type::INT32), t3({3}, Type::INT32);
+    t1 = {1, -2, 3, -4, 5, -6};
+    t2 = {1, 2, 3, 4, 5, 6};
+    t3 = {1, 2, 3};
+
+    auto out = t1.mm(t2);
+    EXPECT_EQ((int32_t)(out[{0, 0}]), 10);
+    EXPECT_EQ((int32_t)(out[{0, 1}]), 12);
+    EXPECT_EQ((int32_t)(out[{1, 0}]), -19);
+    EXPECT_EQ((int32_t)(out[{1, 1}]), -24);
+
+    auto dot = t3.mm(t3);
+    EXPECT_EQ((int32_t)(dot[{0}]), 14);
+}
+
+TEST(BasicTensorOperations, BatchedBroadcastMatmul) {
+    Tensor t1({2, 1, 3, 4}), t2({5, 4, 2}), v({4});
+    for (uint32_t i = 0; i < 24; i++) t1[{i / 12, 0, (i / 4) % 3, i % 4}] = float(i);
+    for (uint32_t i = 0; i < 40; i++) t2[{i / 8, (i / 2) % 4, i % 2}] = float(i % 3);
+    v = {1.f, 2.f, 3.f, 4.f};
+
+    auto out = t1.mm(t2);
+    for (uint32_t b0 = 0; b0 < 2; b0++) {
+        for (uint32_t b1 = 0; b1 < 5; b1++) {
+            for (uint32_t m = 0; m < 3; m++) {
+                for (uint32_t n = 0; n < 2; n++) {
+                    float expected = 0.f;
+                    for (uint32_t k = 0; k < 4; k++) expected += (float)(t1[{b0, 0, m, k}]) * (float)(t2[{b1, k, n}]);
+                    EXPECT_EQ((float)(out[{b0, b1, m, n}]), expected);
+                }
+            }
+        }
+    }
+
+    auto row = v.mm(t2);
+    auto col = t1.mm(v);
+    for (uint32_t b = 0; b < 5; b++) {
+        for (uint32_t n = 0; n < 2; n++) {
+            float expected = 0.f;
+            for (uint32_t k = 0; k < 4; k++) expected += (float)(v[{k}]) * (float)(t2[{b, k, n}]);
+            EXPECT_EQ((float)(row[{b, n}]), expected);
+        }
+    }
+    for (uint32_t m = 0; m < 3; m++) {
+        float expected = 0.f;
+        for (uint32_t k = 0; k < 4; k++) expected += (float)(t1[{1, 0, m, k}]) * (float)(v[{k}]);
+        EXPECT_EQ((float)(col[{1, 0, m}]), expected);
+    }
+}
+
+TEST(BasicTensorOperations, TypeConversionAndPromotion) {
+    Tensor t1({3}, Type::INT32), t2({3}, Type::FLOAT32);
+    t1 = {-1, 2, 3};
+    t2 = 0.5f;
+
+    auto converted = t1.to(Type::FLOAT32);
+    EXPECT_EQ((float)(converted[{0}]), -1.f);
+
+    auto promoted = t1 + t2;
+    for (uint32_t i = 0; i < 3; i++) {
+        EXPECT_EQ((float)(promoted[{i}]), (float)(converted[{i}]) + 0.5f);
+    }
+}
+
+TEST(BasicTensorOperations, StorageIsCachedAndAligned) {
+    empty_cache();
+    auto& allocator = CachingAllocator::instance();
+
+    {
+        Tensor t1({1000});
+        EXPECT_EQ(allocator.cached_bytes(), 0u);
+    }
+    size_t cached = allocator.cached_bytes();
+    EXPECT_GE(cached, 1000 * sizeof(float));
+
+    Tensor t2({999});
+    EXPECT_EQ(allocator.cached_bytes(), 0u);
+    t2 = 1.f;
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&(float&)(t2[{0}])) % 64, 0u);
+
+    empty_cache();
+    EXPECT_EQ(allocator.cached_bytes(), 0u);
+}
+
+TEST(BasicTensorOperations, AssignmentReleasesStorage) {
+    auto& allocator = CachingAllocator::instance();
+
+    Tensor t({1000});
+    t = 1.f;
+    size_t allocated = allocator.allocated_bytes();
+
+    for (int i = 0; i < 10; i++) t = t + 1.f;
+    EXPECT_EQ(allocator.allocated_bytes(), allocated);
+    EXPECT_EQ((float)(t[{0}]), 11.f);
+
+    Tensor moved = std::move(t);
+    EXPECT_EQ(allocator.allocated_bytes(), allocated);
+    EXPECT_EQ((float)(moved[{999}]), 11.f);
+
+    Tensor copy({1000});
+    copy = moved;
+    EXPECT_EQ(allocator.allocated_bytes(), allocated);
+}
+
+TEST(BasicTensorOperations, ScalarOperationKeepsType) {
+    Tensor t1({2, 3}, Type::INT32);
+    t1 = {1, 2, 3, 4, 5, 6};
+
+    auto t2 = t1.transpose() * 2 - 1;
+    for (uint32_t i = 0; i < 3; i++) {
+        for (uint32_t j = 0; j < 2; j++) {
+            EXPECT_EQ((int32_t)(t2[{i, j}]), 2 * (int32_t)(t1[{j, i}]) - 1);
+        }
+    }
+
+    t2 = t1 / 2;
+    EXPECT_EQ((int32_t)(t2[{1, 2}]), 3);
+}
+
+TEST(BasicTensorOperations, HighRankBroadcast) {
+    Tensor t1({2, 3, 1, 4, 5}), t2({3, 2, 1, 5});
+    for (uint32_t i = 0; i < 120; i++) t1[{i / 60, i / 20 % 3, 0, i / 5 % 4, i % 5}] = float(i);
+    for (uint32_t i = 0; i < 30; i++) t2[{i / 10, i / 5 % 2, 0, i % 5}] = float(i) * 1000.f;
+
+    auto t3 = t1 + t2;
+    ASSERT_EQ(t3.size(), 2u * 3 * 2 * 4 * 5);
+    for (uint32_t a = 0; a < 2; a++) {
+        for (uint32_t b = 0; b < 3; b++) {
+            for (uint32_t c = 0; c < 2; c++) {
+                for (uint32_t d = 0; d < 4; d++) {
+                    for (uint32_t e = 0; e < 5; e++) {
+                        float expected = (float)(t1[{a, b, 0, d, e}]) + (float)(t2[{b, c, 0, e}]);
+                        EXPECT_EQ((float)(t3[{a, b, c, d, e}]), expected);
+                    }
+                }
+            }
+        }
+    }
+
+    auto t4 = t3.sum(2).sum(0);
+    for (uint32_t b = 0; b < 3; b++) {
+        for (uint32_t d = 0; d < 4; d++) {
+            for (uint32_t e = 0; e < 5; e++) {
+                float expected = 0.f;
+                for (uint32_t a = 0; a < 2; a++) {
+                    for (uint32_t c = 0; c < 2; c++) expected += (float)(t3[{a, b, c, d, e}]);
+                }
+                EXPECT_EQ((float)(t4[{b, d, e}]), expected);
+            }
+        }
+    }
+
+    auto t5 = t1.transpose(1, 4).to(Type::INT32);
+    EXPECT_EQ((int32_t)(t5[{1, 4, 0, 2, 1}]), (int32_t)(float)(t1[{1, 1, 0, 2, 4}]));
+}
+
+TEST(BasicTensorOperations, LazyElementWiseFusion) {
+    auto& allocator = CachingAllocator::instance();
+
+    Tensor a({64, 32}), b({32}), c({64, 1});
+    for (uint32_t i = 0; i < 64 * 32; i++) a[{i / 32, i % 32}] = float(i % 7);
+    for (uint32_t j = 0; j < 32; j++) b[{j}] = float(j) / 4.f;
+    for (uint32_t i = 0; i < 64; i++) c[{i, 0}] = float(i % 3) + 1.f;
+
+    auto expected = ((a * b + c) - a.transpose().transpose()) / c * 2.f;
+
+    size_t before = allocator.allocated_bytes();
+    size_t result_bytes;
+    {
+        Tensor probe({64, 32});
+        result_bytes = allocator.allocated_bytes() - before;
+    }
+
+    LazyGuard lazy;
+    auto d = a * b + c;
+    auto result = (d - a.transpose().transpose()) / c * 2.f;
+    EXPECT_EQ(allocator.allocated_bytes(), before);
+
+    // The first read evaluates the whole chain into a single buffer
+    float first = result[{0, 0}];
+    EXPECT_EQ(allocator.allocated_bytes(), before + result_bytes);
+    EXPECT_FLOAT_EQ(first, (float)(expected[{0, 0}]));
+
+    for (uint32_t i = 0; i < 64; i++) {
+        for (uint32_t j = 0; j < 32; j++) {
+            EXPECT_FLOAT_EQ((float)(result[{i, j}]), (float)(expected[{i, j}]));
+            EXPECT_FLOAT_EQ((float)(d[{i, j}]), (float)(a[{i, j}]) * (float)(b[{j}]) + (float)(c[{i, 0}]));
+        }
+    }
+}
+
+TEST(BasicTensorOperations, LazyOpsReadInputsBeforeInPlaceWrites) {
+    Tensor a({3}), b({3}), ones({3});
+    a = 1.f;
+    b = 2.f;
+    ones = 1.f;
+
+    Tensor sum, scaled, twice_sum, view_sum, assigned;
+    {
+        LazyGuard lazy;
+        sum = a + b;
+        scaled = b * 2.f;
+        twice_sum = sum * 2.f;
+        view_sum = a.slice(0, 1, 3) + 1.f;
+        assigned = ones * 3.f;
+    }
+
+    // Every kind of write in place leaves the results recorded before it alone. Writing to a
+    // result reaches the expressions that were still reading it as well
+    a += 10.f;
+    b.copy_from(ones);
+    ones = 5.f;
+    sum *= 10.f;
+    EXPECT_EQ((float)(sum[{0}]), 30.f);
+    EXPECT_EQ((float)(twice_sum[{1}]), 6.f);
+    EXPECT_EQ((float)(scaled[{0}]), 4.f);
+    EXPECT_EQ((float)(view_sum[{0}]), 2.f);
+    EXPECT_EQ((float)(assigned[{2}]), 3.f);
+
+    Tensor later;
+    {
+        LazyGuard lazy;
+        later = a - 1.f;
+    }
+    a[{2}] = 0.f;
+    a = std::vector<Element>{0.f, 0.f, 0.f};
+    EXPECT_EQ((float)(later[{2}]), 10.f);
+}
+
+TEST(BasicTensorOperations, ReductionsOverDims) {
+    Tensor t1({2, 3, 4});
+    for (uint32_t i = 0; i < 24; i++) t1[{i / 12, (i / 4) % 3, i % 4}] = float((i * 7) % 11) - 5.f;
+
+    auto value = [&](uint32_t a, uint32_t b, uint32_t c) { return float(((a * 12 + b * 4 + c) * 7) % 11) - 5.f; };
+
+    auto t2 = t1.sum({0, 2});
+    ASSERT_EQ(t2.size(), 3u);
+    for (uint32_t b = 0; b < 3; b++) {
+        float expected = 0;
+        for (uint32_t a = 0; a < 2; a++)
+            for (uint32_t c = 0; c < 4; c++) expected += value(a, b, c);
+        EXPECT_FLOAT_EQ((float)t2[{b}], expected);
+    }
+
+    auto t3 = t1.max(1, true);
+    auto t4 = t1.argmin(1, true);
+    ASSERT_EQ(t3.size(), 8u);
+    for (uint32_t a = 0; a < 2; a++) {
+        for (uint32_t c = 0; c < 4; c++) {
+            uint32_t lowest = 0;
+            float highest = value(a, 0, c);
+            for (uint32_t b = 1; b < 3; b++) {
+                highest = std::max(highest, value(a, b, c));
+                if (value(a, b, c) < value(a, lowest, c)) lowest = b;
+            }
+            EXPECT_EQ(float(t3[{a, 0, c}]), highest);
+            EXPECT_EQ(uint32_t(t4[{a, 0, c}]), lowest);
+        }
+    }
+
+    // Reducing a transposed view walks its input with strides
+    auto t5 = t1.transpose(0, 2).min(1);
+    for (uint32_t c = 0; c < 4; c++) {
+        for (uint32_t a = 0; a < 2; a++) {
+            float lowest = value(a, 0, c);
+            for (uint32_t b = 1; b < 3; b++) lowest = std::min(lowest, value(a, b, c));
+            EXPECT_EQ(float(t5[{c, a}]), lowest);
+        }
+    }
+
+    float total = 0;
+    for (uint32_t i = 0; i < 24; i++) total += float((i * 7) % 11) - 5.f;
+    EXPECT_FLOAT_EQ((float)t1.sum()[{0}], total);
+    EXPECT_EQ((uint32_t)t1.argmax()[{0}], 3u);
+}
+
+TEST(BasicTensorOperations, MeanProdVar) {
+    Tensor t1({2, 3});
+    t1 = {1.f, 2.f, 3.f, 4.f, 6.f, 8.f};
+
+    auto mean = t1.mean(1);
+    EXPECT_FLOAT_EQ((float)mean[{0}], 2.f);
+    EXPECT_FLOAT_EQ((float)mean[{1}], 6.f);
+
+    auto prod = t1.prod(0);
+    EXPECT_FLOAT_EQ((float)prod[{0}], 4.f);
+    EXPECT_FLOAT_EQ((float)prod[{1}], 12.f);
+    EXPECT_FLOAT_EQ((float)prod[{2}], 24.f);
+
+    auto var = t1.var(1);
+    EXPECT_FLOAT_EQ((float)var[{0}], 1.f);
+    EXPECT_FLOAT_EQ((float)var[{1}], 4.f);
+    EXPECT_FLOAT_EQ((float)t1.var(1, false)[{1}], 8.f / 3.f);
+
+    Tensor t2({4}, Type::INT32);
+    t2 = {3, -1, 7, 7};
+    EXPECT_EQ((int32_t)t2.max()[{0}], 7);
+    EXPECT_EQ((int32_t)t2.prod()[{0}], -147);
+    EXPECT_EQ((uint32_t)t2.argmax()[{0}], 2u);
+
+    // Integer tensors average in FLOAT32
+    EXPECT_EQ(t2.mean().dtype(), Type::FLOAT32);
+    EXPECT_FLOAT_EQ((float)t2.mean()[{0}], 4.f);
+    EXPECT_FLOAT_EQ((float)t2.var()[{0}], 44.f / 3.f);
+
+    Tensor t3({4}, Type::UINT8);
+    t3 = {1, 2, 3, 4};
+    EXPECT_FLOAT_EQ((float)t3.mean()[{0}], 2.5f);
+    EXPECT_FLOAT_EQ((float)t3.var(0, false)[{0}], 1.25f);
+}
+
+TEST(BasicTensorOperations, LongSumsStayAccurate) {
+    // A running float sum of 0.1 drifts by several percent over this many elements
+    uint32_t n = 1 << 23;
+    Tensor t1({n});
+    t1 = 0.1f;
+    EXPECT_NEAR((float)t1.sum()[{0}], 0.1 * n, 0.1 * n * 1e-5);
+
+    // Columns summed down a tall matrix, the rows staying contiguous
+    Tensor t2({100000, 3});
+    t2 = 0.1f;
+    auto t3 = t2.sum(0);
+    for (uint32_t j = 0; j < 3; j++) EXPECT_NEAR((float)t3[{j}], 10000.0, 1e-1);
+}
+
+TEST(BasicTensorOperations, ExpandSharesStorage) {
+    Tensor t1({3, 1});
+    t1 = {1.f, 2.f, 3.f};
+
+    auto t2 = t1.expand({2, 3, 4});
+    ASSERT_EQ(t2.size(), 24u);
+    EXPECT_FALSE(t2.is_contiguous());
+
+    // Writes to the source show through every broadcast copy
+    t1[{1, 0}] = 5.f;
+    for (uint32_t i = 0; i < 24; i++) {
+        EXPECT_EQ(float(t2[{i / 12, (i / 4) % 3, i % 4}]), float(t1[{(i / 4) % 3, 0}]));
+    }
+
+    Tensor t3({4});
+    t3 = {1.f, 2.f, 3.f, 4.f};
+    auto t4 = t2 * t3;
+    auto t5 = t3.broadcast_to({3, 4}).sum(0);
+    EXPECT_EQ(float(t4[{1, 2, 3}]), 12.f);
+    EXPECT_EQ((float)t5[{3}], 12.f);
+    EXPECT_FLOAT_EQ((float)t2.sum()[{0}], 72.f);
+}
+
+TEST(BasicTensorOperations, ViewsShareStorage) {
+    Tensor t1({4, 6});
+    for (uint32_t i = 0; i < 24; i++) t1[{i / 6, i % 6}] = float(i);
+
+    auto t2 = t1.view({2, 3, 4});
+    EXPECT_EQ(float(t2[{1, 2, 3}]), 23.f);
+
+    auto t3 = t1.slice(1, 1, 6, 2);
+    ASSERT_EQ(t3.size(), 12u);
+    EXPECT_EQ(float(t3[{2, 1}]), 15.f);
+
+    auto t4 = t1.narrow(0, 1, 2).select(1, 4);
+    ASSERT_EQ(t4.size(), 2u);
+    EXPECT_EQ((float)t4[{1}], 16.f);
+
+    auto t5 = t2.permute({2, 0, 1}).unsqueeze(1);
+    ASSERT_EQ(t5.size(), 24u);
+    EXPECT_EQ(float(t5[{3, 0, 1, 2}]), 23.f);
+    EXPECT_EQ(t5.squeeze().size(), 24u);
+
+    // Flattening a transposed tensor needs a copy, which reshape makes and view refuses to
+    auto t6 = t1.transpose().reshape({24});
+    EXPECT_EQ((float)t6[{1}], 6.f);
+    EXPECT_TRUE(t1.transpose().contiguous().is_contiguous());
+
+    // Writes through a view land in the viewed tensor
+    t1.slice(1, 0, 6, 3) = 0.f;
+    t1.narrow(0, 3, 1) += 100.f;
+    EXPECT_EQ(float(t1[{1, 3}]), 0.f);
+    EXPECT_EQ(float(t1[{1, 4}]), 10.f);
+    EXPECT_EQ(float(t1[{3, 1}]), 119.f);
+    EXPECT_EQ(float(t2[{1, 2, 3}]), 123.f);
+    EXPECT_EQ(float(t3[{2, 1}]), 0.f);
+
+    t1.transpose().select(0, 5) = {1.f, 2.f, 3.f, 4.f};
+    EXPECT_EQ(float(t1[{2, 5}]), 3.f);
+}
+
+TEST(BasicTensorOperations, OpsOnSlicedBatches) {
+    Tensor data({8, 3}), w({3, 2});
+    for (uint32_t i = 0; i < 24; i++) data[{i / 3, i % 3}] = float(i % 5);
+    for (uint32_t i = 0; i < 6; i++) w[{i / 2, i % 2}] = float(i) - 2.f;
+
+    auto batch = data.narrow(0, 4, 4);
+    auto out = batch.mm(w) + data.select(0, 0).slice(0, 0, 2);
+    for (uint32_t r = 0; r < 4; r++) {
+        for (uint32_t c = 0; c < 2; c++) {
+            float expected = float(data[{0, c}]);
+            for (uint32_t k = 0; k < 3; k++) expected += float(data[{r + 4, k}]) * float(w[{k, c}]);
+            EXPECT_EQ(float(out[{r, c}]), expected);
+        }
+    }
+}
+
+TEST(BasicTensorOperations, HalfPrecisionStorage) {
+    Tensor t1({4});
+    t1 = {1.f, -2.5f, 1.f / 3.f, 70000.f};
+
+    // Elements of 16-bit float tensors are read through const tensors, they can't be referenced in place
+    const auto half = t1.to(Type::FLOAT16);
+    const auto bf16 = t1.to(Type::BFLOAT16);
+    EXPECT_EQ(half.number_bytes(), 8u);
+    EXPECT_EQ((float)(half[{1}]), -2.5f);
+    EXPECT_NEAR((float)(half[{2}]), 1.f / 3.f, 1e-3);
+    EXPECT_TRUE(std::isinf((float)(half[{3}])));
+    EXPECT_NEAR((float)(bf16[{2}]), 1.f / 3.f, 1e-2);
+    EXPECT_NEAR((float)(bf16[{3}]), 70000.f, 70000.f / 128);
+
+    // Same-type ops keep the 16-bit dtype, mixed with float they promote to float
+    Tensor t2({4});
+    t2 = 0.5f;
+    const auto sum = half + half.to(Type::FLOAT16) * 2.f;
+    EXPECT_EQ(sum.dtype(), Type::FLOAT16);
+    EXPECT_EQ((float)(sum[{1}]), -7.5f);
+    EXPECT_EQ((half + t2).dtype(), Type::FLOAT32);
+    EXPECT_EQ((float)((bf16 + t2)[{0}]), 1.5f);
+
+    // A sum accumulates in float: a 16-bit running sum of 1s would get stuck at 2048 (256 for bf16)
+    Tensor ones({10000});
+    ones = 1.f;
+    const auto half_sum = ones.to(Type::FLOAT16).sum(), bf16_sum = ones.to(Type::BFLOAT16).sum();
+    EXPECT_EQ((float)(half_sum[{0}]), 10000.f);
+    EXPECT_EQ((float)(bf16_sum[{0}]), 9984.f);
+}
+
+TEST(BasicTensorOperations, HalfPrecisionMatmul) {
+    uint32_t M = 9, K = 700, N = 21;
+    Tensor t1({M, K}), t2({K, N});
+    for (uint32_t i = 0; i < M * K; i++) t1[{i / K, i % K}] = float(i % 7) - 3.f;
+    for (uint32_t i = 0; i < K * N; i++) t2[{i / N, i % N}] = float(i % 5) - 2.f;
+
+    auto expected = t1.mm(t2);
+    const auto half = t1.to(Type::FLOAT16).mm(t2.to(Type::FLOAT16));
+    auto mixed = t1.to(Type::BFLOAT16).mm(t2);
+    EXPECT_EQ(half.dtype(), Type::FLOAT16);
+    EXPECT_EQ(mixed.dtype(), Type::FLOAT32);
+
+    // Small integers are exact in every format and the products are summed in float
+    for (uint32_t i = 0; i < M; i++) {
+        for (uint32_t j = 0; j < N; j++) {
+            EXPECT_EQ(float(half[{i, j}]), float(expected[{i, j}]));
+            EXPECT_EQ(float(mixed[{i, j}]), float(expected[{i, j}]));
+        }
+    }
+}
+
+TEST(BasicTensorOperations, QuantizeDequantize) {
+    Tensor t1({2, 3});
+    t1 = {-1.f, -0.5f, 0.f, 0.25f, 0.5f, 1.f};
+
+    // Per tensor, with a scale that is exact in float: dequantizing gives the values back
+    const auto q = t1.quantize(QuantParams(0.25f, 10), Type::UINT8);
+    EXPECT_EQ(q.dtype(), Type::UINT8);
+    EXPECT_EQ(q.number_bytes(), 6u);
+    EXPECT_EQ((uint8_t)(q[{0, 0}]), 6);
+    EXPECT_EQ((uint8_t)(q[{0, 1}]), 8);
+    EXPECT_EQ((uint8_t)(q[{1, 2}]), 14);
+
+    // Params from a range map it onto [0, 255], within half a step of every value
+    auto params = QuantParams::from_range(-1.f, 1.f, Type::UINT8);
+    const auto exact = q.dequantize(), back = t1.quantize(params, Type::UINT8).dequantize();
+    for (uint32_t i = 0; i < 6; i++) {
+        EXPECT_EQ((float)(exact[{i / 3, i % 3}]), (float)(t1[{i / 3, i % 3}]));
+        EXPECT_NEAR((float)(back[{i / 3, i % 3}]), (float)(t1[{i / 3, i % 3}]), params.scales[0] / 2);
+    }
+
+    // Per channel along dim 1: each column gets a symmetric int8 scale of its own
+    auto channel_params = QuantParams::per_channel_from(t1, 1);
+    EXPECT_EQ(channel_params.scales.size(), 3u);
+    EXPECT_FLOAT_EQ(channel_params.scales[1], 0.5f / 127.5f);
+    const auto per_channel = t1.quantize(channel_params);
+    EXPECT_EQ((int8_t)(per_channel[{0, 1}]), -127);
+    EXPECT_EQ((int8_t)(per_channel[{1, 1}]), 127);
+    EXPECT_EQ((int8_t)(per_channel[{0, 2}]), 0);
+
+    // Values past the range are clamped
+    Tensor big({1});
+    big = 10.f;
+    const auto clamped = big.quantize(QuantParams(0.01f, 0));
+    EXPECT_EQ((int8_t)(clamped[{0}]), 127);
+
+    // Params that don't fit a tensor, as a corrupted checkpoint could hold, are rejected
+    EXPECT_TRUE(channel_params.check({2, 3}, Type::INT8).empty());
+    EXPECT_FALSE(channel_params.check({2, 3}, Type::FLOAT32).empty());
+    EXPECT_FALSE(channel_params.check({3, 2}, Type::INT8).empty());
+    EXPECT_FALSE(channel_params.check({3}, Type::INT8).empty());
+    EXPECT_FALSE(QuantParams(0.f, 0).check({2, 3}, Type::INT8).empty());
+    EXPECT_FALSE(QuantParams(std::nanf(""), 0).check({2, 3}, Type::INT8).empty());
+    EXPECT_FALSE(QuantParams(1.f, 200).check({2, 3}, Type::INT8).empty());
+    EXPECT_FALSE(QuantParams({1.f}, {0}, 5).check({2, 3}, Type::INT8).empty());
+}
+
+TEST(BasicTensorOperations, Int8Matmul) {
+    // K isn't a multiple of the 4-byte groups and the right input is a transposed view
+    uint32_t M = 7, K = 37, N = 45;
+    Tensor a({M, K}), b({N, K});
+    for (uint32_t i = 0; i < M * K; i++) a[{i / K, i % K}] = float(int32_t(i * 7 % 255) - 128);
+    for (uint32_t i = 0; i < N * K; i++) b[{i / K, i % K}] = float(int32_t(i * 13 % 255) - 128);
+
+    auto expected = a.mm(b.transpose());
+    auto product = a.to(Type::INT8).mm(b.to(Type::INT8).transpose());
+    EXPECT_EQ(product.dtype(), Type::INT32);
+    for (uint32_t i = 0; i < M; i++) {
+        for (uint32_t j = 0; j < N; j++) EXPECT_EQ(float(int32_t(product[{i, j}])), float(expected[{i, j}]));
+    }
+
+    // Quantized uint8 activations times per-channel int8 weights match the float product of the
+    // values they stand for
+    Tensor x({3, M, K}), w({K, N});
+    for (uint32_t i = 0; i < 3 * M * K; i++) x[{i / (M * K), i / K % M, i % K}] = float(i % 11) / 10.f;
+    for (uint32_t i = 0; i < K * N; i++) w[{i / N, i % N}] = float(int32_t(i % 9) - 4) * float(i % N + 1) / 50.f;
+
+    Calibrator calibrator;
+    calibrator.observe("x", x);
+    EXPECT_EQ(calibrator.range("x"), std::make_pair(0.f, 1.f));
+
+    const auto xq = x.quantize(calibrator.params("x", Type::UINT8), Type::UINT8);
+    const auto wq = w.quantize(QuantParams::per_channel_from(w, 1));
+    auto out = xq.mm(wq);
+    auto reference = xq.dequantize().mm(wq.dequantize());
+    EXPECT_EQ(out.dtype(), Type::FLOAT32);
+    for (uint32_t i = 0; i < 3 * M * N; i++) {
+        float value = out[{i / (M * N), i / N % M, i % N}];
+        float target = reference[{i / (M * N), i / N % M, i % N}];
+        EXPECT_NEAR(value, target, 1e-4f * (1.f + std::abs(target)));
+    }
+}
+
+TEST(BasicTensorOperations, SaveAndLoad) {
+    Tensor w({3, 4}), b({4});
+    for (uint32_t i = 0; i < 12; i++) w[{i / 4, i % 4}] = float(i) / 4.f;
+    b = {1.f, 2.f, 3.f, 4.f};
+
+    // Views are saved as the elements they cover; half and quantized tensors keep their format
+    const std::string path = testing::TempDir() + "micro_torch_save_and_load.ckpt";
+    save(path, {{"w", w}, {"w_t", w.transpose()}, {"b_half", b.to(Type::FLOAT16)},
+                {"w_q", w.quantize(QuantParams::per_channel_from(w, 1))}});
+
+    auto loaded = load(path);
+    ASSERT_EQ(loaded.size(), 4u);
+    const Tensor w_t = loaded["w_t"], b_half = loaded["b_half"], w_q = loaded["w_q"];
+    EXPECT_EQ(b_half.dtype(), Type::FLOAT16);
+    EXPECT_EQ((float)(b_half[{3}]), 4.f);
+    EXPECT_EQ((float)(w_t[{3, 1}]), (float)(w[{1, 3}]));
+    EXPECT_TRUE(w_q.quant_params().per_channel());
+    EXPECT_EQ(w_q.quant_params().scales, QuantParams::per_channel_from(w, 1).scales);
+
+    const auto w_back = w_q.dequantize(), expected = w.quantize(QuantParams::per_channel_from(w, 1)).dequantize();
+    for (uint32_t i = 0; i < 12; i++) EXPECT_EQ((float)(w_back[{i / 4, i % 4}]), (float)(expected[{i / 4, i % 4}]));
+
+    // Loaded tensors are ordinary tensors, and writing to them leaves the file untouched
+    Tensor& loaded_w = loaded["w"];
+    EXPECT_EQ((float)((loaded_w + 1.f).sum()[{0}]), (float)((w + 1.f).sum()[{0}]));
+    loaded_w = 0.f;
+    EXPECT_EQ((float)(load(path)["w"][{2, 3}]), 2.75f);
+    std::remove(path.c_str());
+}
+
+TEST(BasicTensorOperations, SaveAsyncSnapshots) {
+    Tensor w({256, 256});
+    w = 1.f;
+
+    // The checkpoint holds the values at the call, not the updates made while it is written
+    const std::string path = testing::TempDir() + "micro_torch_save_async.ckpt";
+    auto saved = save_async(path, {{"w", w}});
+    w = 2.f;
+    saved.wait();
+
+    auto loaded = load(path);
+    EXPECT_EQ((float)(loaded["w"].sum()[{0}]), 256.f * 256.f);
+    std::remove(path.c_str());
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <set>
+#include <thread>
+
+#include <data_loader.hpp>
+#include <serialization.hpp>
+#include <tensor.hpp>
+#include <thread_pool.hpp>
+
+using namespace micro;
+
+TEST(Parallel, ParallelForCoversRange) {
+    uint32_t threads = get_num_threads();
+    set_num_threads(4);
+
+    std::vector<int32_t> hits(100000, 0);
+    parallel_for(0, hits.size(), 1000, [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; i++) hits[i]++;
+    });
+
+    for (auto hit : hits) EXPECT_EQ(hit, 1);
+
+    set_num_threads(threads);
+}
+
+TEST(Parallel, ParallelKernels) {
+    uint32_t threads = get_num_threads();
+    set_num_threads(4);
+
+    uint32_t rows = 300, cols = 400;
+    Tensor t1({rows, cols}), t2({cols, rows});
+    t1 = 1.f;
+    t2 = 2.f;
+
+    auto sum = t1 + t1;
+    auto reduced = t1.sum(1);
+    auto product = t1.mm(t2);
+
+    for (uint32_t i = 0; i < rows; i++) {
+        EXPECT_EQ((float)(sum[{i, i}]), 2.f);
+        EXPECT_EQ((float)(reduced[{i}]), float(cols));
+        for (uint32_t j = 0; j < rows; j++) {
+            EXPECT_EQ((float)(product[{i, j}]), 2.f * cols);
+        }
+    }
+
+    set_num_threads(threads);
+}
+
+TEST(Parallel, TensorsSharedAcrossThreads) {
+    auto& allocator = CachingAllocator::instance();
+
+    Tensor shared({1024});
+    shared = 3.f;
+    size_t allocated = allocator.allocated_bytes();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < 10000; j++) {
+                Tensor copy = shared;
+                Tensor moved = std::move(copy);
+                EXPECT_EQ((float)(moved[{7}]), 3.f);
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    EXPECT_EQ(allocator.allocated_bytes(), allocated);
+    EXPECT_EQ((float)(shared[{7}]), 3.f);
+}
+
+TEST(Parallel, DataLoaderShufflesEpochs) {
+    // Row i of x holds 2i and 2i + 1, and y[i] = i, so every batch can be checked against its labels
+    uint32_t samples = 10;
+    Tensor x({samples, 2}), y({samples}, Type::UINT32);
+    for (uint32_t i = 0; i < samples; i++) {
+        x[{i, 0}] = float(2 * i);
+        x[{i, 1}] = float(2 * i + 1);
+        y[{i}] = i;
+    }
+
+    auto run_epochs = [&](DataLoader& loader) {
+        std::vector<uint32_t> visited;
+        std::vector<Tensor> batch;
+        for (int epoch = 0; epoch < 2; epoch++) {
+            std::vector<uint32_t> sizes;
+            while (loader.next(batch)) {
+                const Tensor &xb = batch[0], &yb = batch[1];
+                uint32_t rows = xb.size() / 2;
+                sizes.push_back(rows);
+                for (uint32_t r = 0; r < rows; r++) {
+                    uint32_t label = yb[{r}];
+                    EXPECT_EQ((float)(xb[{r, 1}]), float(2 * label + 1));
+                    visited.push_back(label);
+                }
+            }
+            EXPECT_EQ(sizes, (std::vector<uint32_t>{4, 4, 2}));
+        }
+        return visited;
+    };
+
+    DataLoader loader({x, y}, 4, true, 7);
+    EXPECT_EQ(loader.batches_per_epoch(), 3u);
+    auto visited = run_epochs(loader);
+
+    // Each epoch visits every sample once, in an order of its own that the seed reproduces
+    std::vector<uint32_t> first(visited.begin(), visited.begin() + samples);
+    std::vector<uint32_t> second(visited.begin() + samples, visited.end());
+    EXPECT_EQ(std::set<uint32_t>(first.begin(), first.end()).size(), samples);
+    EXPECT_EQ(std::set<uint32_t>(second.begin(), second.end()).size(), samples);
+    EXPECT_NE(first, second);
+
+    DataLoader same_seed({x, y}, 4, true, 7, false, 3, 2);
+    EXPECT_EQ(run_epochs(same_seed), visited);
+}
+
+TEST(Parallel, DataLoaderFromRawFile) {
+    // 100 samples of 3 floats, written as raw elements after a 16-byte preamble
+    const std::string path = testing::TempDir() + "micro_torch_raw_samples.bin";
+    {
+        std::ofstream file(path, std::ios::binary);
+        std::vector<char> preamble(16);
+        file.write(preamble.data(), preamble.size());
+        for (int i = 0; i < 300; i++) {
+            float value = float(i);
+            file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+    }
+
+    // Batches come in order without shuffle; drop_last skips the 4 samples left over
+    DataLoader loader({load_raw(path, {100, 3}, Type::FLOAT32, 16)}, 32, false, 0, true);
+    std::vector<Tensor> batch;
+    uint32_t batches = 0;
+    while (loader.next(batch)) {
+        const Tensor& rows = batch[0];
+        EXPECT_EQ(rows.size(), 96u);
+        EXPECT_EQ((float)(rows[{31, 2}]), float((batches * 32 + 31) * 3 + 2));
+        batches++;
+    }
+    EXPECT_EQ(batches, 3u);
+    std::remove(path.c_str());
+}
@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 #include <stdlib.h>
 
+#include <graph_capture.hpp>
+#include <linear.hpp>
+#include <serialization.hpp>
 #include <tensor.hpp>
 
 using namespace micro;
@@ -138,3 +141,99 @@ TEST(SimpleML, SimpleMLORGate) {
     EXPECT_GE((float)(pred[{2, 0}]), 0.5f);
     EXPECT_GE((float)(pred[{3, 0}]), 0.5f);
 }
+
+TEST(SimpleML, CapturedStepMatchesEagerTraining) {
+    float lr = 0.1;
+
+    Tensor data({4, 2}), out({4, 1});
+    data = {0.f, 0.f, 0.f, 1.f, 1.f, 0.f, 1.f, 1.f};
+    out = {0.f, 1.f, 1.f, 1.f};
+
+    Tensor init_weights({2, 1}), init_bias({1});
+    init_weights = {rand() / (float)RAND_MAX, rand() / (float)RAND_MAX};
+    init_bias = {rand() / (float)RAND_MAX};
+
+    auto make_params = [&](Tensor& weights, Tensor& bias) {
+        weights = Tensor({2, 1});
+        bias = Tensor({1});
+        weights.copy_from(init_weights);
+        bias.copy_from(init_bias);
+        weights.requires_grad(true);
+        bias.requires_grad(true);
+    };
+
+    auto train_step = [&](Tensor& weights, Tensor& bias) {
+        auto pred = data.mm(weights) + bias;
+        auto loss = pred - out;
+        loss = (loss * loss).sum(0);
+        loss.backward();
+
+        NoGradGuard no_grad;
+        weights -= weights.grad() * lr;
+        bias -= bias.grad() * lr;
+    };
+
+    Tensor eager_weights, eager_bias;
+    make_params(eager_weights, eager_bias);
+    for (int i = 0; i < 50; i++) {
+        eager_weights.reset_grad();
+        eager_bias.reset_grad();
+        train_step(eager_weights, eager_bias);
+    }
+
+    Tensor weights, bias;
+    make_params(weights, bias);
+    auto step = CapturedGraph::capture([&] { train_step(weights, bias); });
+    for (int i = 1; i < 50; i++) step.replay();
+
+    EXPECT_FLOAT_EQ((float)(weights[{0, 0}]), (float)(eager_weights[{0, 0}]));
+    EXPECT_FLOAT_EQ((float)(weights[{1, 0}]), (float)(eager_weights[{1, 0}]));
+    EXPECT_FLOAT_EQ((float)(bias[{0}]), (float)(eager_bias[{0}]));
+}
+
+TEST(SimpleML, LinearLayersLearnXor) {
+    /**
+     * [0 0 0]
+     * [0 1 1]
+     * [1 0 1]
+     * [1 1 0]
+     */
+
+    Tensor data({4, 2}), out({4, 1});
+    data = {0.f, 0.f, 0.f, 1.f, 1.f, 0.f, 1.f, 1.f};
+    out = {0.f, 1.f, 1.f, 0.f};
+
+    nn::Linear hidden(2, 16, Activation::RELU, 1), output(16, 1, Activation::NONE, 2);
+
+    float lr = 0.05;
+    for (int i = 0; i < 500; i++) {
+        auto loss = output(hidden(data)) - out;
+        loss = (loss * loss).sum(0);
+
+        for (auto* param : {&hidden.weight, &hidden.bias, &output.weight, &output.bias}) param->reset_grad();
+        loss.backward();
+
+        NoGradGuard no_grad;
+        for (auto* param : {&hidden.weight, &hidden.bias, &output.weight, &output.bias}) *param -= param->grad() * lr;
+    }
+
+    auto pred = output(hidden(data));
+    EXPECT_LE((float)(pred[{0, 0}]), 0.5f);
+    EXPECT_GE((float)(pred[{1, 0}]), 0.5f);
+    EXPECT_GE((float)(pred[{2, 0}]), 0.5f);
+    EXPECT_LE((float)(pred[{3, 0}]), 0.5f);
+
+    // The trained parameters go through a checkpoint into fresh layers
+    const std::string path = testing::TempDir() + "micro_torch_xor.ckpt";
+    auto parameters = hidden.parameters("hidden.");
+    parameters.merge(output.parameters("output."));
+    save(path, parameters);
+
+    nn::Linear loaded_hidden(2, 16, Activation::RELU), loaded_output(16, 1);
+    auto loaded = load(path);
+    loaded_hidden.load_parameters(loaded, "hidden.");
+    loaded_output.load_parameters(loaded, "output.");
+    auto loaded_pred = loaded_output(loaded_hidden(data));
+    for (uint32_t i = 0; i < 4; i++) EXPECT_EQ((float)(loaded_pred[{i, 0}]), (float)(pred[{i, 0}]));
+    std::remove(path.c_str());
+}